@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+//---------------------------------------------------------------
+//
+// SExprAllocator - where every 'new List/Atom/IntNumber/...' goes
+//
+//---------------------------------------------------------------
+//
+//  ISExpr overrides operator new and asks SExprAllocator::current()
+//  for memory. LInterpreter switches the current allocator with
+//  AllocatorScope: the parser allocates the form in the evaluation
+//  region (Arena), builtins allocate their results in the garbage
+//  collected heap (GcHeap.h).
+//
+//---------------------------------------------------------------
+
+class SExprAllocator
+{
+    static inline thread_local SExprAllocator* gCurrent = nullptr;
+
+public:
+    virtual ~SExprAllocator() = default;
+
+    virtual void* allocate( size_t size ) = 0;
+
+    // memory that is not an ISExpr (names of atoms and builtins)
+    virtual void* allocateRaw( size_t size ) { return allocate( size ); }
+
+    static SExprAllocator* current();
+    static void setCurrent( SExprAllocator* allocator ) { gCurrent = allocator; }
+};
+
+//------------------------
+// AllocatorScope
+//------------------------
+class AllocatorScope
+{
+    SExprAllocator* m_saved;
+
+public:
+    AllocatorScope( SExprAllocator& allocator ) : m_saved( SExprAllocator::current() ) { SExprAllocator::setCurrent( &allocator ); }
+    ~AllocatorScope() { SExprAllocator::setCurrent( m_saved ); }
+
+    AllocatorScope( const AllocatorScope& ) = delete;
+    AllocatorScope& operator=( const AllocatorScope& ) = delete;
+};
+
+//------------------------
+// Arena (region allocator)
+//------------------------
+//
+//  Bump pointer allocation from big chunks.
+//  Nothing is freed one by one: reset() releases the whole region at once.
+//
+class Arena : public SExprAllocator
+{
+    struct Chunk
+    {
+        Chunk*  m_next;
+        size_t  m_size;
+
+        char* begin() { return reinterpret_cast<char*>(this+1); }
+        char* end()   { return begin() + m_size; }
+    };
+
+    // s-expressions hold pointers and 8-byte numbers only: a list cell takes 24 bytes, not 32
+    static constexpr size_t cAlignment = alignof(void*);
+
+    Chunk*  m_chunks = nullptr;
+    char*   m_cursor = nullptr;
+    char*   m_end    = nullptr;
+    size_t  m_chunkSize;
+
+    // statistics
+    uint64_t m_allocationCount = 0;
+    uint64_t m_bytesAllocated  = 0;
+
+public:
+    Arena( size_t chunkSize = 64*1024 ) : m_chunkSize(chunkSize) {}
+    ~Arena() { freeChunks( nullptr ); }
+
+    Arena( const Arena& ) = delete;
+    Arena& operator=( const Arena& ) = delete;
+
+    void* allocate( size_t size ) override
+    {
+        size = (size + cAlignment - 1) & ~(cAlignment - 1);
+
+        if ( size_t(m_end - m_cursor) < size )
+        {
+            addChunk( size );
+        }
+
+        void* result = m_cursor;
+        m_cursor += size;
+
+        m_allocationCount++;
+        m_bytesAllocated += size;
+        return result;
+    }
+
+    bool contains( const void* ptr ) const
+    {
+        for( Chunk* it = m_chunks; it != nullptr; it = it->m_next )
+        {
+            if ( ptr >= it->begin() && ptr < it->end() )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // releases everything allocated so far (the first chunk is kept for reuse)
+    void reset()
+    {
+        if ( m_chunks == nullptr )
+        {
+            return;
+        }
+
+        Chunk* last = m_chunks;
+        while( last->m_next != nullptr )
+        {
+            last = last->m_next;
+        }
+
+        freeChunks( last );
+        m_chunks = last;
+        m_cursor = last->begin();
+        m_end    = last->end();
+    }
+
+    uint64_t allocationCount() const { return m_allocationCount; }
+    uint64_t bytesAllocated() const { return m_bytesAllocated; }
+
+private:
+    void addChunk( size_t minSize )
+    {
+        size_t size = (minSize > m_chunkSize) ? minSize : m_chunkSize;
+
+        auto* chunk = static_cast<Chunk*>( std::malloc( sizeof(Chunk) + size ) );
+        if ( chunk == nullptr )
+        {
+            throw std::bad_alloc();
+        }
+        chunk->m_next = m_chunks;
+        chunk->m_size = size;
+
+        m_chunks = chunk;
+        m_cursor = chunk->begin();
+        m_end    = chunk->end();
+    }
+
+    // frees chunks from the head of the list up to 'keep' (not including it)
+    void freeChunks( Chunk* keep )
+    {
+        while( m_chunks != nullptr && m_chunks != keep )
+        {
+            Chunk* next = m_chunks->m_next;
+            std::free( m_chunks );
+            m_chunks = next;
+        }
+        if ( m_chunks == nullptr )
+        {
+            m_cursor = m_end = nullptr;
+        }
+    }
+};
+
+// memory allocated before any interpreter sets up its regions
+// (one per thread, released when the thread ends)
+inline SExprAllocator* SExprAllocator::current()
+{
+    if ( gCurrent == nullptr )
+    {
+        static thread_local Arena gDefaultArena;
+        return &gDefaultArena;
+    }
+    return gCurrent;
+}
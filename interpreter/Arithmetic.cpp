@@ -0,0 +1,131 @@
+#include "Arithmetic.h"
+
+static double doubleStep( Arithmetic::Op op, double value1, double value2 )
+{
+    switch( op )
+    {
+        case Arithmetic::ADD: return value1 + value2;
+        case Arithmetic::SUB: return value1 - value2;
+        case Arithmetic::MUL: return value1 * value2;
+        case Arithmetic::DIV:
+            if ( value2 == 0 )
+            {
+                LOG_ERR( "divide by 0" );
+            }
+            return value1 / value2;
+    }
+    return 0;
+}
+
+static void bigStep( Arithmetic::Op op, BigValue& value1, const BigValue& value2 )
+{
+    switch( op )
+    {
+        case Arithmetic::ADD: value1.add( value2 ); break;
+        case Arithmetic::SUB: value1.sub( value2 ); break;
+        case Arithmetic::MUL: value1.mul( value2 ); break;
+        default:              break;
+    }
+}
+
+ISExpr* Arithmetic::apply( Op op, ISExpr* const* args, size_t argCount )
+{
+    if ( argCount == 0 )
+    {
+        return (op == ADD) ? IntNumber::make( 0 ) : (op == MUL) ? IntNumber::make( 1 ) : nullptr;
+    }
+    if ( argCount == 1 && (op == SUB || op == DIV) )
+    {
+        // (- x) is (- 0 x), (/ x) is (/ 1 x)
+        ISExpr* operands[2] = { IntNumber::make( (op == SUB) ? 0 : 1 ), args[0] };
+        return apply( op, operands, 2 );
+    }
+    if ( ! isNumber( args[0] ) )
+    {
+        return nullptr;
+    }
+
+    size_t i = 1;
+    double doubleResult;
+    if ( op != DIV && isInteger( args[0] ) )
+    {
+        // int64 while no step overflows, then BigValue
+        bool     isBig = args[0]->type() == ISExpr::BIG_INT;
+        int64_t  intResult = isBig ? 0 : args[0]->toNumberBase()->intValue();
+        BigValue bigResult = isBig ? BigValue::of( args[0] ) : BigValue();
+        for( ; i < argCount && isInteger( args[i] ); i++ )
+        {
+            ISExpr* value = args[i];
+            if ( ! isBig )
+            {
+                int64_t next;
+                if ( value->type() == ISExpr::INT_NUMBER && intStep( op, intResult, value->toNumberBase()->intValue(), next ) )
+                {
+                    intResult = next;
+                    continue;
+                }
+                bigResult = BigValue( intResult );
+                isBig = true;
+            }
+            bigStep( op, bigResult, BigValue::of( value ) );
+        }
+        if ( i == argCount )
+        {
+            return isBig ? bigResult.make() : IntNumber::make( intResult );
+        }
+        doubleResult = isBig ? bigResult.toDouble() : double( intResult );
+    }
+    else
+    {
+        doubleResult = doubleValue( args[0] );
+    }
+
+    // the rest in double, from the first argument that is not an integer
+    for( ; i < argCount; i++ )
+    {
+        if ( ! isNumber( args[i] ) )
+        {
+            return nullptr;
+        }
+        doubleResult = doubleStep( op, doubleResult, doubleValue( args[i] ) );
+    }
+    return new Double( doubleResult );
+}
+
+bool Arithmetic::compare( Comparison comparison, ISExpr* const* args, size_t argCount, bool& isTrue )
+{
+    if ( argCount == 0 || ! isNumber( args[0] ) )
+    {
+        return false;
+    }
+
+    // all arguments are checked, also when the chain is already broken
+    isTrue = true;
+    for( size_t i = 1; i < argCount; i++ )
+    {
+        ISExpr* value1 = args[i-1];
+        ISExpr* value2 = args[i];
+        if ( ! isNumber( value2 ) )
+        {
+            return false;
+        }
+        if ( ! isTrue )
+        {
+            continue;
+        }
+
+        if ( value1->type() == ISExpr::INT_NUMBER && value2->type() == ISExpr::INT_NUMBER )
+        {
+            isTrue = holds( comparison, value1->toNumberBase()->intValue(), value2->toNumberBase()->intValue() );
+        }
+        else if ( isInteger( value1 ) && isInteger( value2 ) )
+        {
+            isTrue = holds( comparison, BigValue::of( value1 ).compare( BigValue::of( value2 ) ), 0 );
+        }
+        else
+        {
+            isTrue = holds( comparison, doubleValue( value1 ), doubleValue( value2 ) );
+        }
+    }
+    return true;
+}
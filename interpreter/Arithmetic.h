@@ -0,0 +1,181 @@
+#pragma once
+
+#include "SExpr.h"
+#include "BigInt.h"
+
+#include <cstdint>
+
+//---------------------------------------------------------------
+//
+// Arithmetic - numbers of the arithmetic and comparison builtins
+//
+//---------------------------------------------------------------
+//
+//  Used by the builtins '+', '-', '*', '/', '<', '>', '=', '<=', '>=',
+//  by VirtualMachine and (through the builtins) by ConstantFolder.
+//
+//  Operations take any number of arguments and look at each of them
+//  once. Integers are computed in int64 while no step overflows, then
+//  exactly with BigValue; from the first double on, the rest is computed
+//  in double. '/' is always computed in double.
+//
+//      (+) -> 0    (*) -> 1    (- x) -> -x    (/ x) -> 1/x
+//      (- 10 1 2) -> 7         (* 3 4) -> 12  (* 4611686018427387904 4) -> 18446744073709551616
+//
+//  Comparisons are chains: (< a b c) is (a < b) and (b < c). Two integers
+//  (IntNumber or BigInt) are compared exactly, an integer and a double as
+//  doubles.
+//
+//  Fixnums are handled inline (apply2, compare2): two operands are the
+//  common case.
+//
+//---------------------------------------------------------------
+
+class Arithmetic
+{
+public:
+    enum Op : uint8_t { ADD, SUB, MUL, DIV };
+    enum Comparison : uint8_t { LESS, GREATER, EQUAL, LESS_EQUAL, GREATER_EQUAL };
+
+    // nullptr when an argument is not a number (or '-' and '/' got none)
+    static ISExpr* apply( Op op, ISExpr* const* args, size_t argCount );
+
+    // false when an argument is not a number (or there is none)
+    static bool compare( Comparison comparison, ISExpr* const* args, size_t argCount, bool& isTrue );
+
+    static ISExpr* apply2( Op op, ISExpr* value1, ISExpr* value2 )
+    {
+        int64_t result;
+        if ( op != DIV && value1->isFixnum() && value2->isFixnum() && intStep( op, value1->fixnumValue(), value2->fixnumValue(), result ) )
+        {
+            return IntNumber::make( result );
+        }
+        ISExpr* args[2] = { value1, value2 };
+        return apply( op, args, 2 );
+    }
+
+    static bool compare2( Comparison comparison, ISExpr* value1, ISExpr* value2, bool& isTrue )
+    {
+        if ( value1->isFixnum() && value2->isFixnum() )
+        {
+            isTrue = holds( comparison, value1->fixnumValue(), value2->fixnumValue() );
+            return true;
+        }
+        ISExpr* args[2] = { value1, value2 };
+        return compare( comparison, args, 2, isTrue );
+    }
+
+    static bool isNumber( const ISExpr* value )
+    {
+        if ( value == nullptr )
+        {
+            return false;
+        }
+        auto type = value->type();
+        return type == ISExpr::INT_NUMBER || type == ISExpr::DOUBLE || type == ISExpr::BIG_INT;
+    }
+
+    // IntNumber or BigInt
+    static bool isInteger( const ISExpr* value )
+    {
+        if ( value == nullptr )
+        {
+            return false;
+        }
+        auto type = value->type();
+        return type == ISExpr::INT_NUMBER || type == ISExpr::BIG_INT;
+    }
+
+    // of a number
+    static double doubleValue( ISExpr* value )
+    {
+        if ( value->type() == ISExpr::BIG_INT )
+        {
+            return static_cast<BigInt*>( value )->doubleValue();
+        }
+        return value->toNumberBase()->doubleValue();
+    }
+
+    // '/' would divide by 0 (then the error is reported and the result is inf or nan)
+    static bool isDivisionByZero( ISExpr* const* args, size_t argCount )
+    {
+        for( size_t i = (argCount == 1) ? 0 : 1; i < argCount; i++ )
+        {
+            if ( isNumber( args[i] ) && doubleValue( args[i] ) == 0 )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static const char* name( Op op )
+    {
+        static const char* const cNames[] = { "+", "-", "*", "/" };
+        return cNames[op];
+    }
+
+    static const char* name( Comparison comparison )
+    {
+        static const char* const cNames[] = { "<", ">", "=", "<=", ">=" };
+        return cNames[comparison];
+    }
+
+    // exact 'value1 op value2' (not DIV); false when it overflows int64
+    static bool intStep( Op op, int64_t value1, int64_t value2, int64_t& result )
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        switch( op )
+        {
+            case ADD: return ! __builtin_add_overflow( value1, value2, &result );
+            case SUB: return ! __builtin_sub_overflow( value1, value2, &result );
+            case MUL: return ! __builtin_mul_overflow( value1, value2, &result );
+            default:  return false;
+        }
+#else
+        switch( op )
+        {
+            case ADD:
+                if ( (value2 > 0 && value1 > INT64_MAX - value2) || (value2 < 0 && value1 < INT64_MIN - value2) )
+                {
+                    return false;
+                }
+                result = value1 + value2;
+                return true;
+            case SUB:
+                if ( (value2 < 0 && value1 > INT64_MAX + value2) || (value2 > 0 && value1 < INT64_MIN + value2) )
+                {
+                    return false;
+                }
+                result = value1 - value2;
+                return true;
+            case MUL:
+            {
+                int64_t product = int64_t( uint64_t(value1) * uint64_t(value2) );
+                if ( value1 != 0 && ( (value1 == -1 && value2 == INT64_MIN) || product / value1 != value2 ) )
+                {
+                    return false;
+                }
+                result = product;
+                return true;
+            }
+            default:
+                return false;
+        }
+#endif
+    }
+
+    template<class T>
+    static bool holds( Comparison comparison, T value1, T value2 )
+    {
+        switch( comparison )
+        {
+            case LESS:          return value1 < value2;
+            case GREATER:       return value1 > value2;
+            case EQUAL:         return value1 == value2;
+            case LESS_EQUAL:    return value1 <= value2;
+            case GREATER_EQUAL: return value1 >= value2;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,313 @@
+#include "LInterpreter.h"
+#include "Array.h"
+
+#include <algorithm>
+#include <vector>
+
+//
+// Builtins of Array (with evaluated arguments)
+//
+
+// nullptr (and the error is reported) when it is not an array
+static Array* toArray( ISExpr* value, const char* funcName )
+{
+    if ( value->type() != ISExpr::ARRAY )
+    {
+        LOG_ERR( funcName << ": array expected" );
+        return nullptr;
+    }
+    return static_cast<Array*>( value );
+}
+
+static bool isNumber( ISExpr* value )
+{
+    return value->type() == ISExpr::INT_NUMBER || value->type() == ISExpr::DOUBLE;
+}
+
+// false (and the error is reported) when 'index' is not an index of 'array'
+static bool isIndex( Array* array, ISExpr* index, const char* funcName )
+{
+    if ( index->type() != ISExpr::INT_NUMBER )
+    {
+        LOG_ERR( funcName << ": integer index expected" );
+        return false;
+    }
+    int64_t value = index->toIntNumber()->intValue();
+    if ( value < 0 || uint64_t(value) >= array->size() )
+    {
+        LOG_ERR( funcName << ": index " << value << " is out of 0.." << int64_t(array->size())-1 );
+        return false;
+    }
+    return true;
+}
+
+// elements as doubles: of the array itself or converted into 'buffer'
+static const double* doublesOf( Array* array, std::vector<double>& buffer )
+{
+    if ( array->elementType() == Array::DOUBLE )
+    {
+        return array->doubles();
+    }
+    buffer.resize( array->size() );
+    for( size_t i = 0; i < array->size(); i++ )
+    {
+        buffer[i] = double( array->ints()[i] );
+    }
+    return buffer.data();
+}
+
+// (make-array 3) -> #(0 0 0), (make-array 2 1.5) -> #(1.5 1.5)
+static ISExpr* makeArray( LInterpreter& interpreter, ISExpr* const* values, size_t argCount )
+{
+    if ( argCount < 1 || argCount > 2 )
+    {
+        LOG_ERR( "make-array: size and an optional initial value expected" );
+        return interpreter.m_nilAtom;
+    }
+    if ( values[0]->type() != ISExpr::INT_NUMBER || values[0]->toIntNumber()->intValue() < 0 )
+    {
+        LOG_ERR( "make-array: size must be a non-negative integer" );
+        return interpreter.m_nilAtom;
+    }
+    ISExpr* initialValue = (argCount == 2) ? values[1] : nullptr;
+    if ( initialValue != nullptr && ! isNumber( initialValue ) )
+    {
+        LOG_ERR( "make-array: initial value must be a number" );
+        return interpreter.m_nilAtom;
+    }
+
+    size_t size = size_t( values[0]->toIntNumber()->intValue() );
+    if ( initialValue != nullptr && initialValue->type() == ISExpr::DOUBLE )
+    {
+        Array* array = Array::make( Array::DOUBLE, size );
+        std::fill( array->doubles(), array->doubles() + size, initialValue->toNumberBase()->doubleValue() );
+        return array;
+    }
+
+    Array* array = Array::make( Array::INT64, size );
+    if ( initialValue != nullptr )
+    {
+        std::fill( array->ints(), array->ints() + size, initialValue->toNumberBase()->intValue() );
+    }
+    return array;
+}
+
+// (aref v 0) -> first element
+static ISExpr* aref( LInterpreter& interpreter, ISExpr* value, ISExpr* index )
+{
+    Array* array = toArray( value, "aref" );
+    if ( array == nullptr || ! isIndex( array, index, "aref" ) )
+    {
+        return interpreter.m_nilAtom;
+    }
+    return array->at( size_t( index->toIntNumber()->intValue() ) );
+}
+
+// (aset v 0 2.5) -> 2.5; integer arrays keep integers only
+static ISExpr* aset( LInterpreter& interpreter, ISExpr* value, ISExpr* index, ISExpr* element )
+{
+    Array* array = toArray( value, "aset" );
+    if ( array == nullptr || ! isIndex( array, index, "aset" ) )
+    {
+        return interpreter.m_nilAtom;
+    }
+    size_t i = size_t( index->toIntNumber()->intValue() );
+    if ( array->elementType() == Array::INT64 && element->type() == ISExpr::INT_NUMBER )
+    {
+        array->ints()[i] = element->toIntNumber()->intValue();
+        return element;
+    }
+    if ( array->elementType() == Array::DOUBLE && isNumber( element ) )
+    {
+        array->doubles()[i] = element->toNumberBase()->doubleValue();
+        return element;
+    }
+    LOG_ERR( "aset: " << (array->elementType() == Array::INT64 ? "integer" : "number") << " expected" );
+    return interpreter.m_nilAtom;
+}
+
+// (length v) -> number of elements of an array or a list
+static ISExpr* length( LInterpreter& interpreter, ISExpr* value )
+{
+    if ( interpreter.isNil( value ) )
+    {
+        return IntNumber::make( 0 );
+    }
+    if ( value->type() == ISExpr::ARRAY )
+    {
+        return IntNumber::make( int64_t( static_cast<Array*>( value )->size() ) );
+    }
+    if ( value->type() != ISExpr::LIST )
+    {
+        LOG_ERR( "length: array or list expected" );
+        return interpreter.m_nilAtom;
+    }
+
+    int64_t count = 0;
+    for( auto* it = value->toList(); it != nullptr && it->m_car != nullptr; it = it->m_cdr )
+    {
+        count++;
+    }
+    return IntNumber::make( count );
+}
+
+// element-wise operation of two arrays of the same size
+template<bool isAdd>
+static ISExpr* elementWise( LInterpreter& interpreter, ISExpr* value1, ISExpr* value2, const char* funcName )
+{
+    Array* array1 = toArray( value1, funcName );
+    Array* array2 = (array1 != nullptr) ? toArray( value2, funcName ) : nullptr;
+    if ( array2 == nullptr )
+    {
+        return interpreter.m_nilAtom;
+    }
+    if ( array1->size() != array2->size() )
+    {
+        LOG_ERR( funcName << ": arrays of different sizes: " << array1->size() << " and " << array2->size() );
+        return interpreter.m_nilAtom;
+    }
+
+    const ArrayKernels& kernels = ArrayKernels::best();
+    size_t size = array1->size();
+    if ( array1->elementType() == Array::INT64 && array2->elementType() == Array::INT64 )
+    {
+        Array* result = Array::make( Array::INT64, size );
+        auto kernel = isAdd ? kernels.m_addInts : kernels.m_mulInts;
+        kernel( array1->ints(), array2->ints(), result->ints(), size );
+        return result;
+    }
+
+    std::vector<double> buffer1, buffer2;
+    const double* doubles1 = doublesOf( array1, buffer1 );
+    const double* doubles2 = doublesOf( array2, buffer2 );
+
+    Array* result = Array::make( Array::DOUBLE, size );
+    auto kernel = isAdd ? kernels.m_addDoubles : kernels.m_mulDoubles;
+    kernel( doubles1, doubles2, result->doubles(), size );
+    return result;
+}
+
+// (vec+ #(1 2) #(10 20)) -> #(11 22)
+static ISExpr* vecAdd( LInterpreter& interpreter, ISExpr* value1, ISExpr* value2 )
+{
+    return elementWise<true>( interpreter, value1, value2, "vec+" );
+}
+
+// (vec* #(1 2) #(10 20)) -> #(10 40)
+static ISExpr* vecMul( LInterpreter& interpreter, ISExpr* value1, ISExpr* value2 )
+{
+    return elementWise<false>( interpreter, value1, value2, "vec*" );
+}
+
+// (sum #(1 2 3)) -> 6
+static ISExpr* sum( LInterpreter& interpreter, ISExpr* value )
+{
+    Array* array = toArray( value, "sum" );
+    if ( array == nullptr )
+    {
+        return interpreter.m_nilAtom;
+    }
+    const ArrayKernels& kernels = ArrayKernels::best();
+    if ( array->elementType() == Array::INT64 )
+    {
+        return IntNumber::make( kernels.m_sumInts( array->ints(), array->size() ) );
+    }
+    return new Double( kernels.m_sumDoubles( array->doubles(), array->size() ) );
+}
+
+// (dot #(1 2) #(3 4)) -> 11
+static ISExpr* dot( LInterpreter& interpreter, ISExpr* value1, ISExpr* value2 )
+{
+    Array* array1 = toArray( value1, "dot" );
+    Array* array2 = (array1 != nullptr) ? toArray( value2, "dot" ) : nullptr;
+    if ( array2 == nullptr )
+    {
+        return interpreter.m_nilAtom;
+    }
+    if ( array1->size() != array2->size() )
+    {
+        LOG_ERR( "dot: arrays of different sizes: " << array1->size() << " and " << array2->size() );
+        return interpreter.m_nilAtom;
+    }
+
+    const ArrayKernels& kernels = ArrayKernels::best();
+    if ( array1->elementType() == Array::INT64 && array2->elementType() == Array::INT64 )
+    {
+        return IntNumber::make( kernels.m_dotInts( array1->ints(), array2->ints(), array1->size() ) );
+    }
+
+    std::vector<double> buffer1, buffer2;
+    const double* doubles1 = doublesOf( array1, buffer1 );
+    const double* doubles2 = doublesOf( array2, buffer2 );
+    return new Double( kernels.m_dotDoubles( doubles1, doubles2, array1->size() ) );
+}
+
+// (list->array (quote (1 2.5))) -> #(1 2.5); integers only make an integer array
+static ISExpr* listToArray( LInterpreter& interpreter, ISExpr* value )
+{
+    size_t size = 0;
+    bool   hasDoubles = false;
+    List*  list = (value->type() == ISExpr::LIST) ? value->toList() : nullptr;
+    for( auto* it = list; it != nullptr && it->m_car != nullptr; it = it->m_cdr )
+    {
+        if ( ! isNumber( it->m_car ) )
+        {
+            LOG_ERR( "list->array: list of numbers expected" );
+            return interpreter.m_nilAtom;
+        }
+        hasDoubles = hasDoubles || it->m_car->type() == ISExpr::DOUBLE;
+        size++;
+    }
+    if ( list == nullptr && ! interpreter.isNil( value ) )
+    {
+        LOG_ERR( "list->array: list expected" );
+        return interpreter.m_nilAtom;
+    }
+
+    Array* array = Array::make( hasDoubles ? Array::DOUBLE : Array::INT64, size );
+    size_t i = 0;
+    for( auto* it = list; i < size; it = it->m_cdr, i++ )
+    {
+        if ( hasDoubles )
+        {
+            array->doubles()[i] = it->m_car->toNumberBase()->doubleValue();
+        }
+        else
+        {
+            array->ints()[i] = it->m_car->toIntNumber()->intValue();
+        }
+    }
+    return array;
+}
+
+// (array->list #(1 2)) -> (1 2), of an empty array -> nil
+static ISExpr* arrayToList( LInterpreter& interpreter, ISExpr* value )
+{
+    Array* array = toArray( value, "array->list" );
+    if ( array == nullptr || array->size() == 0 )
+    {
+        return interpreter.m_nilAtom;
+    }
+
+    // built from the end: every cell is complete when the next one is allocated
+    List* result = nullptr;
+    for( size_t i = array->size(); i-- > 0; )
+    {
+        result = new List( array->at(i), result );
+    }
+    return result;
+}
+
+void LInterpreter::addArrayFuncs()
+{
+    addBuiltin( new BuiltinFunc( "make-array", &makeArray ) );
+    addBuiltin( BuiltinFunc::make<aref>( "aref" ) );
+    addBuiltin( BuiltinFunc::make<aset>( "aset" ) );
+    addBuiltin( BuiltinFunc::make<length>( "length" ) );
+    addBuiltin( BuiltinFunc::make<vecAdd>( "vec+" ) );
+    addBuiltin( BuiltinFunc::make<vecMul>( "vec*" ) );
+    addBuiltin( BuiltinFunc::make<sum>( "sum" ) );
+    addBuiltin( BuiltinFunc::make<dot>( "dot" ) );
+    addBuiltin( BuiltinFunc::make<listToArray>( "list->array" ) );
+    addBuiltin( BuiltinFunc::make<arrayToList>( "array->list" ) );
+}
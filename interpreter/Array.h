@@ -0,0 +1,117 @@
+#pragma once
+
+#include "SExpr.h"
+
+#include <cstdint>
+#include <cstring>
+
+//---------------------------------------------------------------
+//
+// Array - vector of numbers in contiguous memory
+//
+//---------------------------------------------------------------
+//
+//  (set v (make-array 4 0.5))      -> #(0.5 0.5 0.5 0.5)
+//  (aset v 0 2) (aref v 0)         -> 2
+//  (vec+ v v) (vec* v v)           -> element-wise, a new array
+//  (sum v) (dot v v) (length v)
+//  (list->array (quote (1 2 3)))   -> #(1 2 3), (array->list v)
+//
+//  Elements are all int64 or all double and follow the object in the same
+//  cell (as slots of Frame), so the collector has nothing to trace in it.
+//  Element-wise operations and reductions run ArrayKernels with SSE2/AVX2
+//  when the CPU has them (see ArraySimd.cpp); with integers and doubles
+//  mixed the result is double. Sums of doubles are added in the order of
+//  the kernel, so the last bits may differ from adding them one by one.
+//
+//---------------------------------------------------------------
+
+class Array : public ISExpr
+{
+public:
+    enum ElementType : uint32_t { INT64, DOUBLE };
+
+private:
+    ElementType m_elementType;
+    size_t      m_size;
+
+    Array( ElementType elementType, size_t size ) : ISExpr(ARRAY), m_elementType(elementType), m_size(size) {}
+
+public:
+    // elements are 0
+    static Array* make( ElementType elementType, size_t size )
+    {
+        void* place = ISExpr::operator new( sizeof(Array) + size * sizeof(int64_t) );
+        Array* array = new( place ) Array( elementType, size );
+        std::memset( array->data(), 0, size * sizeof(int64_t) );
+        return array;
+    }
+
+    ISExpr* printObject( std::ostream& stream ) const
+    {
+        stream << "#(";
+        for( size_t i = 0; i < m_size; i++ )
+        {
+            if ( i > 0 )
+            {
+                stream << ' ';
+            }
+            if ( m_elementType == INT64 )
+            {
+                printInt( stream, ints()[i] );
+            }
+            else
+            {
+                Double::printValue( stream, doubles()[i] );
+            }
+        }
+        stream << ")";
+        return nullptr;
+    }
+
+    ElementType elementType() const { return m_elementType; }
+    size_t      size() const { return m_size; }
+
+    void*          data()          { return this+1; }
+    int64_t*       ints()          { return reinterpret_cast<int64_t*>( this+1 ); }
+    const int64_t* ints() const    { return reinterpret_cast<const int64_t*>( this+1 ); }
+    double*        doubles()       { return reinterpret_cast<double*>( this+1 ); }
+    const double*  doubles() const { return reinterpret_cast<const double*>( this+1 ); }
+
+    // element as a number value
+    ISExpr* at( size_t index ) const
+    {
+        if ( m_elementType == INT64 )
+        {
+            return IntNumber::make( ints()[index] );
+        }
+        return new Double( doubles()[index] );
+    }
+
+    double doubleAt( size_t index ) const
+    {
+        return (m_elementType == INT64) ? double( ints()[index] ) : doubles()[index];
+    }
+};
+
+//
+// ArrayKernels - loops of the array builtins; integers wrap around on overflow
+//
+struct ArrayKernels
+{
+    void    (*m_addDoubles)( const double* a, const double* b, double* result, size_t size );
+    void    (*m_mulDoubles)( const double* a, const double* b, double* result, size_t size );
+    double  (*m_sumDoubles)( const double* a, size_t size );
+    double  (*m_dotDoubles)( const double* a, const double* b, size_t size );
+
+    void    (*m_addInts)( const int64_t* a, const int64_t* b, int64_t* result, size_t size );
+    void    (*m_mulInts)( const int64_t* a, const int64_t* b, int64_t* result, size_t size );
+    int64_t (*m_sumInts)( const int64_t* a, size_t size );
+    int64_t (*m_dotInts)( const int64_t* a, const int64_t* b, size_t size );
+
+    // the fastest ones supported by the CPU (selected once)
+    static const ArrayKernels& best();
+
+    // nullptr when the CPU (or the build) does not support it: "scalar", "sse2", "avx2"
+    static const ArrayKernels* kernels( const char* name );
+};
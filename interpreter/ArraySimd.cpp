@@ -0,0 +1,305 @@
+#include "Array.h"
+#include "Cpu.h"
+
+#include <cstring>
+
+//
+// Scalar kernels (also the tails of the vector ones); integers are added and
+// multiplied as unsigned, so that they wrap around as the vector instructions do
+//
+static void addDoublesScalar( const double* a, const double* b, double* result, size_t size )
+{
+    for( size_t i = 0; i < size; i++ )
+    {
+        result[i] = a[i] + b[i];
+    }
+}
+
+static void mulDoublesScalar( const double* a, const double* b, double* result, size_t size )
+{
+    for( size_t i = 0; i < size; i++ )
+    {
+        result[i] = a[i] * b[i];
+    }
+}
+
+static double sumDoublesScalar( const double* a, size_t size )
+{
+    double sum = 0;
+    for( size_t i = 0; i < size; i++ )
+    {
+        sum += a[i];
+    }
+    return sum;
+}
+
+static double dotDoublesScalar( const double* a, const double* b, size_t size )
+{
+    double sum = 0;
+    for( size_t i = 0; i < size; i++ )
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static void addIntsScalar( const int64_t* a, const int64_t* b, int64_t* result, size_t size )
+{
+    for( size_t i = 0; i < size; i++ )
+    {
+        result[i] = int64_t( uint64_t(a[i]) + uint64_t(b[i]) );
+    }
+}
+
+// there is no 64-bit multiplication in SSE2/AVX2, so it is the only one
+static void mulIntsScalar( const int64_t* a, const int64_t* b, int64_t* result, size_t size )
+{
+    for( size_t i = 0; i < size; i++ )
+    {
+        result[i] = int64_t( uint64_t(a[i]) * uint64_t(b[i]) );
+    }
+}
+
+static int64_t sumIntsScalar( const int64_t* a, size_t size )
+{
+    uint64_t sum = 0;
+    for( size_t i = 0; i < size; i++ )
+    {
+        sum += uint64_t(a[i]);
+    }
+    return int64_t(sum);
+}
+
+static int64_t dotIntsScalar( const int64_t* a, const int64_t* b, size_t size )
+{
+    uint64_t sum = 0;
+    for( size_t i = 0; i < size; i++ )
+    {
+        sum += uint64_t(a[i]) * uint64_t(b[i]);
+    }
+    return int64_t(sum);
+}
+
+static const ArrayKernels cScalarKernels = {
+    addDoublesScalar, mulDoublesScalar, sumDoublesScalar, dotDoublesScalar,
+    addIntsScalar,    mulIntsScalar,    sumIntsScalar,    dotIntsScalar
+};
+
+#ifdef LISP_X86_64
+
+//
+// SSE2: 2 lanes
+//
+static void addDoublesSse2( const double* a, const double* b, double* result, size_t size )
+{
+    size_t i = 0;
+    for( ; i + 2 <= size; i += 2 )
+    {
+        _mm_storeu_pd( result + i, _mm_add_pd( _mm_loadu_pd( a + i ), _mm_loadu_pd( b + i ) ) );
+    }
+    addDoublesScalar( a + i, b + i, result + i, size - i );
+}
+
+static void mulDoublesSse2( const double* a, const double* b, double* result, size_t size )
+{
+    size_t i = 0;
+    for( ; i + 2 <= size; i += 2 )
+    {
+        _mm_storeu_pd( result + i, _mm_mul_pd( _mm_loadu_pd( a + i ), _mm_loadu_pd( b + i ) ) );
+    }
+    mulDoublesScalar( a + i, b + i, result + i, size - i );
+}
+
+// two accumulators, so that an addition does not wait for the previous one
+static double sumDoublesSse2( const double* a, size_t size )
+{
+    __m128d sum0 = _mm_setzero_pd();
+    __m128d sum1 = _mm_setzero_pd();
+    size_t i = 0;
+    for( ; i + 4 <= size; i += 4 )
+    {
+        sum0 = _mm_add_pd( sum0, _mm_loadu_pd( a + i ) );
+        sum1 = _mm_add_pd( sum1, _mm_loadu_pd( a + i + 2 ) );
+    }
+    double lanes[2];
+    _mm_storeu_pd( lanes, _mm_add_pd( sum0, sum1 ) );
+    return lanes[0] + lanes[1] + sumDoublesScalar( a + i, size - i );
+}
+
+static double dotDoublesSse2( const double* a, const double* b, size_t size )
+{
+    __m128d sum0 = _mm_setzero_pd();
+    __m128d sum1 = _mm_setzero_pd();
+    size_t i = 0;
+    for( ; i + 4 <= size; i += 4 )
+    {
+        sum0 = _mm_add_pd( sum0, _mm_mul_pd( _mm_loadu_pd( a + i ), _mm_loadu_pd( b + i ) ) );
+        sum1 = _mm_add_pd( sum1, _mm_mul_pd( _mm_loadu_pd( a + i + 2 ), _mm_loadu_pd( b + i + 2 ) ) );
+    }
+    double lanes[2];
+    _mm_storeu_pd( lanes, _mm_add_pd( sum0, sum1 ) );
+    return lanes[0] + lanes[1] + dotDoublesScalar( a + i, b + i, size - i );
+}
+
+static void addIntsSse2( const int64_t* a, const int64_t* b, int64_t* result, size_t size )
+{
+    size_t i = 0;
+    for( ; i + 2 <= size; i += 2 )
+    {
+        __m128i values = _mm_add_epi64( _mm_loadu_si128( reinterpret_cast<const __m128i*>( a + i ) ),
+                                        _mm_loadu_si128( reinterpret_cast<const __m128i*>( b + i ) ) );
+        _mm_storeu_si128( reinterpret_cast<__m128i*>( result + i ), values );
+    }
+    addIntsScalar( a + i, b + i, result + i, size - i );
+}
+
+static int64_t sumIntsSse2( const int64_t* a, size_t size )
+{
+    __m128i sum = _mm_setzero_si128();
+    size_t i = 0;
+    for( ; i + 2 <= size; i += 2 )
+    {
+        sum = _mm_add_epi64( sum, _mm_loadu_si128( reinterpret_cast<const __m128i*>( a + i ) ) );
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( lanes ), sum );
+    return int64_t( uint64_t(lanes[0]) + uint64_t(lanes[1]) + uint64_t( sumIntsScalar( a + i, size - i ) ) );
+}
+
+static const ArrayKernels cSse2Kernels = {
+    addDoublesSse2, mulDoublesSse2, sumDoublesSse2, dotDoublesSse2,
+    addIntsSse2,    mulIntsScalar,  sumIntsSse2,    dotIntsScalar
+};
+
+//
+// AVX2: 4 lanes
+//
+LISP_TARGET_AVX2
+static void addDoublesAvx2( const double* a, const double* b, double* result, size_t size )
+{
+    size_t i = 0;
+    for( ; i + 4 <= size; i += 4 )
+    {
+        _mm256_storeu_pd( result + i, _mm256_add_pd( _mm256_loadu_pd( a + i ), _mm256_loadu_pd( b + i ) ) );
+    }
+    addDoublesScalar( a + i, b + i, result + i, size - i );
+}
+
+LISP_TARGET_AVX2
+static void mulDoublesAvx2( const double* a, const double* b, double* result, size_t size )
+{
+    size_t i = 0;
+    for( ; i + 4 <= size; i += 4 )
+    {
+        _mm256_storeu_pd( result + i, _mm256_mul_pd( _mm256_loadu_pd( a + i ), _mm256_loadu_pd( b + i ) ) );
+    }
+    mulDoublesScalar( a + i, b + i, result + i, size - i );
+}
+
+LISP_TARGET_AVX2
+static double horizontalSum( __m256d sum )
+{
+    double lanes[4];
+    _mm256_storeu_pd( lanes, sum );
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+LISP_TARGET_AVX2
+static double sumDoublesAvx2( const double* a, size_t size )
+{
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for( ; i + 8 <= size; i += 8 )
+    {
+        sum0 = _mm256_add_pd( sum0, _mm256_loadu_pd( a + i ) );
+        sum1 = _mm256_add_pd( sum1, _mm256_loadu_pd( a + i + 4 ) );
+    }
+    return horizontalSum( _mm256_add_pd( sum0, sum1 ) ) + sumDoublesScalar( a + i, size - i );
+}
+
+// (no FMA: its rounding would differ from the other kernels)
+LISP_TARGET_AVX2
+static double dotDoublesAvx2( const double* a, const double* b, size_t size )
+{
+    __m256d sum0 = _mm256_setzero_pd();
+    __m256d sum1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for( ; i + 8 <= size; i += 8 )
+    {
+        sum0 = _mm256_add_pd( sum0, _mm256_mul_pd( _mm256_loadu_pd( a + i ), _mm256_loadu_pd( b + i ) ) );
+        sum1 = _mm256_add_pd( sum1, _mm256_mul_pd( _mm256_loadu_pd( a + i + 4 ), _mm256_loadu_pd( b + i + 4 ) ) );
+    }
+    return horizontalSum( _mm256_add_pd( sum0, sum1 ) ) + dotDoublesScalar( a + i, b + i, size - i );
+}
+
+LISP_TARGET_AVX2
+static void addIntsAvx2( const int64_t* a, const int64_t* b, int64_t* result, size_t size )
+{
+    size_t i = 0;
+    for( ; i + 4 <= size; i += 4 )
+    {
+        __m256i values = _mm256_add_epi64( _mm256_loadu_si256( reinterpret_cast<const __m256i*>( a + i ) ),
+                                           _mm256_loadu_si256( reinterpret_cast<const __m256i*>( b + i ) ) );
+        _mm256_storeu_si256( reinterpret_cast<__m256i*>( result + i ), values );
+    }
+    addIntsScalar( a + i, b + i, result + i, size - i );
+}
+
+LISP_TARGET_AVX2
+static int64_t sumIntsAvx2( const int64_t* a, size_t size )
+{
+    __m256i sum = _mm256_setzero_si256();
+    size_t i = 0;
+    for( ; i + 4 <= size; i += 4 )
+    {
+        sum = _mm256_add_epi64( sum, _mm256_loadu_si256( reinterpret_cast<const __m256i*>( a + i ) ) );
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256( reinterpret_cast<__m256i*>( lanes ), sum );
+    uint64_t total = uint64_t(lanes[0]) + uint64_t(lanes[1]) + uint64_t(lanes[2]) + uint64_t(lanes[3]);
+    return int64_t( total + uint64_t( sumIntsScalar( a + i, size - i ) ) );
+}
+
+static const ArrayKernels cAvx2Kernels = {
+    addDoublesAvx2, mulDoublesAvx2, sumDoublesAvx2, dotDoublesAvx2,
+    addIntsAvx2,    mulIntsScalar,  sumIntsAvx2,    dotIntsScalar
+};
+
+#endif
+
+const ArrayKernels* ArrayKernels::kernels( const char* name )
+{
+    if ( std::strcmp( name, "scalar" ) == 0 )
+    {
+        return &cScalarKernels;
+    }
+#ifdef LISP_X86_64
+    // SSE2 is a part of x86-64
+    if ( std::strcmp( name, "sse2" ) == 0 )
+    {
+        return &cSse2Kernels;
+    }
+    if ( std::strcmp( name, "avx2" ) == 0 && cpuHasAvx2() )
+    {
+        return &cAvx2Kernels;
+    }
+#endif
+    return nullptr;
+}
+
+const ArrayKernels& ArrayKernels::best()
+{
+    static const ArrayKernels& best = []() -> const ArrayKernels&
+    {
+        for( const char* name : { "avx2", "sse2" } )
+        {
+            if ( const ArrayKernels* found = kernels( name ); found != nullptr )
+            {
+                return *found;
+            }
+        }
+        return cScalarKernels;
+    }();
+    return best;
+}
@@ -0,0 +1,427 @@
+#include "BigInt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+using Limbs = std::vector<uint64_t>;
+
+// low word of a * b, the high one in 'high'
+static uint64_t mulWide( uint64_t a, uint64_t b, uint64_t& high )
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128)a * b;
+    high = uint64_t( product >> 64 );
+    return uint64_t( product );
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return _umul128( a, b, &high );
+#else
+    uint64_t aLow = a & 0xffffffff, aHigh = a >> 32;
+    uint64_t bLow = b & 0xffffffff, bHigh = b >> 32;
+    uint64_t lowLow   = aLow * bLow;
+    uint64_t lowHigh  = aLow * bHigh;
+    uint64_t highLow  = aHigh * bLow;
+    uint64_t middle   = (lowLow >> 32) + (lowHigh & 0xffffffff) + (highLow & 0xffffffff);
+    high = aHigh * bHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32);
+    return (middle << 32) | (lowLow & 0xffffffff);
+#endif
+}
+
+static void trim( Limbs& limbs )
+{
+    while( ! limbs.empty() && limbs.back() == 0 )
+    {
+        limbs.pop_back();
+    }
+}
+
+static size_t trimmedSize( const uint64_t* limbs, size_t size )
+{
+    while( size > 0 && limbs[size-1] == 0 )
+    {
+        size--;
+    }
+    return size;
+}
+
+static int compareMagnitude( const Limbs& a, const Limbs& b )
+{
+    if ( a.size() != b.size() )
+    {
+        return (a.size() < b.size()) ? -1 : 1;
+    }
+    for( size_t i = a.size(); i-- > 0; )
+    {
+        if ( a[i] != b[i] )
+        {
+            return (a[i] < b[i]) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// result[offset...] += value; the carry stays in 'result' (it is long enough)
+static void addAt( uint64_t* result, size_t resultSize, const uint64_t* value, size_t size, size_t offset )
+{
+    uint64_t carry = 0;
+    size_t i = 0;
+    for( ; i < size; i++ )
+    {
+        uint64_t sum = result[offset+i] + carry;
+        carry = (sum < carry);
+        sum += value[i];
+        carry += (sum < value[i]);
+        result[offset+i] = sum;
+    }
+    for( ; carry != 0 && offset+i < resultSize; i++ )
+    {
+        carry = (++result[offset+i] == 0);
+    }
+}
+
+// a -= b, a >= b
+static void subtractFrom( uint64_t* a, size_t aSize, const uint64_t* b, size_t bSize )
+{
+    uint64_t borrow = 0;
+    size_t i = 0;
+    for( ; i < bSize; i++ )
+    {
+        uint64_t difference = a[i] - b[i];
+        uint64_t nextBorrow = (a[i] < b[i]);
+        nextBorrow += (difference < borrow);
+        a[i] = difference - borrow;
+        borrow = nextBorrow;
+    }
+    for( ; borrow != 0 && i < aSize; i++ )
+    {
+        borrow = (a[i]-- == 0);
+    }
+}
+
+static void addMagnitude( Limbs& a, const Limbs& b )
+{
+    a.resize( std::max( a.size(), b.size() ) + 1, 0 );
+    addAt( a.data(), a.size(), b.data(), b.size(), 0 );
+    trim( a );
+}
+
+// result (aSize + bSize limbs, zeroed) = a * b
+static void multiplySchoolbook( const uint64_t* a, size_t aSize, const uint64_t* b, size_t bSize, uint64_t* result )
+{
+    for( size_t i = 0; i < aSize; i++ )
+    {
+        uint64_t carry = 0;
+        for( size_t j = 0; j < bSize; j++ )
+        {
+            uint64_t high;
+            uint64_t low = mulWide( a[i], b[j], high );
+            low += carry;
+            high += (low < carry);
+            low += result[i+j];
+            high += (low < result[i+j]);
+            result[i+j] = low;
+            carry = high;
+        }
+        result[i+bSize] = carry;
+    }
+}
+
+// result (aSize + bSize limbs, zeroed) = a * b
+static void multiply( const uint64_t* a, size_t aSize, const uint64_t* b, size_t bSize, uint64_t* result )
+{
+    if ( aSize < bSize )
+    {
+        std::swap( a, b );
+        std::swap( aSize, bSize );
+    }
+    if ( bSize < BigValue::cKaratsubaLimbs )
+    {
+        multiplySchoolbook( a, aSize, b, bSize, result );
+        return;
+    }
+
+    if ( aSize >= 2 * bSize )
+    {
+        // pieces of 'a' as long as 'b'
+        Limbs product( 2 * bSize );
+        for( size_t begin = 0; begin < aSize; begin += bSize )
+        {
+            size_t size = std::min( bSize, aSize - begin );
+            std::fill( product.begin(), product.end(), 0 );
+            multiply( a + begin, size, b, bSize, product.data() );
+            addAt( result, aSize + bSize, product.data(), size + bSize, begin );
+        }
+        return;
+    }
+
+    // a = a1 B^half + a0, b = b1 B^half + b0 (b1 is not empty: bSize > aSize/2):
+    // a0 b0 and a1 b1 go to their places in 'result' and
+    // a0 b1 + a1 b0 = (a0 + a1) (b0 + b1) - a0 b0 - a1 b1 is added at B^half
+    size_t half = aSize / 2;
+    multiply( a, half, b, half, result );
+    multiply( a + half, aSize - half, b + half, bSize - half, result + 2*half );
+
+    auto sumOfHalves = []( const uint64_t* limbs, size_t size, size_t half )
+    {
+        Limbs sum( limbs, limbs + half );
+        sum.resize( std::max( half, size - half ) + 1, 0 );
+        addAt( sum.data(), sum.size(), limbs + half, size - half, 0 );
+        return sum;
+    };
+    Limbs sumA = sumOfHalves( a, aSize, half );
+    Limbs sumB = sumOfHalves( b, bSize, half );
+
+    Limbs middle( sumA.size() + sumB.size(), 0 );
+    multiply( sumA.data(), sumA.size(), sumB.data(), sumB.size(), middle.data() );
+    subtractFrom( middle.data(), middle.size(), result, trimmedSize( result, 2*half ) );
+    subtractFrom( middle.data(), middle.size(), result + 2*half, trimmedSize( result + 2*half, aSize + bSize - 2*half ) );
+    addAt( result, aSize + bSize, middle.data(), trimmedSize( middle.data(), middle.size() ), half );
+}
+
+//------------------------
+// BigValue
+//------------------------
+
+BigValue::BigValue( int64_t value )
+{
+    m_isNegative = value < 0;
+    uint64_t magnitude = m_isNegative ? 0 - uint64_t(value) : uint64_t(value);
+    if ( magnitude != 0 )
+    {
+        m_limbs.push_back( magnitude );
+    }
+}
+
+BigValue::BigValue( const BigInt& value ) : m_isNegative( value.isNegative() ), m_limbs( value.limbs(), value.limbs() + value.size() )
+{
+}
+
+BigValue BigValue::of( ISExpr* value )
+{
+    if ( value->type() == ISExpr::BIG_INT )
+    {
+        return BigValue( *static_cast<BigInt*>( value ) );
+    }
+    return BigValue( value->toNumberBase()->intValue() );
+}
+
+bool BigValue::parse( std::string_view text )
+{
+    bool isNegative = false;
+    if ( ! text.empty() && (text[0] == '-' || text[0] == '+') )
+    {
+        isNegative = text[0] == '-';
+        text.remove_prefix( 1 );
+    }
+    if ( text.empty() )
+    {
+        return false;
+    }
+
+    // 19 digits at a time: limbs = limbs * 10^digits + chunk
+    Limbs limbs;
+    for( size_t begin = 0; begin < text.size(); )
+    {
+        size_t   digits = std::min<size_t>( 19, text.size() - begin );
+        uint64_t chunk = 0;
+        uint64_t scale = 1;
+        for( size_t i = begin; i < begin + digits; i++ )
+        {
+            if ( text[i] < '0' || text[i] > '9' )
+            {
+                return false;
+            }
+            chunk = chunk * 10 + uint64_t( text[i] - '0' );
+            scale *= 10;
+        }
+        begin += digits;
+
+        uint64_t carry = chunk;
+        for( auto& limb : limbs )
+        {
+            uint64_t high;
+            uint64_t low = mulWide( limb, scale, high );
+            low += carry;
+            high += (low < carry);
+            limb = low;
+            carry = high;
+        }
+        if ( carry != 0 )
+        {
+            limbs.push_back( carry );
+        }
+    }
+
+    m_limbs = std::move( limbs );
+    m_isNegative = isNegative && ! m_limbs.empty();
+    return true;
+}
+
+void BigValue::add( const BigValue& value )
+{
+    addSigned( value, value.m_isNegative );
+}
+
+void BigValue::sub( const BigValue& value )
+{
+    addSigned( value, ! value.m_isNegative );
+}
+
+// *this += (isNegative ? -|value| : |value|)
+void BigValue::addSigned( const BigValue& value, bool isNegative )
+{
+    if ( m_isNegative == isNegative )
+    {
+        addMagnitude( m_limbs, value.m_limbs );
+    }
+    else if ( compareMagnitude( m_limbs, value.m_limbs ) >= 0 )
+    {
+        subtractFrom( m_limbs.data(), m_limbs.size(), value.m_limbs.data(), value.m_limbs.size() );
+        trim( m_limbs );
+    }
+    else
+    {
+        Limbs limbs = value.m_limbs;
+        subtractFrom( limbs.data(), limbs.size(), m_limbs.data(), m_limbs.size() );
+        trim( limbs );
+        m_limbs = std::move( limbs );
+        m_isNegative = isNegative;
+    }
+
+    if ( m_limbs.empty() )
+    {
+        m_isNegative = false;
+    }
+}
+
+void BigValue::mul( const BigValue& value )
+{
+    if ( m_limbs.empty() || value.m_limbs.empty() )
+    {
+        m_limbs.clear();
+        m_isNegative = false;
+        return;
+    }
+
+    Limbs product( m_limbs.size() + value.m_limbs.size(), 0 );
+    multiply( m_limbs.data(), m_limbs.size(), value.m_limbs.data(), value.m_limbs.size(), product.data() );
+    trim( product );
+    m_limbs = std::move( product );
+    m_isNegative = m_isNegative != value.m_isNegative;
+}
+
+int BigValue::compare( const BigValue& value ) const
+{
+    if ( m_isNegative != value.m_isNegative )
+    {
+        return m_isNegative ? -1 : 1;
+    }
+    int result = compareMagnitude( m_limbs, value.m_limbs );
+    return m_isNegative ? -result : result;
+}
+
+double BigValue::toDouble() const
+{
+    return toDouble( m_isNegative, m_limbs.data(), m_limbs.size() );
+}
+
+double BigValue::toDouble( bool isNegative, const uint64_t* limbs, size_t size )
+{
+    // the 3 most significant limbs are more than the 53 bits of a double
+    double result = 0;
+    size_t lowest = (size > 3) ? size - 3 : 0;
+    for( size_t i = size; i-- > lowest; )
+    {
+        result = result * 18446744073709551616.0 + double( limbs[i] );
+    }
+    result = std::ldexp( result, int( lowest * 64 ) );
+    return isNegative ? -result : result;
+}
+
+std::string BigValue::toString() const
+{
+    if ( m_limbs.empty() )
+    {
+        return "0";
+    }
+
+    // groups of 9 digits, the lowest first: the remainders of division by 10^9
+    // (a limb is divided in two halves, so the quotients fit in 64 bits)
+    constexpr uint64_t cGroup = 1'000'000'000;
+    Limbs limbs = m_limbs;
+    std::vector<uint32_t> groups;
+    while( ! limbs.empty() )
+    {
+        uint64_t remainder = 0;
+        for( size_t i = limbs.size(); i-- > 0; )
+        {
+            uint64_t high = (remainder << 32) | (limbs[i] >> 32);
+            uint64_t highQuotient = high / cGroup;
+            remainder = high % cGroup;
+            uint64_t low = (remainder << 32) | (limbs[i] & 0xffffffff);
+            uint64_t lowQuotient = low / cGroup;
+            remainder = low % cGroup;
+            limbs[i] = (highQuotient << 32) | lowQuotient;
+        }
+        groups.push_back( uint32_t( remainder ) );
+        trim( limbs );
+    }
+
+    std::string text = m_isNegative ? "-" : "";
+    text += std::to_string( groups.back() );
+    for( size_t i = groups.size() - 1; i-- > 0; )
+    {
+        std::string group = std::to_string( groups[i] );
+        text.append( 9 - group.size(), '0' );
+        text += group;
+    }
+    return text;
+}
+
+ISExpr* BigValue::make() const
+{
+    if ( m_limbs.empty() )
+    {
+        return IntNumber::make( 0 );
+    }
+    if ( m_limbs.size() == 1 )
+    {
+        uint64_t magnitude = m_limbs[0];
+        if ( ! m_isNegative && magnitude <= uint64_t( INT64_MAX ) )
+        {
+            return IntNumber::make( int64_t( magnitude ) );
+        }
+        if ( m_isNegative && magnitude <= uint64_t( INT64_MAX ) + 1 )
+        {
+            return IntNumber::make( int64_t( 0 - magnitude ) );
+        }
+    }
+    return BigInt::make( m_isNegative, m_limbs.data(), m_limbs.size() );
+}
+
+//------------------------
+// BigInt
+//------------------------
+
+BigInt* BigInt::make( bool isNegative, const uint64_t* limbs, size_t size )
+{
+    void* place = ISExpr::operator new( sizeof(BigInt) + size * sizeof(uint64_t) );
+    BigInt* bigInt = new( place ) BigInt( isNegative, uint32_t( size ) );
+    std::memcpy( reinterpret_cast<uint64_t*>( bigInt+1 ), limbs, size * sizeof(uint64_t) );
+    return bigInt;
+}
+
+double BigInt::doubleValue() const
+{
+    return BigValue::toDouble( m_isNegative, limbs(), m_size );
+}
+
+ISExpr* BigInt::printObject( std::ostream& stream ) const
+{
+    stream << BigValue( *this ).toString();
+    return nullptr;
+}
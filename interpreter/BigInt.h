@@ -0,0 +1,98 @@
+#pragma once
+
+#include "SExpr.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//---------------------------------------------------------------
+//
+// BigInt - integer of any size
+//
+//---------------------------------------------------------------
+//
+//  (* 4611686018427387904 4)             -> 18446744073709551616
+//  (- 0 99999999999999999999 1)          -> -100000000000000000000
+//
+//  Integers are IntNumber while they fit in int64. An operation of
+//  Arithmetic that overflows goes on with BigValue and its result is a
+//  BigInt (or an IntNumber again when it fits); literals that do not fit
+//  in int64 are parsed as BigInt.
+//
+//  The magnitude is an array of 64-bit limbs, least significant first,
+//  without leading zeros. In BigInt the limbs follow the object in the
+//  same cell (as the elements of Array), so the collector has nothing to
+//  trace in it. Products of two numbers of cKaratsubaLimbs limbs or more
+//  are computed by Karatsuba: 3 products of the halves instead of 4.
+//
+//---------------------------------------------------------------
+
+class BigInt;
+
+//------------------------
+// BigValue - signed integer of any size while it is computed
+//------------------------
+class BigValue
+{
+    bool                  m_isNegative = false;
+    std::vector<uint64_t> m_limbs;
+
+public:
+    static constexpr size_t cKaratsubaLimbs = 32;
+
+    BigValue() = default;
+    explicit BigValue( int64_t value );
+    explicit BigValue( const BigInt& value );
+
+    // INT_NUMBER or BIG_INT
+    static BigValue of( ISExpr* value );
+
+    // decimal digits with an optional sign; false when it is not an integer
+    bool parse( std::string_view text );
+
+    bool isNegative() const { return m_isNegative; }
+    const std::vector<uint64_t>& limbs() const { return m_limbs; }
+
+    // 'value' is not *this
+    void add( const BigValue& value );
+    void sub( const BigValue& value );
+    void mul( const BigValue& value );
+
+    // -1, 0 or 1
+    int compare( const BigValue& value ) const;
+
+    double toDouble() const;
+    static double toDouble( bool isNegative, const uint64_t* limbs, size_t size );
+
+    std::string toString() const;
+
+    // IntNumber when it fits in int64, BigInt otherwise (in the current allocator)
+    ISExpr* make() const;
+
+private:
+    void addSigned( const BigValue& value, bool isNegative );
+};
+
+//------------------------
+// BigInt
+//------------------------
+class BigInt : public ISExpr
+{
+    bool     m_isNegative;
+    uint32_t m_size;
+
+    BigInt( bool isNegative, uint32_t size ) : ISExpr(BIG_INT), m_isNegative(isNegative), m_size(size) {}
+
+public:
+    static BigInt* make( bool isNegative, const uint64_t* limbs, size_t size );
+
+    bool            isNegative() const { return m_isNegative; }
+    size_t          size() const { return m_size; }
+    const uint64_t* limbs() const { return reinterpret_cast<const uint64_t*>( this+1 ); }
+
+    double doubleValue() const;
+
+    ISExpr* printObject( std::ostream& stream ) const;
+};
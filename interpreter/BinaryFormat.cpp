@@ -0,0 +1,454 @@
+#include "LInterpreter.h"
+#include "BinaryFormat.h"
+
+#include <cstring>
+#include <fstream>
+
+static void putVarint( std::string& out, uint64_t value )
+{
+    while( value >= 0x80 )
+    {
+        out += char( (value & 0x7f) | 0x80 );
+        value >>= 7;
+    }
+    out += char( value );
+}
+
+//------------------------
+// BinaryWriter
+//------------------------
+
+bool BinaryWriter::write( ISExpr* value )
+{
+    m_names.clear();
+    m_newSymbolCount = 0;
+    m_value.clear();
+    writeValue( value );
+
+    if ( ! m_isHeaderWritten )
+    {
+        m_stream.write( BinaryFormat::cMagic, sizeof(BinaryFormat::cMagic) );
+        m_stream.put( char( BinaryFormat::cVersion ) );
+        m_isHeaderWritten = true;
+    }
+
+    std::string count;
+    putVarint( count, m_newSymbolCount );
+    m_stream.write( count.data(), count.size() );
+    m_stream.write( m_names.data(), m_names.size() );
+    m_stream.write( m_value.data(), m_value.size() );
+    return bool( m_stream );
+}
+
+// lists are walked with m_rest (the cells left of every open list), not recursively
+void BinaryWriter::writeValue( ISExpr* value )
+{
+    for(;;)
+    {
+        if ( value != nullptr && value->type() == ISExpr::LIST )
+        {
+            List* list = value->toList();
+            uint64_t length = 0;
+            if ( ! list->isEmptyList() )
+            {
+                for( List* it = list; it != nullptr; it = it->m_cdr )
+                {
+                    length++;
+                }
+            }
+
+            m_value += char( BinaryFormat::LIST );
+            putVarint( m_value, length );
+            if ( length > 0 )
+            {
+                m_rest.push_back( list->m_cdr );
+                value = list->m_car;
+                continue;
+            }
+        }
+        else
+        {
+            writeAtom( value );
+        }
+
+        // next element of the innermost list that is not finished
+        while( ! m_rest.empty() && m_rest.back() == nullptr )
+        {
+            m_rest.pop_back();
+        }
+        if ( m_rest.empty() )
+        {
+            return;
+        }
+        List* next = m_rest.back();
+        m_rest.back() = next->m_cdr;
+        value = next->m_car;
+    }
+}
+
+void BinaryWriter::writeAtom( ISExpr* value )
+{
+    if ( m_interpreter.isNil( value ) )
+    {
+        m_value += char( BinaryFormat::NIL );
+        return;
+    }
+
+    switch( value->type() )
+    {
+        case ISExpr::INT_NUMBER:
+        {
+            int64_t number = value->toIntNumber()->intValue();
+            m_value += char( BinaryFormat::INT );
+            putVarint( m_value, (uint64_t(number) << 1) ^ uint64_t(number >> 63) );
+            break;
+        }
+        case ISExpr::DOUBLE:
+        {
+            double number = value->toDouble()->doubleValue();
+            char bytes[sizeof(number)];
+            std::memcpy( bytes, &number, sizeof(number) );
+            m_value += char( BinaryFormat::DOUBLE );
+            m_value.append( bytes, sizeof(bytes) );
+            break;
+        }
+        case ISExpr::BIG_INT:
+        {
+            auto* bigInt = static_cast<BigInt*>( value );
+            m_value += char( BinaryFormat::BIG_INT );
+            m_value += char( bigInt->isNegative() ? 1 : 0 );
+            putVarint( m_value, bigInt->size() );
+            m_value.append( reinterpret_cast<const char*>( bigInt->limbs() ), bigInt->size() * sizeof(uint64_t) );
+            break;
+        }
+        case ISExpr::ATOM:
+        case ISExpr::BUILT_IN_FUNC:
+            m_value += char( BinaryFormat::SYMBOL );
+            putVarint( m_value, symbolIndex( value ) );
+            break;
+        default:
+            LOG_ERR( "cannot write value of type " << value->type() << " in binary format, nil is written instead" );
+            m_value += char( BinaryFormat::NIL );
+            break;
+    }
+}
+
+// a new symbol goes to the header of the current record
+uint64_t BinaryWriter::symbolIndex( ISExpr* symbol )
+{
+    if ( auto it = m_symbols.find( symbol ); it != m_symbols.end() )
+    {
+        return it->second;
+    }
+
+    const char* name = (symbol->type() == ISExpr::ATOM) ? symbol->toAtom()->name() : symbol->toBuiltinFunc()->name();
+    size_t length = std::strlen( name );
+    putVarint( m_names, length );
+    m_names.append( name, length );
+    m_newSymbolCount++;
+
+    uint64_t index = m_symbols.size();
+    m_symbols[symbol] = index;
+    return index;
+}
+
+//------------------------
+// BinaryReader
+//------------------------
+
+ISExpr* BinaryReader::read()
+{
+    if ( m_isFailed || (! m_isHeaderRead && ! readHeader()) )
+    {
+        return nullptr;
+    }
+
+    uint8_t first;
+    if ( ! readByte( first ) )
+    {
+        // the end of the stream (between records)
+        return nullptr;
+    }
+    m_position--;
+
+    uint64_t newSymbolCount;
+    if ( ! readVarint( newSymbolCount ) )
+    {
+        fail();
+        return nullptr;
+    }
+
+    std::string name;
+    for( uint64_t i = 0; i < newSymbolCount; i++ )
+    {
+        uint64_t length;
+        if ( ! readVarint( length ) || length == 0 || length > m_buffer.size() )
+        {
+            fail();
+            return nullptr;
+        }
+        name.resize( length );
+        if ( ! readBytes( name.data(), length ) )
+        {
+            fail();
+            return nullptr;
+        }
+        m_symbols.push_back( m_interpreter.symbol( name ) );
+    }
+
+    return readValue();
+}
+
+bool BinaryReader::readHeader()
+{
+    char magic[sizeof(BinaryFormat::cMagic)];
+    uint8_t version;
+    if ( ! readBytes( magic, sizeof(magic) ) || std::memcmp( magic, BinaryFormat::cMagic, sizeof(magic) ) != 0
+        || ! readByte( version ) || version != BinaryFormat::cVersion )
+    {
+        LOG_ERR( "not a binary s-expression stream (or of another version)" );
+        m_isFailed = true;
+        return false;
+    }
+    m_isHeaderRead = true;
+    return true;
+}
+
+// lists are collected in m_elements, as the parser does it: the cells of a list are
+// allocated together (when its last element is read), so they are one after another
+ISExpr* BinaryReader::readValue()
+{
+    m_pending.clear();
+    m_elements.clear();
+    for(;;)
+    {
+        uint8_t tag;
+        if ( ! readByte( tag ) )
+        {
+            fail();
+            return nullptr;
+        }
+
+        ISExpr* value;
+        switch( tag )
+        {
+            case BinaryFormat::NIL:
+                value = m_interpreter.m_nilAtom;
+                break;
+
+            case BinaryFormat::INT:
+            {
+                uint64_t zigzag;
+                if ( ! readVarint( zigzag ) )
+                {
+                    fail();
+                    return nullptr;
+                }
+                value = IntNumber::make( int64_t( zigzag >> 1 ) ^ -int64_t( zigzag & 1 ) );
+                break;
+            }
+            case BinaryFormat::DOUBLE:
+            {
+                double number;
+                if ( ! readBytes( reinterpret_cast<char*>( &number ), sizeof(number) ) )
+                {
+                    fail();
+                    return nullptr;
+                }
+                value = new Double( number );
+                break;
+            }
+            case BinaryFormat::BIG_INT:
+            {
+                uint8_t  sign;
+                uint64_t size;
+                if ( ! readByte( sign ) || ! readVarint( size ) || size == 0 || size > m_buffer.size() )
+                {
+                    fail();
+                    return nullptr;
+                }
+                std::vector<uint64_t> limbs( size );
+                if ( ! readBytes( reinterpret_cast<char*>( limbs.data() ), size * sizeof(uint64_t) ) || limbs.back() == 0 )
+                {
+                    fail();
+                    return nullptr;
+                }
+                value = BigInt::make( sign != 0, limbs.data(), limbs.size() );
+                break;
+            }
+            case BinaryFormat::SYMBOL:
+            {
+                uint64_t index;
+                if ( ! readVarint( index ) || index >= m_symbols.size() )
+                {
+                    fail();
+                    return nullptr;
+                }
+                value = m_symbols[index];
+                break;
+            }
+            case BinaryFormat::LIST:
+            {
+                uint64_t length;
+                if ( ! readVarint( length ) )
+                {
+                    fail();
+                    return nullptr;
+                }
+                if ( length > 0 )
+                {
+                    m_pending.push_back( { length, m_elements.size() } );
+                    continue;
+                }
+                value = new List();
+                break;
+            }
+            default:
+                fail();
+                return nullptr;
+        }
+
+        // the value completes the lists it is the last element of
+        for(;;)
+        {
+            if ( m_pending.empty() )
+            {
+                return value;
+            }
+            m_elements.push_back( value );
+            if ( --m_pending.back().m_remaining > 0 )
+            {
+                break;
+            }
+            value = makeRun( m_pending.back().m_begin );
+            m_pending.pop_back();
+        }
+    }
+}
+
+List* BinaryReader::makeRun( size_t begin )
+{
+    List* result = new List( m_elements[begin] );
+    List* back   = result;
+    for( size_t i = begin+1; i < m_elements.size(); i++ )
+    {
+        back->m_cdr = new List( m_elements[i] );
+        back = back->m_cdr;
+    }
+    m_elements.resize( begin );
+    return result;
+}
+
+bool BinaryReader::readByte( uint8_t& byte )
+{
+    if ( m_position == m_size )
+    {
+        m_stream.read( m_buffer.data(), m_buffer.size() );
+        m_size = size_t( m_stream.gcount() );
+        m_position = 0;
+        if ( m_size == 0 )
+        {
+            return false;
+        }
+    }
+    byte = uint8_t( m_buffer[m_position++] );
+    return true;
+}
+
+bool BinaryReader::readBytes( char* data, size_t size )
+{
+    while( size > 0 )
+    {
+        if ( m_position == m_size )
+        {
+            uint8_t byte;
+            if ( ! readByte( byte ) )
+            {
+                return false;
+            }
+            m_position--;
+        }
+        size_t count = std::min( size, m_size - m_position );
+        std::memcpy( data, m_buffer.data() + m_position, count );
+        m_position += count;
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+bool BinaryReader::readVarint( uint64_t& value )
+{
+    value = 0;
+    for( int shift = 0; shift < 64; shift += 7 )
+    {
+        uint8_t byte;
+        if ( ! readByte( byte ) )
+        {
+            return false;
+        }
+        value |= uint64_t( byte & 0x7f ) << shift;
+        if ( (byte & 0x80) == 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BinaryReader::fail()
+{
+    LOG_ERR( "damaged binary s-expression stream" );
+    m_isFailed = true;
+    return false;
+}
+
+//
+// Builtins (with evaluated arguments); the file is named by an atom
+//
+
+// (write-binary (quote data.bin) (quote (1 2.5 a))) -> (1 2.5 a), the file has one record of it
+static ISExpr* writeBinary( LInterpreter& interpreter, ISExpr* fileName, ISExpr* value )
+{
+    if ( fileName->type() != ISExpr::ATOM )
+    {
+        LOG_ERR( "write-binary: file name expected" );
+        return interpreter.m_nilAtom;
+    }
+
+    std::ofstream file( fileName->toAtom()->name(), std::ios::binary );
+    if ( ! file || ! BinaryWriter( file, interpreter ).write( value ) )
+    {
+        LOG_ERR( "cannot write file: " << fileName->toAtom()->name() );
+        return interpreter.m_nilAtom;
+    }
+    return value;
+}
+
+// (read-binary (quote data.bin)) -> value of the first record
+static ISExpr* readBinary( LInterpreter& interpreter, ISExpr* fileName )
+{
+    if ( fileName->type() != ISExpr::ATOM )
+    {
+        LOG_ERR( "read-binary: file name expected" );
+        return interpreter.m_nilAtom;
+    }
+
+    std::ifstream file( fileName->toAtom()->name(), std::ios::binary );
+    if ( ! file )
+    {
+        LOG_ERR( "cannot open file: " << fileName->toAtom()->name() );
+        return interpreter.m_nilAtom;
+    }
+
+    // the elements being read are not seen by the garbage collector
+    GcHeap::NoCollectScope noCollect( interpreter.heap() );
+    ISExpr* value = BinaryReader( file, interpreter ).read();
+    return (value != nullptr) ? value : interpreter.m_nilAtom;
+}
+
+void LInterpreter::addBinaryFuncs()
+{
+    addBuiltin( BuiltinFunc::make<writeBinary>( "write-binary" ) );
+    addBuiltin( BuiltinFunc::make<readBinary>( "read-binary" ) );
+}
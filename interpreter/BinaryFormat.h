@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class ISExpr;
+class List;
+class LInterpreter;
+
+//---------------------------------------------------------------
+//
+// BinaryFormat - compact binary encoding of s-expression data
+//
+//---------------------------------------------------------------
+//
+//  stream:   "LSPB" version, then records one after another
+//  record:   count of new symbols, their names (length and bytes),
+//            then one value
+//  value:    tag byte and
+//              NIL
+//              INT      zigzag varint
+//              DOUBLE   8 bytes as in memory (little endian on our platforms)
+//              SYMBOL   varint index (in the order the names came)
+//              LIST     varint length and the elements
+//              BIG_INT  sign byte (1: negative), varint count of limbs and
+//                       the limbs (8 bytes each, the least significant first)
+//
+//  The symbols of a stream are numbered across its records, so a name is
+//  written (and looked up by the reader) once per stream; lists are
+//  length-prefixed and numbers are not parsed from text. Atoms and
+//  builtins are both symbols: the reader gets them as the parser would.
+//  Values of other types are written as nil (and the error is reported).
+//
+//  Counts are varints: 7 bits per byte, the high bit set on all but the
+//  last byte.
+//
+//---------------------------------------------------------------
+
+struct BinaryFormat
+{
+    enum Tag : uint8_t { NIL = 0, INT = 1, DOUBLE = 2, SYMBOL = 3, LIST = 4, BIG_INT = 5 };
+
+    static constexpr char    cMagic[4] = { 'L', 'S', 'P', 'B' };
+    static constexpr uint8_t cVersion  = 1;
+};
+
+//------------------------
+// BinaryWriter
+//------------------------
+class BinaryWriter
+{
+    std::ostream& m_stream;
+    LInterpreter& m_interpreter;
+
+    // atom or builtin -> symbol index
+    std::unordered_map<const ISExpr*, uint64_t> m_symbols;
+
+    // of the current record
+    std::string m_names;
+    uint64_t    m_newSymbolCount = 0;
+    std::string m_value;
+
+    std::vector<List*> m_rest;
+
+    bool m_isHeaderWritten = false;
+
+public:
+    BinaryWriter( std::ostream& stream, LInterpreter& interpreter ) : m_stream(stream), m_interpreter(interpreter) {}
+
+    // appends a record of 'value'; false when the stream failed
+    bool write( ISExpr* value );
+
+    void flush() { m_stream.flush(); }
+
+private:
+    void writeValue( ISExpr* value );
+    void writeAtom( ISExpr* value );
+    uint64_t symbolIndex( ISExpr* symbol );
+};
+
+//------------------------
+// BinaryReader
+//------------------------
+class BinaryReader
+{
+    std::istream& m_stream;
+    LInterpreter& m_interpreter;
+
+    // read ahead from the stream
+    std::vector<char> m_buffer;
+    size_t            m_position = 0;
+    size_t            m_size = 0;
+
+    std::vector<ISExpr*> m_symbols;
+
+    // elements of the lists being read (see Parser::m_elements)
+    struct PendingList { uint64_t m_remaining; size_t m_begin; };
+    std::vector<PendingList> m_pending;
+    std::vector<ISExpr*>     m_elements;
+
+    bool m_isHeaderRead = false;
+    bool m_isFailed = false;
+
+public:
+    BinaryReader( std::istream& stream, LInterpreter& interpreter ) : m_stream(stream), m_interpreter(interpreter), m_buffer( 64 * 1024 ) {}
+
+    // value of the next record, in the current allocator; nullptr at the end
+    // of the stream or on an error (the garbage collector must not run meanwhile)
+    ISExpr* read();
+
+    // the stream was not valid (or was cut)
+    bool isFailed() const { return m_isFailed; }
+
+private:
+    bool readHeader();
+    ISExpr* readValue();
+    List* makeRun( size_t begin );
+
+    bool readByte( uint8_t& byte );
+    bool readBytes( char* data, size_t size );
+    bool readVarint( uint64_t& value );
+    bool fail();
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+//
+// BoundedQueue - blocking producer/consumer queue with a fixed capacity
+//
+// push() waits while the queue is full, pop() waits while it is empty;
+// after close() pop() returns the rest and then false, push() returns false.
+//
+template<class T>
+class BoundedQueue
+{
+    std::mutex              m_mutex;
+    std::condition_variable m_notFull;
+    std::condition_variable m_notEmpty;
+    std::deque<T>           m_items;
+    size_t                  m_capacity;
+    bool                    m_isClosed = false;
+
+public:
+    BoundedQueue( size_t capacity ) : m_capacity( capacity ) {}
+
+    bool push( T item )
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        m_notFull.wait( lock, [this] { return m_items.size() < m_capacity || m_isClosed; } );
+        if ( m_isClosed )
+        {
+            return false;
+        }
+        m_items.push_back( std::move(item) );
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop( T& item )
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        m_notEmpty.wait( lock, [this] { return ! m_items.empty() || m_isClosed; } );
+        if ( m_items.empty() )
+        {
+            return false;
+        }
+        item = std::move( m_items.front() );
+        m_items.pop_front();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_isClosed = true;
+        m_notFull.notify_all();
+        m_notEmpty.notify_all();
+    }
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "SExpr.h"
+#include "Environment.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+//---------------------------------------------------------------
+//
+// ByteCode - a form compiled for VirtualMachine
+//
+//---------------------------------------------------------------
+//
+//  Code is a flat array of int32: an opcode followed by its operands.
+//  Operands are indices into m_constants or jump targets (code offsets);
+//  calls of user functions refer to an inline cache in m_callCaches.
+//
+//  Example: (if (< n 2) n (+ n 1)) in the body of (defun f (n) ...)
+//
+//      LOAD_LOCAL 0 0
+//      CONST   2
+//      LESS    2
+//      JUMP_IF_NIL else
+//      LOAD_LOCAL 0 0
+//      JUMP    end
+//  else:
+//      LOAD_LOCAL 0 0
+//      CONST   1
+//      ADD     2
+//  end:
+//      RETURN
+//
+//---------------------------------------------------------------
+
+enum class OpCode : int32_t
+{
+    CONST,          // k        push constants[k]
+    LOAD,           // k        push value of atom constants[k]
+    STORE,          // k        value of atom constants[k] = top (stays on the stack)
+    LOAD_LOCAL,     // d i      push slot i of the frame d levels up
+    STORE_LOCAL,    // d i      slot i of the frame d levels up = top (stays on the stack)
+    POP,            //          pop
+    JUMP,           // target
+    JUMP_IF_NIL,    // target   pop, jump when nil
+
+    ADD,            // n        pop n values, push the sum (or concatenation)
+    SUB,            // n        pop n, push the difference (see Arithmetic)
+    MUL,            // n        pop n, push the product
+    DIV,            // n        pop n, push the quotient
+    LESS,           // n        pop n, push t when the chain holds, nil otherwise
+    GREATER,        // n        the same for '>'
+    EQUAL,          // n        '='
+    LESS_EQUAL,     // n        '<='
+    GREATER_EQUAL,  // n        '>='
+
+    PRINT,          // isLast   print top and '_' after it unless it is the last one (then it stays)
+    CALL,           // c n      call user function of callCaches[c] with n arguments from the stack
+    TAIL_CALL,      // c n      the same in tail position: the frame and code of the caller are replaced
+    BUILTIN,        // k l      push special form constants[k] applied to unevaluated arguments constants[l]
+    CALL_BUILTIN,   // k n      call builtin constants[k] with n evaluated arguments from the stack
+    EVAL,           // k        push tree walker evaluation of constants[k]
+    RETURN          //          return top
+};
+
+struct ByteCode
+{
+    std::vector<int32_t> m_code;
+    std::vector<ISExpr*> m_constants;
+
+    // constant -> its index in m_constants (used while compiling)
+    std::unordered_map<ISExpr*, int32_t> m_constantIndices;
+
+    // filled while the code runs
+    mutable std::vector<CallCache> m_callCaches;
+
+    // number of parameters of a user function (frame size)
+    uint32_t m_slotCount = 0;
+
+    // the code runs builtins or the tree walker, which can keep the frame of
+    // the call ('defun' in the body); otherwise the frame is not allocated in the heap
+    bool     m_canCaptureFrame = false;
+
+    int32_t addConstant( ISExpr* expr )
+    {
+        auto [it, isNew] = m_constantIndices.try_emplace( expr, int32_t( m_constants.size() ) );
+        if ( isNew )
+        {
+            m_constants.push_back( expr );
+        }
+        return it->second;
+    }
+
+    int32_t addCallCache( Atom* funcName )
+    {
+        m_callCaches.emplace_back( funcName );
+        return int32_t( m_callCaches.size()-1 );
+    }
+
+    void emit( OpCode opCode )
+    {
+        m_code.push_back( int32_t(opCode) );
+        if ( opCode == OpCode::BUILTIN || opCode == OpCode::CALL_BUILTIN || opCode == OpCode::EVAL )
+        {
+            m_canCaptureFrame = true;
+        }
+    }
+    void emit( OpCode opCode, int32_t operand ) { emit( opCode ); m_code.push_back( operand ); }
+    void emit( OpCode opCode, int32_t operand1, int32_t operand2 ) { emit( opCode, operand1 ); m_code.push_back( operand2 ); }
+
+    // jump placeholder; returns the position to patch
+    int32_t emitJump( OpCode opCode ) { emit( opCode, 0 ); return int32_t( m_code.size()-1 ); }
+    void patchJump( int32_t position ) { m_code[position] = int32_t( m_code.size() ); }
+};
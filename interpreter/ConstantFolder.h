@@ -0,0 +1,304 @@
+#pragma once
+
+#include "SExpr.h"
+#include "Arithmetic.h"
+
+#include <vector>
+
+//---------------------------------------------------------------
+//
+// ConstantFolder - evaluates constant parts of a parsed form once
+//
+//---------------------------------------------------------------
+//
+//  Runs after Parser::parse(), before the form is evaluated:
+//
+//      (print (+ 25.5 (quote 11)) (* x (- 10 4)))
+//   -> (print 36.5 (* x 6))
+//
+//      (if (< 1 2) a b)  ->  a
+//
+//  A call is folded when its builtin is pure (arithmetic, comparisons,
+//  car and cdr) and all its arguments are constants: numbers and quoted
+//  values. Such a call has no side effects and its result does not depend
+//  on when it is made, so the folded form prints and returns the same as
+//  the original one. Calls that would report an error (a wrong number of
+//  arguments, not a number, division by 0) are left for the evaluation.
+//
+//  Constant subtrees are replaced by their value: a number, or (quote value)
+//  for anything else ('t' and 'nil' of comparisons included), so the result
+//  is a constant again for the enclosing call and for VirtualMachine (CONST).
+//
+//  Only code is folded: arguments of special forms are entered when the form
+//  is known to evaluate them ('if', 'print', 'set', 'OR', the body of 'defun').
+//  Results are allocated in the current region (the one of the form).
+//  It keeps no state, so parsers on other threads may use it (see Driver).
+//
+//---------------------------------------------------------------
+
+class ConstantFolder
+{
+    BuiltinFunc* m_quote = nullptr;
+    BuiltinFunc* m_defun = nullptr;
+    BuiltinFunc* m_if    = nullptr;
+    BuiltinFunc* m_set   = nullptr;
+    BuiltinFunc* m_print = nullptr;
+    BuiltinFunc* m_or    = nullptr;
+    BuiltinFunc* m_add   = nullptr;
+    BuiltinFunc* m_mul   = nullptr;
+    BuiltinFunc* m_div   = nullptr;
+    BuiltinFunc* m_car   = nullptr;
+    BuiltinFunc* m_cdr   = nullptr;
+
+    // without side effects; their arguments must be numbers (but of car and cdr)
+    std::vector<BuiltinFunc*> m_pureFuncs;
+
+    Atom* m_nilAtom = nullptr;
+
+    // passed to the pure builtins
+    LInterpreter* m_interpreter = nullptr;
+
+public:
+    // must be called when all builtins are registered
+    void init( LInterpreter& interpreter, const SymbolTable& symbolTable, Atom* nilAtom )
+    {
+        auto builtin = [&symbolTable]( const char* name ) -> BuiltinFunc*
+        {
+            Symbol* symbol = symbolTable.find( name );
+            return (symbol != nullptr) ? symbol->m_builtinFunc : nullptr;
+        };
+
+        m_quote = builtin( "quote" );
+        m_defun = builtin( "defun" );
+        m_if    = builtin( "if" );
+        m_set   = builtin( "set" );
+        m_print = builtin( "print" );
+        m_or    = builtin( "OR" );
+        m_add   = builtin( "+" );
+        m_mul   = builtin( "*" );
+        m_div   = builtin( "/" );
+        m_car   = builtin( "car" );
+        m_cdr   = builtin( "cdr" );
+
+        m_pureFuncs = { m_add, builtin( "-" ), m_mul, m_div, builtin( "<" ), builtin( ">" ), builtin( "=" ), builtin( "<=" ), builtin( ">=" ),
+                        m_car, m_cdr };
+        m_nilAtom = nilAtom;
+        m_interpreter = &interpreter;
+    }
+
+    // returns the folded form; lists of 'expr' are changed in place
+    ISExpr* fold( ISExpr* expr ) const
+    {
+        if ( expr == nullptr || expr->type() != ISExpr::LIST )
+        {
+            return expr;
+        }
+
+        List* list = expr->toList();
+        if ( list->isEmptyList() )
+        {
+            return expr;
+        }
+
+        ISExpr* head = list->m_car;
+        if ( head->type() == ISExpr::ATOM )
+        {
+            // call of a user function: its arguments are evaluated
+            foldArguments( list->m_cdr );
+            return expr;
+        }
+
+        BuiltinFunc* func = head->toBuiltinFunc();
+        if ( func == nullptr )
+        {
+            return expr;
+        }
+
+        if ( func == m_quote )
+        {
+            // (quote 11) -> 11
+            if ( list->m_cdr != nullptr && list->m_cdr->m_car != nullptr && isNumber( list->m_cdr->m_car ) )
+            {
+                return list->m_cdr->m_car;
+            }
+            return expr;
+        }
+
+        if ( func == m_defun )
+        {
+            // (defun name parameters body...)
+            if ( list->m_cdr != nullptr && list->m_cdr->m_cdr != nullptr )
+            {
+                foldArguments( list->m_cdr->m_cdr->m_cdr );
+            }
+            return expr;
+        }
+
+        if ( func == m_set )
+        {
+            // (set name value)
+            if ( list->m_cdr != nullptr )
+            {
+                foldArguments( list->m_cdr->m_cdr );
+            }
+            return expr;
+        }
+
+        if ( func == m_if )
+        {
+            return foldIf( list );
+        }
+
+        if ( func->isSpecialForm() )
+        {
+            if ( func == m_print || func == m_or )
+            {
+                foldArguments( list->m_cdr );
+            }
+            // others may use their arguments as data
+            return expr;
+        }
+
+        foldArguments( list->m_cdr );
+        if ( ! isPure( func ) )
+        {
+            return expr;
+        }
+        return foldCall( list, func );
+    }
+
+private:
+    static bool isNumber( ISExpr* expr )
+    {
+        return Arithmetic::isNumber( expr );
+    }
+
+    bool isPure( BuiltinFunc* func ) const
+    {
+        for( auto* pureFunc : m_pureFuncs )
+        {
+            if ( pureFunc == func )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool isQuote( ISExpr* expr ) const
+    {
+        return expr->type() == ISExpr::LIST && expr->toList()->m_car == m_quote && expr->toList()->m_cdr != nullptr;
+    }
+
+    bool isConstant( ISExpr* expr ) const
+    {
+        return expr != nullptr && ( isNumber( expr ) || isQuote( expr ) );
+    }
+
+    // value of a constant
+    ISExpr* valueOf( ISExpr* expr ) const
+    {
+        return isNumber( expr ) ? expr : expr->toList()->m_cdr->m_car;
+    }
+
+    // constant with the given value
+    ISExpr* literal( ISExpr* value ) const
+    {
+        if ( isNumber( value ) )
+        {
+            return value;
+        }
+        return new List( m_quote, new List( value ) );
+    }
+
+    void foldArguments( List* arguments ) const
+    {
+        for( auto* it = arguments; it != nullptr; it = it->m_cdr )
+        {
+            it->m_car = fold( it->m_car );
+        }
+    }
+
+    // (if cond then else) with a constant condition -> then or else
+    ISExpr* foldIf( List* list ) const
+    {
+        if ( list->m_cdr == nullptr || list->m_cdr->m_cdr == nullptr )
+        {
+            return list;
+        }
+
+        foldArguments( list->m_cdr );
+
+        ISExpr* condition = list->m_cdr->m_car;
+        if ( ! isConstant( condition ) )
+        {
+            return list;
+        }
+
+        ISExpr* value = valueOf( condition );
+        List* branches = list->m_cdr->m_cdr;
+        if ( value != nullptr && value != m_nilAtom )
+        {
+            return branches->m_car;
+        }
+        if ( branches->m_cdr != nullptr )
+        {
+            return branches->m_cdr->m_car;
+        }
+        return literal( m_nilAtom );
+    }
+
+    ISExpr* foldCall( List* list, BuiltinFunc* func ) const
+    {
+        std::vector<ISExpr*> args;
+        for( auto* it = list->m_cdr; it != nullptr; it = it->m_cdr )
+        {
+            if ( ! isConstant( it->m_car ) )
+            {
+                return list;
+            }
+            args.push_back( valueOf( it->m_car ) );
+        }
+        size_t argCount = args.size();
+
+        if ( func->arity() >= 0 && size_t( func->arity() ) != argCount )
+        {
+            return list;
+        }
+
+        if ( func == m_car || func == m_cdr )
+        {
+            // their argument may be anything
+            if ( args[0] == nullptr )
+            {
+                return list;
+            }
+        }
+        else
+        {
+            for( size_t i = 0; i < argCount; i++ )
+            {
+                if ( ! isNumber( args[i] ) )
+                {
+                    return list;
+                }
+            }
+            // only '+' and '*' take no arguments
+            if ( argCount == 0 && func != m_add && func != m_mul )
+            {
+                return list;
+            }
+            if ( func == m_div && Arithmetic::isDivisionByZero( args.data(), argCount ) )
+            {
+                return list;
+            }
+        }
+
+        ISExpr* value = func->argsFunc()( *m_interpreter, args.data(), argCount );
+        if ( value == nullptr )
+        {
+            return list;
+        }
+        return literal( value );
+    }
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+//
+// Cpu - instruction sets the code can use at run time (see ScannerSimd.cpp, ArraySimd.cpp)
+//
+
+#if defined(__x86_64__) || defined(_M_X64)
+    #define LISP_X86_64 1
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#endif
+
+// AVX2 code is compiled for the function only; it is called when the CPU has AVX2
+#if defined(LISP_X86_64) && (defined(__GNUC__) || defined(__clang__))
+    #define LISP_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+    #define LISP_TARGET_AVX2
+#endif
+
+inline bool cpuHasAvx2()
+{
+#if defined(LISP_X86_64) && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_cpu_supports( "avx2" );
+#elif defined(LISP_X86_64) && defined(_MSC_VER)
+    int info[4];
+    __cpuid( info, 0 );
+    if ( info[0] < 7 )
+    {
+        return false;
+    }
+    // AVX2 registers must be enabled by the OS as well (OSXSAVE + XCR0)
+    __cpuid( info, 1 );
+    bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+    __cpuidex( info, 7, 0 );
+    return osSavesYmm && (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
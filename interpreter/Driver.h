@@ -0,0 +1,141 @@
+#pragma once
+
+#include "LInterpreter.h"
+#include "FormReader.h"
+#include "BoundedQueue.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+//---------------------------------------------------------------
+//
+// Driver - evaluates the forms of a stream while the next ones are parsed
+//
+//---------------------------------------------------------------
+//
+//  parser thread                          evaluating (calling) thread
+//
+//  FormReader::nextForm() ->
+//  Parser::parse() into a free Arena -> [ queue of parsed forms ] -> LInterpreter::evalForm()
+//                                                                    LInterpreter::releaseTemporaries()
+//                ^-------------------- [ free arenas ] <------------ arena is reset
+//
+//  Every form is parsed into an Arena of its own, so the parser thread never
+//  touches GcHeap; it only shares the symbol table with LInterpreter
+//  (guarded by LInterpreter::m_symbolMutex while the thread runs, see
+//  LInterpreter::setSymbolTableShared). Parsing runs at most
+//  'queueCapacity' forms ahead of evaluation.
+//
+//---------------------------------------------------------------
+
+class Driver
+{
+    LInterpreter& m_interpreter;
+    size_t        m_queueCapacity;
+
+    // REPL: results are printed and a prompt is shown
+    bool          m_isInteractive = false;
+
+    struct ParsedForm
+    {
+        ISExpr* m_expr  = nullptr;
+        Arena*  m_arena = nullptr;
+    };
+
+public:
+    Driver( LInterpreter& interpreter, size_t queueCapacity = 8 ) : m_interpreter(interpreter), m_queueCapacity(queueCapacity) {}
+
+    void setInteractive( bool isInteractive ) { m_isInteractive = isInteractive; }
+
+    // returns when all forms of 'reader' are evaluated
+    void run( FormReader& reader )
+    {
+        // one arena per form in the queue, plus the one being evaluated
+        std::vector<std::unique_ptr<Arena>> arenas;
+        BoundedQueue<Arena*>     freeArenas( m_queueCapacity + 1 );
+        BoundedQueue<ParsedForm> parsedForms( m_queueCapacity );
+        for( size_t i = 0; i < m_queueCapacity + 1; i++ )
+        {
+            arenas.push_back( std::make_unique<Arena>() );
+            freeArenas.push( arenas.back().get() );
+        }
+
+        m_interpreter.setSymbolTableShared( true );
+        std::thread parserThread( [&]
+        {
+            Parser parser;
+            m_interpreter.initParser( parser );
+
+            std::string_view text;
+            while( reader.nextForm( text ) )
+            {
+                Arena* arena;
+                if ( ! freeArenas.pop( arena ) )
+                {
+                    break;
+                }
+
+                ISExpr* expr;
+                {
+                    AllocatorScope scope( *arena );
+                    parser.setSource( text );
+                    expr = m_interpreter.foldConstants( parser.parse() );
+                }
+
+                if ( expr == nullptr )
+                {
+                    // syntax error (reported by the parser)
+                    arena->reset();
+                    freeArenas.push( arena );
+                    continue;
+                }
+                if ( ! parsedForms.push( ParsedForm{ expr, arena } ) )
+                {
+                    break;
+                }
+            }
+            parsedForms.close();
+        });
+
+        prompt();
+        ParsedForm form;
+        while( parsedForms.pop( form ) )
+        {
+            ISExpr* result = m_interpreter.evalForm( form.m_expr, *form.m_arena );
+            if ( m_isInteractive )
+            {
+                // after what the form printed
+                std::ostream& output = m_interpreter.output();
+                output << "\n";
+                if ( result != nullptr )
+                {
+                    result->print( output );
+                }
+                else
+                {
+                    output << "NIL";
+                }
+                output << "\n";
+            }
+
+            m_interpreter.releaseTemporaries( *form.m_arena );
+            freeArenas.push( form.m_arena );
+            prompt();
+        }
+
+        freeArenas.close();
+        parserThread.join();
+        m_interpreter.setSymbolTableShared( false );
+    }
+
+private:
+    void prompt()
+    {
+        if ( m_isInteractive )
+        {
+            m_interpreter.output() << "> ";
+            m_interpreter.flushOutput();
+        }
+    }
+};
@@ -0,0 +1,269 @@
+#pragma once
+
+#include "SExpr.h"
+
+#include <vector>
+
+//---------------------------------------------------------------
+//
+// Environment - lexical variables of user functions
+//
+//---------------------------------------------------------------
+//
+//  (defun add (x) (defun addX (y) (+ x y)) ...)
+//
+//  When a top-level 'defun' is evaluated, Resolver replaces every reference
+//  to a parameter in the function body (nested 'defun's included) by a
+//  LocalVariable: (depth, index) of the parameter, where depth is the number
+//  of enclosing functions to go up. Atoms that are not parameters stay
+//  global.
+//
+//  A call allocates one Frame with a slot per parameter; its parent is the
+//  frame the function was defined in (Closure::m_environment), so reading
+//  a variable is 'depth' pointer hops plus an array index:
+//
+//      addX frame          add frame
+//      !----------!        !----------!
+//      ! parent   !------->! parent   !-->(nullptr: globals)
+//      ! y        !        ! x        !
+//      !----------!        !----------!
+//
+//  Frames are garbage collected, so closures may outlive the call.
+//
+//  Calls of user functions in the body are resolved too: the name of the
+//  called function is replaced by a CallSite, an inline cache of the closure
+//  the name was bound to at the last call (see LInterpreter::cachedDefinition).
+//
+//---------------------------------------------------------------
+
+struct ByteCode;
+class  Closure;
+
+//------------------------
+// LocalVariable
+//------------------------
+class LocalVariable : public ISExpr
+{
+public:
+    Atom*    m_atom;
+    uint32_t m_depth;
+    uint32_t m_index;
+
+public:
+    LocalVariable( Atom* atom, uint32_t depth, uint32_t index ) : ISExpr(LOCAL_VARIABLE), m_atom(atom), m_depth(depth), m_index(index) {}
+
+    ISExpr* printObject( std::ostream& stream ) const
+    {
+        return m_atom->print( stream );
+    }
+};
+
+//------------------------
+// CallCache
+//------------------------
+// What a call of a user function found at its last call. It is used while the
+// atom is bound to the same closure and m_epoch is LInterpreter::m_codeEpoch
+// (so a closure freed by the collector cannot be mistaken for a new one at
+// the same address). The closure itself is not marked by the collector.
+struct CallCache
+{
+    Atom*     m_atom;
+    Closure*  m_closure   = nullptr;
+    uint64_t  m_epoch     = 0;
+    uint32_t  m_slotCount = 0;          // number of parameters
+    ByteCode* m_code      = nullptr;    // of VirtualMachine
+
+    explicit CallCache( Atom* atom ) : m_atom(atom) {}
+};
+
+//------------------------
+// CallSite
+//------------------------
+// name of the function in ( name arguments... ) of a resolved function body
+class CallSite : public ISExpr
+{
+public:
+    CallCache m_cache;
+
+public:
+    CallSite( Atom* atom ) : ISExpr(CALL_SITE), m_cache(atom) {}
+
+    ISExpr* printObject( std::ostream& stream ) const
+    {
+        return m_cache.m_atom->print( stream );
+    }
+};
+
+//------------------------
+// Frame
+//------------------------
+class Frame : public ISExpr
+{
+public:
+    Frame*   m_parent;
+    uint32_t m_size;
+
+    // not in the heap: reused by VirtualMachine when the call returns (see ByteCode::m_canCaptureFrame)
+    bool     m_isPooled = false;
+
+private:
+    Frame( Frame* parent, uint32_t size ) : ISExpr(FRAME), m_parent(parent), m_size(size) {}
+
+public:
+    // slots follow the object in the same cell
+    static Frame* make( Frame* parent, uint32_t size )
+    {
+        void* place = ISExpr::operator new( sizeof(Frame) + size * sizeof(ISExpr*) );
+        return new( place ) Frame( parent, size );
+    }
+
+    static Frame* makePooled( void* place, Frame* parent, uint32_t size )
+    {
+        Frame* frame = new( place ) Frame( parent, size );
+        frame->m_isPooled = true;
+        return frame;
+    }
+
+    ISExpr* printObject( std::ostream& stream ) const
+    {
+        stream << "#frame";
+        return nullptr;
+    }
+
+    ISExpr**       slots()       { return reinterpret_cast<ISExpr**>( this+1 ); }
+    ISExpr* const* slots() const { return reinterpret_cast<ISExpr* const*>( this+1 ); }
+};
+
+//------------------------
+// Closure
+//------------------------
+class Closure : public ISExpr
+{
+public:
+    List*  m_definition;    // ( parameters body... )
+    Frame* m_environment;   // nullptr for top-level functions
+
+public:
+    Closure( List* definition, Frame* environment ) : ISExpr(CLOSURE), m_definition(definition), m_environment(environment) {}
+
+    ISExpr* printObject( std::ostream& stream ) const
+    {
+        if ( m_definition == nullptr )
+        {
+            stream << "NIL";
+            return nullptr;
+        }
+        return m_definition->print( stream );
+    }
+};
+
+//------------------------
+// Resolver
+//------------------------
+class Resolver
+{
+    BuiltinFunc* m_quote = nullptr;
+    BuiltinFunc* m_defun = nullptr;
+
+    // parameter lists of the functions being resolved, innermost last
+    std::vector<List*> m_scopes;
+
+public:
+    void init( BuiltinFunc* quote, BuiltinFunc* defun )
+    {
+        m_quote = quote;
+        m_defun = defun;
+    }
+
+    // 'definition' is ( parameters body... ); it is changed in place.
+    // Already resolved parts are left as they are, so it can be called again.
+    void resolveFunction( List* definition )
+    {
+        m_scopes.clear();
+        resolveDefinition( definition );
+    }
+
+private:
+    void resolveDefinition( List* definition )
+    {
+        if ( definition == nullptr || definition->m_car == nullptr || definition->m_car->type() != ISExpr::LIST )
+        {
+            return;
+        }
+
+        m_scopes.push_back( definition->m_car->toList() );
+        for( auto* it = definition->m_cdr; it != nullptr; it = it->m_cdr )
+        {
+            it->m_car = resolve( it->m_car );
+        }
+        m_scopes.pop_back();
+    }
+
+    ISExpr* resolve( ISExpr* expr )
+    {
+        if ( expr == nullptr )
+        {
+            return expr;
+        }
+
+        switch( expr->type() )
+        {
+            case ISExpr::ATOM:
+                return lookup( expr->toAtom() );
+
+            case ISExpr::LIST:
+            {
+                List* list = expr->toList();
+                ISExpr* head = list->m_car;
+                if ( head == m_quote )
+                {
+                    return expr;
+                }
+                if ( head == m_defun )
+                {
+                    // (defun name parameters body...)
+                    if ( list->m_cdr != nullptr )
+                    {
+                        resolveDefinition( list->m_cdr->m_cdr );
+                    }
+                    return expr;
+                }
+
+                // names of called functions are always global
+                if ( head != nullptr && head->type() == ISExpr::ATOM )
+                {
+                    list->m_car = new CallSite( head->toAtom() );
+                }
+                else if ( head != nullptr )
+                {
+                    list->m_car = resolve( head );
+                }
+                for( auto* it = list->m_cdr; it != nullptr; it = it->m_cdr )
+                {
+                    it->m_car = resolve( it->m_car );
+                }
+                return expr;
+            }
+
+            default:
+                return expr;
+        }
+    }
+
+    ISExpr* lookup( Atom* atom )
+    {
+        uint32_t depth = 0;
+        for( auto scope = m_scopes.rbegin(); scope != m_scopes.rend(); ++scope, depth++ )
+        {
+            uint32_t index = 0;
+            for( auto* it = *scope; it != nullptr && it->m_car != nullptr; it = it->m_cdr, index++ )
+            {
+                if ( it->m_car == atom )
+                {
+                    return new LocalVariable( atom, depth, index );
+                }
+            }
+        }
+        return atom;
+    }
+};
@@ -0,0 +1,157 @@
+#include "FormReader.h"
+#include "Scanner.h"
+
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+FormReader::FormReader( std::istream& stream ) : m_stream( &stream )
+{
+}
+
+FormReader::FormReader( int fd ) : m_fd( fd )
+{
+}
+
+FormReader::FormReader( const std::string& fileName ) : m_ownsFd( true )
+{
+#ifdef _WIN32
+    m_fd = ::_open( fileName.c_str(), _O_RDONLY | _O_BINARY );
+#else
+    m_fd = ::open( fileName.c_str(), O_RDONLY );
+#endif
+}
+
+FormReader::~FormReader()
+{
+    if ( m_ownsFd && m_fd >= 0 )
+    {
+#ifdef _WIN32
+        ::_close( m_fd );
+#else
+        ::close( m_fd );
+#endif
+    }
+}
+
+bool FormReader::readMore()
+{
+    if ( m_stream != nullptr )
+    {
+        std::string line;
+        if ( ! std::getline( *m_stream, line ) )
+        {
+            return false;
+        }
+        m_buffer += line;
+        m_buffer += '\n';
+        return true;
+    }
+
+    if ( m_fd < 0 )
+    {
+        return false;
+    }
+
+    constexpr size_t cChunkSize = 64*1024;
+    size_t size = m_buffer.size();
+    m_buffer.resize( size + cChunkSize );
+#ifdef _WIN32
+    int count = ::_read( m_fd, m_buffer.data() + size, unsigned(cChunkSize) );
+#else
+    ssize_t count = ::read( m_fd, m_buffer.data() + size, cChunkSize );
+#endif
+    m_buffer.resize( size + (count > 0 ? size_t(count) : 0) );
+    return count > 0;
+}
+
+size_t FormReader::formEnd( std::string_view text )
+{
+    size_t offset = m_resumeOffset;
+    Scanner scanner;
+    scanner.setSource( text.substr( offset ) );
+    int depth = m_resumeDepth;
+
+    for(;;)
+    {
+        auto token = scanner.getNextToken();
+        size_t position = offset + scanner.position();
+
+        switch( token.m_type )
+        {
+            case Scanner::LEFT_BRACKET:
+                depth++;
+                break;
+
+            case Scanner::RIGHT_BRACKET:
+                // unexpected ')' is returned as a form as well (the parser reports it)
+                if ( depth > 0 )
+                {
+                    depth--;
+                }
+                if ( depth == 0 )
+                {
+                    return position;
+                }
+                break;
+
+            case Scanner::ATOM:
+                if ( depth == 0 )
+                {
+                    // the atom may continue in the next chunk
+                    return ( position < text.size() || m_isEof ) ? position : std::string_view::npos;
+                }
+                continue;
+
+            default:
+                return std::string_view::npos;
+        }
+
+        // an atom after the last bracket may be incomplete, so the scan is resumed from the bracket
+        m_resumeOffset = position;
+        m_resumeDepth  = depth;
+    }
+}
+
+bool FormReader::nextForm( std::string_view& form )
+{
+    for(;;)
+    {
+        std::string_view text( m_buffer.data() + m_begin, m_buffer.size() - m_begin );
+
+        size_t end = formEnd( text );
+        if ( end == std::string_view::npos && m_isEof )
+        {
+            Scanner scanner;
+            scanner.setSource( text );
+            if ( scanner.isAtEnd() )
+            {
+                return false;
+            }
+            // incomplete form at the end of input (the parser reports it)
+            end = text.size();
+        }
+
+        if ( end != std::string_view::npos )
+        {
+            form = text.substr( 0, end );
+            m_begin += end;
+            m_resumeOffset = 0;
+            m_resumeDepth = 0;
+            return true;
+        }
+
+        // returned forms are not needed any more
+        m_buffer.erase( 0, m_begin );
+        m_begin = 0;
+
+        if ( ! readMore() )
+        {
+            m_isEof = true;
+        }
+    }
+}
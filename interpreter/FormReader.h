@@ -0,0 +1,49 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+
+//
+// FormReader - splits input into top-level forms as it arrives
+//
+// Input is read in chunks (a line at a time from std::istream, whatever is
+// available from a file descriptor), so forms can be evaluated before the
+// whole input is read: a REPL on a terminal or a pipe, or a big data file.
+// A form spanning several chunks is returned when its last ')' arrives.
+//
+class FormReader
+{
+    std::istream* m_stream = nullptr;
+    int           m_fd = -1;
+    bool          m_ownsFd = false;
+
+    std::string   m_buffer;
+    size_t        m_begin = 0;      // text not returned yet
+    bool          m_isEof = false;
+
+    // an incomplete form is scanned again only from its last bracket
+    size_t        m_resumeOffset = 0;   // relative to m_begin
+    int           m_resumeDepth = 0;
+
+public:
+    FormReader( std::istream& stream );
+    FormReader( int fd );
+    FormReader( const std::string& fileName );
+    ~FormReader();
+
+    FormReader( const FormReader& ) = delete;
+    FormReader& operator=( const FormReader& ) = delete;
+
+    bool isOpen() const { return m_stream != nullptr || m_fd >= 0; }
+
+    // the next top-level form, a view into the buffer valid until the next call;
+    // false when only whitespace is left
+    bool nextForm( std::string_view& form );
+
+private:
+    bool   readMore();
+
+    // end of the first form of 'text' or npos when it is not complete yet
+    size_t formEnd( std::string_view text );
+};
@@ -0,0 +1,382 @@
+#include "GcHeap.h"
+#include "SExpr.h"
+#include "Environment.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csetjmp>
+#include <cstdlib>
+#include <cstring>
+
+GcHeap::~GcHeap()
+{
+    for( auto& [begin, page] : m_pages )
+    {
+        std::free( page->m_begin );
+        delete page;
+    }
+}
+
+void* GcHeap::allocateCell( size_t size, CellState state )
+{
+    if ( m_bytesSinceCollection >= m_collectAfter && m_stackBase != nullptr && m_noCollectCounter == 0 )
+    {
+        collect();
+    }
+
+    size_t sizeClass = 0;
+    while( sizeClass < cSizeClassCount && cSizeClasses[sizeClass] < size )
+    {
+        sizeClass++;
+    }
+
+    char* cell;
+    size_t cellSize;
+    Page* page = nullptr;
+
+    if ( sizeClass == cSizeClassCount )
+    {
+        // large object - a page of its own
+        cellSize = (size + 15) & ~size_t(15);
+        page = addPage( cellSize, 1 );
+        cell = page->m_begin;
+    }
+    else
+    {
+        cellSize = cSizeClasses[sizeClass];
+        if ( m_freeLists[sizeClass] == nullptr )
+        {
+            page = addPage( cellSize, cPageSize / cellSize );
+
+            // link cells in address order
+            for( size_t i = page->m_cellCount; i-- > 0; )
+            {
+                auto* freeCell = reinterpret_cast<FreeCell*>( page->m_begin + i*cellSize );
+                freeCell->m_next = m_freeLists[sizeClass];
+                m_freeLists[sizeClass] = freeCell;
+            }
+        }
+
+        cell = reinterpret_cast<char*>( m_freeLists[sizeClass] );
+        m_freeLists[sizeClass] = m_freeLists[sizeClass]->m_next;
+        findCell( cell, &page );
+    }
+
+    page->m_state[ (cell - page->m_begin) / cellSize ] = state | YOUNG;
+    if ( ! page->m_hasYoung )
+    {
+        page->m_hasYoung = true;
+        m_youngPages.push_back( page );
+    }
+
+    // a collection can happen before the object is constructed
+    // ('new List( a, new List(b) )' allocates the outer list first),
+    // such cell is recognized by its zero header (see ISExpr::m_isConstructed)
+    std::memset( cell, 0, cellSize );
+
+    m_heapBytes += cellSize;
+    m_bytesSinceCollection += cellSize;
+    m_stats.m_allocations++;
+    return cell;
+}
+
+bool GcHeap::isConstructed( const void* cell )
+{
+    return static_cast<const ISExpr*>( cell )->m_isConstructed != 0;
+}
+
+GcHeap::Page* GcHeap::addPage( size_t cellSize, size_t cellCount )
+{
+    auto* page = new Page;
+    page->m_begin = static_cast<char*>( std::malloc( cellSize * cellCount ) );
+    if ( page->m_begin == nullptr )
+    {
+        delete page;
+        throw std::bad_alloc();
+    }
+    page->m_cellSize  = uint32_t(cellSize);
+    page->m_cellCount = uint32_t(cellCount);
+    page->m_state.assign( cellCount, FREE );
+
+    auto begin = reinterpret_cast<uintptr_t>( page->m_begin );
+    auto end   = reinterpret_cast<uintptr_t>( page->end() );
+    m_pages[begin] = page;
+    if ( begin < m_lowest )  { m_lowest = begin; }
+    if ( end > m_highest )   { m_highest = end; }
+
+    return page;
+}
+
+// returns the beginning of the cell containing 'ptr' (interior pointers too)
+char* GcHeap::findCell( const void* ptr, Page** page ) const
+{
+    auto address = reinterpret_cast<uintptr_t>( ptr );
+    if ( address < m_lowest || address >= m_highest )
+    {
+        return nullptr;
+    }
+
+    auto it = m_pages.upper_bound( address );
+    if ( it == m_pages.begin() )
+    {
+        return nullptr;
+    }
+    --it;
+
+    Page* found = it->second;
+    if ( address >= reinterpret_cast<uintptr_t>( found->end() ) )
+    {
+        return nullptr;
+    }
+
+    if ( page != nullptr )
+    {
+        *page = found;
+    }
+    size_t index = (address - it->first) / found->m_cellSize;
+    return found->m_begin + index * found->m_cellSize;
+}
+
+bool GcHeap::isYoung( const void* ptr ) const
+{
+    Page* page;
+    char* cell = findCell( ptr, &page );
+    return cell != nullptr && ( page->m_state[ (cell - page->m_begin) / page->m_cellSize ] & YOUNG ) != 0;
+}
+
+void GcHeap::clearYoung()
+{
+    for( Page* page : m_youngPages )
+    {
+        for( uint8_t& state : page->m_state )
+        {
+            state &= ~YOUNG;
+        }
+        page->m_hasYoung = false;
+    }
+    m_youngPages.clear();
+}
+
+void GcHeap::mark( const ISExpr* expr )
+{
+    markExpr( expr );
+    drainMarkStack();
+}
+
+void GcHeap::markReferences( const ISExpr* expr )
+{
+    m_markStack.push_back( expr );
+    drainMarkStack();
+}
+
+void GcHeap::markExpr( const ISExpr* expr )
+{
+    // fixnums are not in the heap
+    if ( expr != nullptr && ! expr->isFixnum() )
+    {
+        markCell( expr );
+    }
+}
+
+void GcHeap::markCell( const void* ptr )
+{
+    Page* page;
+    char* cell = findCell( ptr, &page );
+    if ( cell == nullptr )
+    {
+        // not ours (evaluation region, default arena ...)
+        return;
+    }
+
+    uint8_t& state = page->m_state[ (cell - page->m_begin) / page->m_cellSize ];
+    if ( state == FREE || (state & MARKED) )
+    {
+        return;
+    }
+    state |= MARKED;
+
+    if ( state & OBJECT )
+    {
+        m_markStack.push_back( cell );
+    }
+}
+
+void GcHeap::drainMarkStack()
+{
+    while( ! m_markStack.empty() )
+    {
+        auto* expr = static_cast<ISExpr*>( const_cast<void*>( m_markStack.back() ) );
+        m_markStack.pop_back();
+
+        if ( ! isConstructed( expr ) )
+        {
+            continue;
+        }
+
+        switch( expr->type() )
+        {
+            case ISExpr::LIST:
+            {
+                List* list = expr->toList();
+                markExpr( list->m_car );
+                markExpr( list->m_cdr );
+                break;
+            }
+            case ISExpr::ATOM:
+            {
+                Atom* atom = expr->toAtom();
+                markCell( atom->name() );
+                markExpr( atom->value() );
+                break;
+            }
+            case ISExpr::BUILT_IN_FUNC:
+            {
+                markCell( expr->toBuiltinFunc()->name() );
+                break;
+            }
+            case ISExpr::LOCAL_VARIABLE:
+            {
+                markExpr( static_cast<LocalVariable*>( expr )->m_atom );
+                break;
+            }
+            case ISExpr::CALL_SITE:
+            {
+                markExpr( static_cast<CallSite*>( expr )->m_cache.m_atom );
+                break;
+            }
+            case ISExpr::CLOSURE:
+            {
+                auto* closure = static_cast<Closure*>( expr );
+                markExpr( closure->m_definition );
+                markExpr( closure->m_environment );
+                break;
+            }
+            case ISExpr::FRAME:
+            {
+                auto* frame = static_cast<Frame*>( expr );
+                markExpr( frame->m_parent );
+                for( uint32_t i = 0; i < frame->m_size; i++ )
+                {
+                    markExpr( frame->slots()[i] );
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+// reading the whole stack is intended here
+#if defined(__GNUC__)
+__attribute__((no_sanitize_address))
+#endif
+void GcHeap::scanStack()
+{
+    // spill callee-saved registers, so pointers held in them are seen too
+    std::jmp_buf registers;
+    setjmp( registers );
+#if defined(__GNUC__)
+    __builtin_unwind_init();
+#endif
+
+    auto* top  = reinterpret_cast<const char*>( &registers );
+    auto* base = static_cast<const char*>( m_stackBase );
+    const char* begin = (top < base) ? top : base;
+    const char* end   = (top < base) ? base : top + sizeof(registers);
+
+    begin = reinterpret_cast<const char*>( reinterpret_cast<uintptr_t>(begin) & ~(sizeof(void*)-1) );
+    for( const char* it = begin; it + sizeof(void*) <= end; it += sizeof(void*) )
+    {
+        const void* candidate;
+        std::memcpy( &candidate, it, sizeof(candidate) );
+        markCell( candidate );
+    }
+    drainMarkStack();
+}
+
+void GcHeap::collect()
+{
+    NoCollectScope noCollect( *this );
+    auto start = std::chrono::steady_clock::now();
+
+    if ( m_rootMarker )
+    {
+        m_rootMarker( *this );
+    }
+    if ( m_stackBase != nullptr )
+    {
+        scanStack();
+    }
+    sweep();
+
+    // do not collect again until the heap has grown by its live size
+    m_bytesSinceCollection = 0;
+    m_collectAfter = (m_heapBytes > m_threshold) ? m_heapBytes : m_threshold;
+
+    double pauseMs = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+    m_stats.m_collections++;
+    m_stats.m_lastPauseMs = pauseMs;
+    m_stats.m_totalPauseMs += pauseMs;
+}
+
+void GcHeap::sweep()
+{
+    for( auto it = m_pages.begin(); it != m_pages.end(); )
+    {
+        Page* page = it->second;
+
+        size_t sizeClass = 0;
+        while( sizeClass < cSizeClassCount && cSizeClasses[sizeClass] != page->m_cellSize )
+        {
+            sizeClass++;
+        }
+
+        size_t liveCells = 0;
+        for( size_t i = 0; i < page->m_cellCount; i++ )
+        {
+            uint8_t& state = page->m_state[i];
+            if ( state == FREE )
+            {
+                continue;
+            }
+            if ( state & MARKED )
+            {
+                state &= ~MARKED;
+                liveCells++;
+                continue;
+            }
+
+            char* cell = page->m_begin + i * page->m_cellSize;
+            // objects are trivially destructible (see SExpr.cpp): nothing to call
+            if ( (state & OBJECT) && isConstructed( cell ) )
+            {
+                m_stats.m_objectsFreed++;
+            }
+            state = FREE;
+            m_heapBytes -= page->m_cellSize;
+            m_stats.m_bytesFreed += page->m_cellSize;
+
+            if ( sizeClass < cSizeClassCount )
+            {
+                auto* freeCell = reinterpret_cast<FreeCell*>( cell );
+                freeCell->m_next = m_freeLists[sizeClass];
+                m_freeLists[sizeClass] = freeCell;
+            }
+        }
+
+        if ( sizeClass == cSizeClassCount && liveCells == 0 )
+        {
+            // large object page is not reused
+            if ( page->m_hasYoung )
+            {
+                m_youngPages.erase( std::find( m_youngPages.begin(), m_youngPages.end(), page ) );
+            }
+            std::free( page->m_begin );
+            delete page;
+            it = m_pages.erase( it );
+            continue;
+        }
+        ++it;
+    }
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "Arena.h"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+class ISExpr;
+
+//---------------------------------------------------------------
+//
+// GcHeap - mark-and-sweep garbage collected heap
+//
+//---------------------------------------------------------------
+//
+//  Cells of one size class are carved from 64K pages; free cells are
+//  linked through their first word. Every cell has a state byte in its
+//  page: free, object (ISExpr), raw (name of an atom) and the mark bit.
+//
+//  Roots:
+//    - whatever the root marker (set by LInterpreter) marks:
+//      atoms, builtins, frames of user functions being called
+//    - the C++ stack between the stack base (outermost LInterpreter::eval)
+//      and the collecting frame, scanned conservatively
+//
+//  Collection is triggered from allocate() when the bytes allocated since
+//  the last collection exceed the threshold (or the live size, if bigger),
+//  and only while a stack base is set (i.e. inside evaluation).
+//
+//  Cells allocated since the last clearYoung() are young: the objects of the
+//  form being evaluated (LInterpreter::releaseTemporaries follows only those).
+//
+//---------------------------------------------------------------
+
+struct GcStats
+{
+    uint64_t m_allocations    = 0;
+    uint64_t m_collections    = 0;
+    uint64_t m_bytesFreed     = 0;
+    uint64_t m_objectsFreed   = 0;
+    double   m_totalPauseMs   = 0;
+    double   m_lastPauseMs    = 0;
+};
+
+class GcHeap : public SExprAllocator
+{
+public:
+    using RootMarker = std::function< void (GcHeap&) >;
+
+private:
+    enum CellState : uint8_t {
+        FREE   = 0,
+        OBJECT = 1,
+        RAW    = 2,
+        MARKED = 4,
+        YOUNG  = 8
+    };
+
+    struct FreeCell { FreeCell* m_next; };
+
+    struct Page
+    {
+        char*                 m_begin;
+        uint32_t              m_cellSize;
+        uint32_t              m_cellCount;
+        std::vector<uint8_t>  m_state;
+        bool                  m_hasYoung = false;
+
+        char* end() const { return m_begin + size_t(m_cellSize) * m_cellCount; }
+    };
+
+    static constexpr size_t cPageSize = 64*1024;
+    static constexpr size_t cSizeClasses[] = { 16, 24, 32, 48, 64, 96, 128, 192, 256 };
+    static constexpr size_t cSizeClassCount = sizeof(cSizeClasses)/sizeof(cSizeClasses[0]);
+
+    FreeCell*   m_freeLists[cSizeClassCount] = {};
+
+    // page begin -> page (for finding the cell of an arbitrary address)
+    std::map<uintptr_t, Page*> m_pages;
+    uintptr_t   m_lowest  = UINTPTR_MAX;
+    uintptr_t   m_highest = 0;
+
+    std::vector<const void*> m_markStack;
+
+    // pages with young cells
+    std::vector<Page*> m_youngPages;
+
+    RootMarker  m_rootMarker;
+    const void* m_stackBase = nullptr;
+    int         m_noCollectCounter = 0;
+
+    size_t      m_heapBytes = 0;
+    size_t      m_bytesSinceCollection = 0;
+    size_t      m_threshold;
+    size_t      m_collectAfter;
+
+    GcStats     m_stats;
+
+public:
+    GcHeap( size_t threshold = 4*1024*1024 ) : m_threshold(threshold), m_collectAfter(threshold) {}
+    ~GcHeap();
+
+    GcHeap( const GcHeap& ) = delete;
+    GcHeap& operator=( const GcHeap& ) = delete;
+
+    void* allocate( size_t size ) override { return allocateCell( size, OBJECT ); }
+    void* allocateRaw( size_t size ) override { return allocateCell( size, RAW ); }
+
+    void setRootMarker( RootMarker rootMarker ) { m_rootMarker = rootMarker; }
+
+    // outermost frame that can hold pointers to the heap; nullptr disables collection
+    const void* stackBase() const { return m_stackBase; }
+    void setStackBase( const void* stackBase ) { m_stackBase = stackBase; }
+
+    // marks 'expr' and everything reachable from it (called by the root marker)
+    void mark( const ISExpr* expr );
+
+    // marks what an object outside of the heap (of a Snapshot) refers to
+    void markReferences( const ISExpr* expr );
+
+    bool contains( const void* ptr ) const { return findCell( ptr, nullptr ) != nullptr; }
+
+    // a cell of the heap allocated since the last clearYoung()
+    bool isYoung( const void* ptr ) const;
+
+    // all cells allocated so far are not young any more
+    void clearYoung();
+
+    void collect();
+
+    const GcStats& stats() const { return m_stats; }
+    size_t heapBytes() const { return m_heapBytes; }
+    size_t threshold() const { return m_threshold; }
+    void setThreshold( size_t threshold ) { m_threshold = m_collectAfter = threshold; }
+
+    //
+    // NoCollectScope - collection is postponed while data is held outside of roots
+    //
+    class NoCollectScope
+    {
+        GcHeap& m_heap;
+    public:
+        NoCollectScope( GcHeap& heap ) : m_heap(heap) { m_heap.m_noCollectCounter++; }
+        ~NoCollectScope() { m_heap.m_noCollectCounter--; }
+    };
+
+private:
+    void* allocateCell( size_t size, CellState state );
+    Page* addPage( size_t cellSize, size_t cellCount );
+
+    char* findCell( const void* ptr, Page** page ) const;
+    static bool isConstructed( const void* cell );
+
+    void markExpr( const ISExpr* expr );
+    void markCell( const void* ptr );
+    void drainMarkStack();
+    void scanStack();
+    void sweep();
+};
@@ -1,91 +1,211 @@
 #include "LInterpreter.h"
-#include <cassert>
+#include "Parallel.h"
+#include "Arithmetic.h"
+#include <fstream>
 
-LInterpreter* LInterpreter::gLInterpreterInstance = nullptr;
+//
+// Builtins with evaluated arguments (see BuiltinFunc)
+//
 
-LInterpreter::LInterpreter()
+// (car (quote (a b))) -> a
+static ISExpr* car( LInterpreter& interpreter, ISExpr* list )
+{
+    if ( list->type() != ISExpr::LIST || list->toList()->m_car == nullptr )
+    {
+        return interpreter.m_nilAtom;
+    }
+    return list->toList()->m_car;
+}
+
+// (cdr (quote (a b))) -> (b)
+static ISExpr* cdr( LInterpreter& interpreter, ISExpr* list )
+{
+    if ( list->type() != ISExpr::LIST || list->toList()->m_cdr == nullptr )
+    {
+        return interpreter.m_nilAtom;
+    }
+    return list->toList()->m_cdr;
+}
+
+// (cons a (quote (b))) -> (a b), (cons a nil) -> (a)
+static ISExpr* cons( LInterpreter& interpreter, ISExpr* first, ISExpr* rest )
+{
+    if ( rest->type() == ISExpr::LIST )
+    {
+        return new List( first, rest->toList() );
+    }
+    if ( ! interpreter.isNil( rest ) )
+    {
+        LOG_ERR( "cons: second argument must be a list" );
+    }
+    return new List( first );
+}
+
+// (- 10 1 2) -> 7, (* 2 3) -> 6, (/ 1 4) -> 0.25, (- 5) -> -5 (see Arithmetic)
+template<Arithmetic::Op op>
+static ISExpr* arithmetic( LInterpreter& interpreter, ISExpr* const* args, size_t argCount )
+{
+    ISExpr* result = (argCount == 2) ? Arithmetic::apply2( op, args[0], args[1] ) : Arithmetic::apply( op, args, argCount );
+    if ( result != nullptr )
+    {
+        return result;
+    }
+    if ( argCount == 0 )
+    {
+        LOG_ERR( "'" << Arithmetic::name( op ) << "' expects at least 1 argument" );
+    }
+    else
+    {
+        LOG_ERR( "'" << Arithmetic::name( op ) << "': number expected" );
+    }
+    return interpreter.m_nilAtom;
+}
+
+// (> 2 1) -> t, (> 1 2) -> nil, (< 1 2 3) -> t, (= 2 2.0) -> t
+template<Arithmetic::Comparison comparison>
+static ISExpr* compare( LInterpreter& interpreter, ISExpr* const* args, size_t argCount )
+{
+    bool isTrue;
+    bool isValid = (argCount == 2) ? Arithmetic::compare2( comparison, args[0], args[1], isTrue )
+                                   : Arithmetic::compare( comparison, args, argCount, isTrue );
+    if ( ! isValid )
+    {
+        LOG_ERR( "'" << Arithmetic::name( comparison ) << "' expects numbers" );
+        return interpreter.m_nilAtom;
+    }
+    return isTrue ? interpreter.m_trueAtom : interpreter.m_nilAtom;
+}
+
+// (flush) -> nil: the buffered output is written (see OutputBuffer)
+static ISExpr* flush( LInterpreter& interpreter )
+{
+    interpreter.flushOutput();
+    return interpreter.m_nilAtom;
+}
+
+// (gc-stats) -> ( collections N bytes-freed N objects-freed N pause-ms X last-pause-ms X heap-bytes N )
+static ISExpr* getGcStats( LInterpreter& interpreter )
+{
+    return interpreter.gcStats();
+}
+
+// (+ 1 2 3) -> 6, (+ 1 2.5) -> 3.5
+// (+ "save x: " 10 567) -> "save x: 10567"
+static ISExpr* add( LInterpreter& interpreter, ISExpr* const* values, size_t argCount )
 {
-    assert( gLInterpreterInstance == nullptr );
-    gLInterpreterInstance = this;
+    ISExpr* sum = (argCount == 2) ? Arithmetic::apply2( Arithmetic::ADD, values[0], values[1] ) : Arithmetic::apply( Arithmetic::ADD, values, argCount );
+    if ( sum != nullptr )
+    {
+        return sum;
+    }
 
-    m_nilAtom = new Atom("nil");
-    m_globalVariableMap["nil"] = m_nilAtom;
+    // lists and functions have no sum, atoms turn it into a concatenation
+    ISExpr::Type returnType = ISExpr::INT_NUMBER;
+    for( size_t i = 0; i < argCount; i++ )
+    {
+        auto type = values[i]->type();
+        if ( type < returnType )
+        {
+            returnType = type;
+        }
+    }
 
-    m_parser.init( m_globalVariableMap, m_builtInFuncMap );
+    switch( returnType )
+    {
+        case ISExpr::ATOM:
+        {
+            std::string text;
+            for( size_t i = 0; i < argCount; i++ )
+            {
+                ISExpr* value = values[i];
+                if ( value->type() == ISExpr::ATOM ) {
+                    text += value->toAtom()->name();
+                }
+                else if ( value->type() == ISExpr::DOUBLE ) {
+                    // spelled as print spells it
+                    char buffer[Double::cMaxTextSize];
+                    text += Double::format( buffer, value->toDouble()->doubleValue() );
+                }
+                else if ( value->type() == ISExpr::INT_NUMBER ) {
+                    text += std::to_string( value->toIntNumber()->intValue() );
+                }
+                else if ( value->type() == ISExpr::BIG_INT ) {
+                    text += BigValue( *static_cast<BigInt*>( value ) ).toString();
+                }
+            }
+            return new Atom( text.c_str() );
+        }
+
+        default:
+            return arithmetic<Arithmetic::ADD>( interpreter, values, argCount );
+    }
+}
+
+LInterpreter::LInterpreter()
+{
+    // builtins are allocated in the heap (and are roots of it), atoms in m_atomArena
+    AllocatorScope scope( m_heap );
+    m_heap.setRootMarker( [this]( GcHeap& heap ) { markRoots( heap ); } );
+
+    m_parser.init( m_symbolTable, m_atomArena, m_symbolMutex, m_isSymbolTableShared );
+    m_nilAtom = getAtom("nil");
+    m_trueAtom = getAtom("t");
 
     addPseudoTableFuncs();
+    addArrayFuncs();
+    addParallelFuncs();
+    addBinaryFuncs();
 
     // Add user fuction
-	m_builtInFuncMap["defun"] = new BuiltinFunc( "defun", [](List* expr) -> ISExpr*
+	addBuiltin( new BuiltinFunc( "defun", [](LInterpreter& interpreter, List* expr) -> ISExpr*
     {
         // get funcName
         auto* funcName = expr->m_car->toAtom();
         
+        // nested functions are resolved together with the enclosing one
+        Frame* environment = interpreter.currentFrame();
+        if ( environment == nullptr )
+        {
+            interpreter.resolveFunction( expr->m_cdr );
+        }
+
         // set value
-        funcName->setValue( expr->m_cdr );
+        funcName->setValue( new Closure( expr->m_cdr, environment ) );
+        interpreter.remember( funcName, funcName->value() );
         
         return funcName->value();
-	});
+	}));
     
 
     // quote
-    m_builtInFuncMap["quote"] = new BuiltinFunc( "quote", [](List* expr) -> ISExpr* {
+    addBuiltin( new BuiltinFunc( "quote", [](LInterpreter&, List* expr) -> ISExpr* {
         return expr->m_car;
-    });
+    }));
 
     // (print (+ a b) (+ d c) )
-    m_builtInFuncMap["print"] = new BuiltinFunc( "print", [](List* expr) -> ISExpr* {
-        ISExpr* result = LInterpreter::instance().m_nilAtom;
+    addBuiltin( new BuiltinFunc( "print", [](LInterpreter& interpreter, List* expr) -> ISExpr* {
+        ISExpr* result = interpreter.m_nilAtom;
         //expr->print("\ndbg: ");
 
+        std::ostream& output = interpreter.output();
         for( auto* it = expr; it != nullptr; it = it->m_cdr ) {
-            result = LInterpreter::instance().eval(it->m_car);
+            result = interpreter.eval(it->m_car);
             if ( result != nullptr )
             {
-                result->print( std::cout );
+                result->print( output );
             }
             else
             {
-                std::cout << "NIL";
+                output << "NIL";
             }
             if ( it->m_cdr != nullptr )
             {
-                std::cout << '_';
+                output << '_';
             }
 		}
 
         return result;
-	});
-
-    m_builtInFuncMap["car"] = new BuiltinFunc( "car", [](List* expr) -> ISExpr* {
-        if ( expr == nullptr )
-        {
-            return LInterpreter::instance().m_nilAtom;
-        }
-        return expr->m_car;
-    });
-
-    m_builtInFuncMap["cdr"] = new BuiltinFunc( "cdr", [](List* expr) -> ISExpr* {
-        if ( expr == nullptr )
-        {
-            return LInterpreter::instance().m_nilAtom;
-        }
-        return expr->m_cdr;
-    });
-
-    m_builtInFuncMap["cons"] = new BuiltinFunc( "cons", [](List* expr) -> ISExpr* {
-        if ( expr == nullptr )
-        {
-            return LInterpreter::instance().m_nilAtom;
-        }
-        expr->print("dbg:cons:");
-        std::cout << std::endl;
-        
-        auto* firstArg = expr->m_car;
-        auto* secondArg = expr->m_cdr->m_car->toList();
-
-        return new List( firstArg, secondArg );
-    });
+	}));
 
    
     // (set x 1) -> 1   
@@ -95,186 +215,142 @@ LInterpreter::LInterpreter()
     // (set x (+ a b c )) -> atom("abc")
     // (+ a (b c) d) -> atom("ad")
 
-    m_builtInFuncMap["set"] = new BuiltinFunc( "set", [](List* expr) -> ISExpr*
+    addBuiltin( new BuiltinFunc( "set", [](LInterpreter& interpreter, List* expr) -> ISExpr*
     {
         if ( expr == nullptr )
         {
-            return LInterpreter::instance().m_nilAtom;
+            return interpreter.m_nilAtom;
+        }
+        auto* value = (expr->m_cdr==nullptr) ? interpreter.m_nilAtom
+                                             : interpreter.eval( expr->m_cdr->m_car );
+
+        // parameter of a function
+        if ( expr->m_car->type() == ISExpr::LOCAL_VARIABLE )
+        {
+            auto* variable = static_cast<LocalVariable*>( expr->m_car );
+            if ( ISExpr** slot = interpreter.localSlot( interpreter.currentFrame(), variable ); slot != nullptr )
+            {
+                *slot = value;
+                interpreter.remember( interpreter.localFrame( interpreter.currentFrame(), variable->m_depth ), value );
+            }
+            return value;
         }
+
         auto* var   = expr->m_car->toAtom();
-        auto* value = (expr->m_cdr==nullptr) ? LInterpreter::instance().m_nilAtom
-                                             : LInterpreter::instance().eval( expr->m_cdr->m_car );
 //        var->print0("\nvar: ");
-//        if ( var == LInterpreter::instance().getAtom("1playerX") )
+//        if ( var == interpreter.getAtom("1playerX") )
 //        {
 //            value->print0("\nvalue: ");
 //        }
         var->setValue( value );
+        interpreter.remember( var, value );
         return value;
-    });
-
-    m_builtInFuncMap["-"] = new BuiltinFunc( "-", [](List* expr) -> ISExpr*
-    {
-        auto* value1 = LInterpreter::instance().eval( expr->m_car );
-        auto* value2 = LInterpreter::instance().eval( expr->m_cdr->m_car );
-        
-        if ( value1->type()==ISExpr::INT_NUMBER && value2->type()==ISExpr::INT_NUMBER )
-        {
-            return new IntNumber( value1->toIntNumber()->intValue() - value2->toIntNumber()->intValue() );
-        }
-
-        return new Double( value1->toNumberBase()->doubleValue() - value2->toNumberBase()->doubleValue() );
-    });
-
-    m_builtInFuncMap["/"] = new BuiltinFunc( "/", [](List* expr) -> ISExpr*
-    {
-        auto* value1 = LInterpreter::instance().eval( expr->m_car );
-        auto* value2 = LInterpreter::instance().eval( expr->m_cdr->m_car );
-
-        if ( value2->toNumberBase()->doubleValue() == 0 )
-        {
-            LOG_ERR( "divide by 0" );
-        }
-        return new Double( value1->toNumberBase()->doubleValue() / value2->toNumberBase()->doubleValue() );
-    });
-
-    m_builtInFuncMap["*"] = new BuiltinFunc( "*", [](List* expr) -> ISExpr*
-    {
-        auto* value1 = LInterpreter::instance().eval( expr->m_car );
-        auto* value2 = LInterpreter::instance().eval( expr->m_cdr->m_car );
-
-        return new Double( value1->toNumberBase()->doubleValue() * value2->toNumberBase()->doubleValue() );
-    });
+    }));
 
     // OR
-    m_builtInFuncMap["OR"] = new BuiltinFunc( "OR", [](List* expr) -> ISExpr*
+    addBuiltin( new BuiltinFunc( "OR", [](LInterpreter& interpreter, List* expr) -> ISExpr*
     {
-        auto* value = LInterpreter::instance().eval( expr->m_car );
-        auto* secondValue = LInterpreter::instance().eval( expr->m_cdr->m_car );
-        bool first = LInterpreter::instance().isNil(value);
-        bool second = LInterpreter::instance().isNil(secondValue);
+        auto* value = interpreter.eval( expr->m_car );
+        auto* secondValue = interpreter.eval( expr->m_cdr->m_car );
+        bool first = interpreter.isNil(value);
+        bool second = interpreter.isNil(secondValue);
         
         if ( first || second )
         {
             return expr;
         }
         
-        return LInterpreter::instance().m_nilAtom;
-    });
+        return interpreter.m_nilAtom;
+    }));
 
-    // if
-    m_builtInFuncMap["if"] = new BuiltinFunc( "if", [](List* expr) -> ISExpr*
+    // (if cond then) -> value of 'then' or nil
+    // (if cond then else) -> value of 'then' or 'else'
+    addBuiltin( new BuiltinFunc( "if", [](LInterpreter& interpreter, List* expr) -> ISExpr*
     {
-        auto* x = LInterpreter::instance().eval(expr->m_car);
-        bool istrue = !LInterpreter::instance().isNil(x);
+        auto* x = interpreter.eval(expr->m_car);
+        bool istrue = !interpreter.isNil(x);
         if (istrue) {
-            LInterpreter::instance().eval(expr->m_cdr->m_car);
+            return interpreter.eval(expr->m_cdr->m_car);
+        }
+        if ( expr->m_cdr->m_cdr != nullptr )
+        {
+            return interpreter.eval(expr->m_cdr->m_cdr->m_car);
         }
-    });
+        return interpreter.m_nilAtom;
+    }));
 
-    m_builtInFuncMap[">"] = new BuiltinFunc( ">", [](List* expr) -> ISExpr*
+    // (profile on), (profile off), (profile reset)
+    // (profile report) -> flat profile to the output
+    // (profile folded stacks.txt) -> call paths for flame graphs to the file
+    addBuiltin( new BuiltinFunc( "profile", [](LInterpreter& interpreter, List* expr) -> ISExpr*
     {
-        auto value1 = LInterpreter::instance().eval( expr->m_car )->toNumberBase()->doubleValue();
-        auto value2 = LInterpreter::instance().eval( expr->m_cdr->m_car )->toNumberBase()->doubleValue();
-        if ( value1 > value2 )
+        if ( expr == nullptr || expr->m_car == nullptr || expr->m_car->type() != ISExpr::ATOM )
         {
-            return expr;
+            LOG_ERR( "profile: on, off, reset, report or folded <file> expected" );
+            return interpreter.m_nilAtom;
         }
-        return LInterpreter::instance().m_nilAtom;
-    });
-
-    m_builtInFuncMap["<"] = new BuiltinFunc( "<", [](List* expr) -> ISExpr*
- {
-        auto value1 = LInterpreter::instance().eval( expr->m_car )->toNumberBase()->doubleValue();
-        auto value2 = LInterpreter::instance().eval( expr->m_cdr->m_car )->toNumberBase()->doubleValue();
-        if ( value1 < value2 )
+
+        Profiler& profiler = interpreter.profiler();
+        std::string command = expr->m_car->toAtom()->name();
+        if ( command == "on" )
         {
-            return expr;
+            profiler.enable();
         }
-        return LInterpreter::instance().m_nilAtom;
- });
-
-    m_builtInFuncMap["+"] = new BuiltinFunc( "+", [](List* expr) -> ISExpr*
-    {
-        ISExpr* result = nullptr;
-        ISExpr::Type returnType = ISExpr::INT_NUMBER;
-        for (auto* it = expr; it != nullptr; it = it->m_cdr)
+        else if ( command == "off" )
         {
-            auto* value = LInterpreter::instance().eval( it->m_car );
-            if ( value->type() < returnType )
-            {
-                returnType = value->type();
-            }
+            profiler.disable();
         }
-        
-        switch (returnType)
+        else if ( command == "reset" )
         {
-                // (+ "save x: " 10 567) -> "save x: 10567"
-            case ISExpr::ATOM:
-            {
-                std::string returnValue;
-                for (auto* it = expr; it != nullptr; it = it->m_cdr)
-                {
-                    auto* value = LInterpreter::instance().eval( it->m_car );
-                    if (value->type() == ISExpr::ATOM) {
-                        returnValue += value->toAtom()->name();
-                    }
-                    else if ( value->type() == ISExpr::DOUBLE ) {
-                        std::string str = std::to_string( value->toDouble()->doubleValue() );
-                        str.erase ( str.find_last_not_of('0') + 1, std::string::npos );
-                        str.erase ( str.find_last_not_of('.') + 1, std::string::npos );
-                        returnValue += str;
-                    }
-                    else if ( value->type() == ISExpr::INT_NUMBER ) {
-                        returnValue += std::to_string( value->toIntNumber()->intValue() );
-                    }
-                }
-                return new Atom( returnValue.c_str() );
-            }
-
-            case ISExpr::DOUBLE:
-            {
-                double returnValue = 0;
-
-                //expr->print("+ arguments: ");
-                for (auto* it = expr; it != nullptr; it = it->m_cdr)
-                {
-                    //it->m_car->print("\nit->m_car: ");
-                    auto* value = LInterpreter::instance().eval( it->m_car );
-                    //value->print("\nvalue: ");
-                    assert( value->type() != ISExpr::ATOM );
-                    if ( value->type() == ISExpr::DOUBLE ) {
-                        returnValue += value->toDouble()->doubleValue();
-                    }
-                    else if ( value->type() == ISExpr::INT_NUMBER ) {
-                        returnValue += value->toIntNumber()->intValue();
-                    }
-                }
-                return new Double( returnValue );
-            }
-
-            case ISExpr::INT_NUMBER:
+            profiler.reset();
+        }
+        else if ( command == "report" )
+        {
+            profiler.printFlat( interpreter.output() );
+        }
+        else if ( command == "folded" && expr->m_cdr != nullptr && expr->m_cdr->m_car->type() == ISExpr::ATOM )
+        {
+            const char* fileName = expr->m_cdr->m_car->toAtom()->name();
+            std::ofstream file( fileName );
+            if ( ! file )
             {
-                int64_t returnValue = 0;
-
-                //expr->print("+ arguments: ");
-                for (auto* it = expr; it != nullptr; it = it->m_cdr)
-                {
-                    //it->m_car->print("\nit->m_car: ");
-                    auto* value = LInterpreter::instance().eval( it->m_car );
-                    //value->print("\nvalue: ");
-                    assert( value->type() != ISExpr::ATOM );
-                    assert( value->type() != ISExpr::DOUBLE );
-                    if ( value->type() == ISExpr::INT_NUMBER ) {
-                        returnValue += value->toIntNumber()->intValue();
-                    }
-                }
-                return new IntNumber( returnValue );
+                LOG_ERR( "profile: cannot write file: " << fileName );
+                return interpreter.m_nilAtom;
             }
-            default:
-                break;
+            profiler.writeFolded( file );
         }
-            return nullptr;
-    });
+        else
+        {
+            LOG_ERR( "profile: unknown command: " << command );
+            return interpreter.m_nilAtom;
+        }
+        return interpreter.m_trueAtom;
+    }));
+
+    // arguments of these are evaluated by the caller
+    addBuiltin( BuiltinFunc::make<car>( "car" ) );
+    addBuiltin( BuiltinFunc::make<cdr>( "cdr" ) );
+    addBuiltin( BuiltinFunc::make<cons>( "cons" ) );
+    addBuiltin( new BuiltinFunc( "-", &arithmetic<Arithmetic::SUB> ) );
+    addBuiltin( new BuiltinFunc( "/", &arithmetic<Arithmetic::DIV> ) );
+    addBuiltin( new BuiltinFunc( "*", &arithmetic<Arithmetic::MUL> ) );
+    addBuiltin( new BuiltinFunc( ">", &compare<Arithmetic::GREATER> ) );
+    addBuiltin( new BuiltinFunc( "<", &compare<Arithmetic::LESS> ) );
+    addBuiltin( new BuiltinFunc( "=", &compare<Arithmetic::EQUAL> ) );
+    addBuiltin( new BuiltinFunc( "<=", &compare<Arithmetic::LESS_EQUAL> ) );
+    addBuiltin( new BuiltinFunc( ">=", &compare<Arithmetic::GREATER_EQUAL> ) );
+    addBuiltin( BuiltinFunc::make<getGcStats>( "gc-stats" ) );
+    addBuiltin( BuiltinFunc::make<flush>( "flush" ) );
+    addBuiltin( new BuiltinFunc( "+", &add ) );
+
+    m_ifFunc = m_symbolTable.find("if")->m_builtinFunc;
+    m_resolver.init( m_symbolTable.find("quote")->m_builtinFunc, m_symbolTable.find("defun")->m_builtinFunc );
+    m_vm.init();
+    m_constantFolder.init( *this, m_symbolTable, m_nilAtom );
+}
 
+// defined here: ParallelContext is complete
+LInterpreter::~LInterpreter()
+{
+    m_outputBuffer.flush();
 }
@@ -1,20 +1,49 @@
 #pragma once
 
 #include "Parser.h"
+#include "Arena.h"
+#include "GcHeap.h"
+#include "Environment.h"
+#include "ConstantFolder.h"
+#include "Array.h"
+#include "BigInt.h"
+#include "VirtualMachine.h"
+#include "ValueStack.h"
+#include "Profiler.h"
+#include "MappedFile.h"
+#include "Snapshot.h"
+#include "OutputBuffer.h"
 #include "Log.h"
 
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <functional>
-#include <forward_list>
-#include <fstream>
-#include <sstream>
+#include <mutex>
+#include <vector>
+#include <string_view>
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+//
+// LInterpreter - all state of one interpreter: atoms, heap, regions, frames...
+//
+// Nothing is shared between instances (builtins get the interpreter that calls
+// them), so several interpreters can run on different threads at once; one
+// instance is used by one thread at a time (but the parser thread of Driver).
+//
+class ParallelContext;
 
 class LInterpreter {
-    static LInterpreter* gLInterpreterInstance;
+    friend class VirtualMachine;
+    friend class Importer;
     
 public:
     Atom*  m_nilAtom = nullptr;
+
+    // value of true comparisons
+    Atom*  m_trueAtom = nullptr;
     
     bool isNil( ISExpr* at)
     {
@@ -25,55 +54,608 @@ public:
         return false;
     }
 protected:
+    // garbage collected heap: builtins and all values created by evaluation
+    GcHeap  m_heap;
+
+    // interned atoms (they are never freed); guarded by m_symbolMutex
+    Arena   m_atomArena;
+
+    // m_symbolTable and m_atomArena are shared with the parser thread of Driver
+    std::mutex m_symbolMutex;
+
+    // set by Driver while its parser thread runs; parsers lock m_symbolMutex only then
+    bool       m_isSymbolTableShared = false;
+
+    // per-evaluation region: parsed code of the current top-level form
+    Arena   m_evalArena;
+
+    // region of the form being evaluated (m_evalArena or the one of Driver)
+    Arena*  m_codeArena = &m_evalArena;
+
     Parser  m_parser;
-    
-    LInterpreter();
-    void addPseudoTableFuncs();
-    
-public:
-    static LInterpreter& instance()
+
+    // frames of user functions being called, innermost last
+    std::vector<Frame*> m_frames;
+
+    // evaluated arguments of user functions and operands of the virtual machine
+    ValueStack m_valueStack;
+
+    Resolver       m_resolver;
+
+    ConstantFolder m_constantFolder;
+    bool           m_foldConstants = true;
+
+    // 'if' is followed by evalTail()
+    BuiltinFunc*   m_ifFunc = nullptr;
+
+    VirtualMachine m_vm{ *this };
+
+    Profiler       m_profiler{ m_heap.stats() };
+
+    // changed when code is moved or freed or objects are collected: CallCache-s filled
+    // before refer to closures and code that may have been replaced at the same address
+    uint64_t       m_codeEpoch = 1;
+
+    bool           m_useVirtualMachine = false;
+
+    // where 'print' (and printRect, profile report) write: buffered, to std::cout by default
+    OutputBuffer   m_outputBuffer{ std::cout };
+    std::ostream   m_output{ &m_outputBuffer };
+
+    // worker threads of pmap, preduce and pfor (0: they run on the calling thread)
+    unsigned       m_parallelThreads = std::max( 1u, std::thread::hardware_concurrency() );
+
+    // created by the first parallel call (see Parallel.h)
+    std::unique_ptr<ParallelContext> m_parallel;
+
+    // loaded images: their objects live as long as the interpreter
+    std::vector<std::unique_ptr<Snapshot>> m_snapshots;
+
+    // atoms and frames of earlier forms given a new value by the current form
+    // (see remember() and releaseTemporaries())
+    std::vector<ISExpr*> m_remembered;
+    size_t               m_rememberedLimit = 1024;
+
+    void markRoots( GcHeap& heap )
+    {
+        m_codeEpoch++;
+
+        // atoms are not in the heap, so their values are marked here
+        std::lock_guard<std::mutex> lock( m_symbolMutex );
+        m_symbolTable.forEach( [&heap]( const Symbol& symbol )
+        {
+            if ( symbol.m_atom != nullptr )
+            {
+                heap.mark( symbol.m_atom->value() );
+            }
+            heap.mark( symbol.m_builtinFunc );
+        });
+        for( auto* frame : m_frames )
+        {
+            if ( frame->m_isPooled )
+            {
+                heap.markReferences( frame );
+            }
+            else
+            {
+                heap.mark( frame );
+            }
+        }
+        for( auto* value : m_valueStack )
+        {
+            heap.mark( value );
+        }
+        for( auto* object : m_remembered )
+        {
+            heap.mark( object );
+        }
+        m_vm.markRoots( heap );
+        for( auto& snapshot : m_snapshots )
+        {
+            snapshot->markRoots( heap );
+        }
+    }
+
+    // calls a function: new frame with 'slotCount' parameters
+    // bound to the last 'argCount' values of m_valueStack (they are popped)
+    void pushFrame( Frame* environment, uint32_t slotCount, size_t argCount )
+    {
+        pushFrame( Frame::make( environment, slotCount ), argCount );
+    }
+
+    // the same with a frame made by the caller
+    void pushFrame( Frame* frame, size_t argCount )
     {
-        return *gLInterpreterInstance;
+        uint32_t slotCount = frame->m_size;
+        ISExpr** args = m_valueStack.data() + m_valueStack.size() - argCount;
+        for( uint32_t i = 0; i < slotCount; i++ )
+        {
+            frame->slots()[i] = (i < argCount) ? args[i] : m_nilAtom;
+        }
+        m_valueStack.resize( m_valueStack.size() - argCount );
+        m_frames.push_back( frame );
+    }
+
+    void popFrame()
+    {
+        m_frames.pop_back();
+    }
+
+    static uint32_t parameterCount( List* argList )
+    {
+        uint32_t count = 0;
+        for( auto* it = argList; it != nullptr && it->m_car != nullptr; it = it->m_cdr )
+        {
+            count++;
+        }
+        return count;
     }
+
+    void addPseudoTableFuncs();
+
+    // make-array, aref, vec+... (see Array.h)
+    void addArrayFuncs();
+
+    // pmap, preduce, pfor (see Parallel.h)
+    void addParallelFuncs();
+
+    // read-binary, write-binary (see BinaryFormat.h)
+    void addBinaryFuncs();
     
+public:
+    LInterpreter();
+    ~LInterpreter();
+
+    LInterpreter( const LInterpreter& ) = delete;
+    LInterpreter& operator=( const LInterpreter& ) = delete;
+
     Atom* getAtom( const char* name )
     {
         return m_parser.getAtom(name)->toAtom();
     }
 
+    // interned atom, builtin or number (as the parser reads 'name')
+    ISExpr* symbol( std::string_view name )
+    {
+        return m_parser.getAtom( name );
+    }
+
+    // writes the global bindings (functions and variables) to an image file (see Snapshot.h)
+    bool saveSnapshot( const std::string& fileName );
+
+    // binds the atoms of an image file; false (and the error is reported) when it cannot be loaded
+    bool loadSnapshot( const std::string& fileName );
+
+    // nullptr when there is no builtin with this name
+    BuiltinFunc* builtin( const char* name )
+    {
+        std::lock_guard<std::mutex> lock( m_symbolMutex );
+        Symbol* symbol = m_symbolTable.find( name );
+        return (symbol != nullptr) ? symbol->m_builtinFunc : nullptr;
+    }
+
+    // copy of a value of another interpreter (which is not running), in the current allocator
+    ISExpr* importValue( ISExpr* value );
+
+    // binds 'name' to a copy of a function of another interpreter (which is not running),
+    // together with the global functions and variables it refers to
+    void importFunction( Atom* name, ISExpr* function );
+
+    // for parsers running on other threads (they share the symbol table)
+    void initParser( Parser& parser )
+    {
+        parser.init( m_symbolTable, m_atomArena, m_symbolMutex, m_isSymbolTableShared );
+    }
+
+    // a parser runs on another thread (set before it starts and cleared after it ends)
+    void setSymbolTableShared( bool isShared ) { m_isSymbolTableShared = isShared; }
+
 public:
-    BuiltinFuncMap m_builtInFuncMap;
-    
-    NameToSExprMap m_globalVariableMap;
+    // names of atoms and builtins
+    SymbolTable m_symbolTable;
 
-    ISExpr* evalFile( const std::string& fileName )
+    Frame* currentFrame() const
+    {
+        return m_frames.empty() ? nullptr : m_frames.back();
+    }
+
+    // frame 'depth' levels out of 'frame'
+    static Frame* localFrame( Frame* frame, uint32_t depth )
+    {
+        for( ; depth > 0 && frame != nullptr; depth-- )
+        {
+            frame = frame->m_parent;
+        }
+        return frame;
+    }
+
+    // nullptr when used out of its function
+    ISExpr** localSlot( Frame* frame, uint32_t depth, uint32_t index )
+    {
+        frame = localFrame( frame, depth );
+        if ( frame == nullptr || index >= frame->m_size )
+        {
+            LOG_ERR( "local variable is used out of its function" );
+            return nullptr;
+        }
+        return &frame->slots()[index];
+    }
+
+    ISExpr** localSlot( Frame* frame, const LocalVariable* variable )
+    {
+        return localSlot( frame, variable->m_depth, variable->m_index );
+    }
+
+    // parameters in the body of a function are replaced by local variables
+    void resolveFunction( List* definition )
+    {
+        SExprAllocator& region = m_codeArena->contains( definition ) ? static_cast<SExprAllocator&>( *m_codeArena ) : m_heap;
+        AllocatorScope scope( region );
+        m_resolver.resolveFunction( definition );
+    }
+
+    // the same as functionDefinition() for the function called through 'cache';
+    // while the atom is bound to the same closure nothing is looked up again
+    List* cachedDefinition( CallCache& cache, Frame*& environment, uint32_t& slotCount )
+    {
+        ISExpr* value = cache.m_atom->value();
+        if ( value != cache.m_closure || cache.m_epoch != m_codeEpoch || value == nullptr )
+        {
+            List* definition = functionDefinition( value, environment );
+            if ( definition == nullptr )
+            {
+                return nullptr;
+            }
+            slotCount = parameterCount( definition->m_car->toList() );
+
+            // functions that are not closures are resolved on every call
+            bool isClosure = value->type() == ISExpr::CLOSURE;
+            cache.m_closure   = isClosure ? static_cast<Closure*>( value ) : nullptr;
+            cache.m_epoch     = m_codeEpoch;
+            cache.m_slotCount = slotCount;
+            cache.m_code      = nullptr;
+            return definition;
+        }
+
+        environment = cache.m_closure->m_environment;
+        slotCount = cache.m_slotCount;
+        return cache.m_closure->m_definition;
+    }
+
+    // ( parameters body... ) of a function value and the frame it was defined in
+    List* functionDefinition( ISExpr* value, Frame*& environment )
     {
-        std::ifstream fStream( fileName.c_str() );
-        std::string code;
-        if ( fStream )
+        environment = nullptr;
+        if ( value == nullptr )
+        {
+            return nullptr;
+        }
+        if ( value->type() == ISExpr::CLOSURE )
         {
-           std::ostringstream ss;
-           ss << fStream.rdbuf(); // reading data
-           code = ss.str();
+            auto* closure = static_cast<Closure*>( value );
+            environment = closure->m_environment;
+            return closure->m_definition;
         }
-        else
+        if ( value->type() == ISExpr::LIST )
+        {
+            // not created by 'defun' ((set f (quote ((x) (+ x 1))))): resolved on every call
+            resolveFunction( value->toList() );
+            return value->toList();
+        }
+        return nullptr;
+    }
+
+    Profiler& profiler() { return m_profiler; }
+
+    GcHeap& heap() { return m_heap; }
+
+    std::ostream& output() { return m_output; }
+
+    // what was written before goes to the old stream
+    void setOutput( std::ostream& output ) { m_outputBuffer.setTarget( output ); }
+
+    // writes the buffered output to the stream (and flushes it)
+    void flushOutput() { m_outputBuffer.flush(); }
+
+    // top-level forms are compiled and run by VirtualMachine instead of the tree walker
+    void setUseVirtualMachine( bool useVirtualMachine )
+    {
+        m_useVirtualMachine = useVirtualMachine;
+    }
+
+    bool useVirtualMachine() const { return m_useVirtualMachine; }
+
+    // number of worker threads of pmap, preduce and pfor (0: no threads)
+    void setParallelThreads( unsigned threadCount )
+    {
+        m_parallelThreads = threadCount;
+    }
+
+    // nullptr when there are no worker threads
+    ParallelContext* parallel();
+
+    // parsed forms are passed through ConstantFolder (on by default)
+    void setFoldConstants( bool foldConstants )
+    {
+        m_foldConstants = foldConstants;
+    }
+
+    // called by parsers (on any thread) in the region of the parsed form
+    ISExpr* foldConstants( ISExpr* expr ) const
+    {
+        return m_foldConstants ? m_constantFolder.fold( expr ) : expr;
+    }
+
+    void addBuiltin( BuiltinFunc* builtinFunc )
+    {
+        std::lock_guard<std::mutex> lock( m_symbolMutex );
+        m_symbolTable.intern( builtinFunc->name() )->m_builtinFunc = builtinFunc;
+    }
+
+    // evaluates all forms of the file; the file is mapped into memory and parsed in place
+    ISExpr* evalFile( const std::string& fileName )
+    {
+        MappedFile file( fileName );
+        if ( ! file.isOpen() )
         {
             LOG_ERR( "cannot open to read file: " << fileName );
+            return nullptr;
         }
-        return eval( code );
+
+        ISExpr* result = nullptr;
+        m_parser.setSource( file.view() );
+        while( ! m_parser.isAtEnd() )
+        {
+            result = evalNextForm();
+        }
+        m_parser.setSource( {} );
+        return result;
     }
     
-    ISExpr* eval(const std::string& lText) {
-        auto* expr = m_parser.parse( lText, m_globalVariableMap, m_builtInFuncMap );
+    // evaluates the first form of 'lText' (parsing always starts at its beginning)
+    ISExpr* eval(std::string_view lText) {
+        m_parser.setSource( lText );
+        ISExpr* result = evalNextForm();
+        m_parser.setSource( {} );
+        return result;
+	}
+
+    // parses and evaluates the next form of the parser's source
+    ISExpr* evalNextForm()
+    {
+        ErrorOrderScope errorOrder( m_output );
+        bool isOutermost = m_heap.stackBase() == nullptr;
+        if ( isOutermost )
+        {
+            // result of the previous form is not used any more
+            releaseTemporaries( m_evalArena );
+        }
+
+        ISExpr* expr;
+        {
+            AllocatorScope scope( m_evalArena );
+            expr = foldConstants( m_parser.parse() );
+        }
+
         if ( expr == nullptr )
         {
             return nullptr;
         }
-        std::cout << std::endl << std::endl;
-        expr->print0("\n# evaluation of: ");
-        std::cout << std::endl;
-        return eval( expr );
-	}
+        return evalForm( expr, m_evalArena );
+    }
+
+    // evaluates a parsed top-level form; its code is allocated in 'codeArena'
+    // (the caller releases it with releaseTemporaries() when the result is not used any more)
+    ISExpr* evalForm( ISExpr* expr, Arena& codeArena )
+    {
+        ErrorOrderScope errorOrder( m_output );
+
+        // frames below this one are scanned by the garbage collector
+        int stackBase;
+        bool isOutermost = m_heap.stackBase() == nullptr;
+        Arena* savedCodeArena = m_codeArena;
+        if ( isOutermost )
+        {
+            m_heap.setStackBase( &stackBase );
+            m_codeArena = &codeArena;
+        }
+
+        TRACE( TRACE_FORMS, std::cout << std::endl << std::endl; expr->print0("\n# evaluation of: "); std::cout << std::endl );
+
+        ISExpr* result;
+        {
+            AllocatorScope scope( m_heap );
+            result = m_useVirtualMachine ? m_vm.eval( expr ) : eval( expr );
+        }
+
+        if ( isOutermost )
+        {
+            m_heap.setStackBase( nullptr );
+            m_codeArena = savedCodeArena;
+        }
+        return result;
+    }
+
+    // write barrier: 'object' (an atom or a frame) is given 'value' by set or defun
+    void remember( ISExpr* object, ISExpr* value )
+    {
+        if ( value == nullptr || value->isFixnum() || ( ! m_remembered.empty() && m_remembered.back() == object ) )
+        {
+            return;
+        }
+        m_remembered.push_back( object );
+        if ( m_remembered.size() >= m_rememberedLimit )
+        {
+            // (set a ...) (set b ...) in a loop
+            std::sort( m_remembered.begin(), m_remembered.end() );
+            m_remembered.erase( std::unique( m_remembered.begin(), m_remembered.end() ), m_remembered.end() );
+            m_rememberedLimit = std::max( m_rememberedLimit, 2 * m_remembered.size() );
+        }
+    }
+
+    //
+    // Moves everything still referred to out of the evaluation region (into the
+    // heap) and then releases the region in one go.
+    //
+    // Only the current form can have made references into the region: from the
+    // objects it allocated (young in the heap) and from the atoms and frames it
+    // set (remembered). So the search starts at the remembered objects and
+    // follows region and young objects only; the rest of the heap is not visited.
+    //
+    void releaseTemporaries( Arena& region )
+    {
+        GcHeap::NoCollectScope noCollect( m_heap );
+        AllocatorScope scope( m_heap );
+
+        // old location -> new location (young heap objects map to themselves)
+        std::unordered_map<ISExpr*,ISExpr*> moved;
+        std::vector<ISExpr*> toFix( m_remembered.begin(), m_remembered.end() );
+        m_remembered.clear();
+        m_rememberedLimit = 1024;
+
+        // heap objects can refer to the evaluation region as well ((cons a (quote (1 2))))
+        while( ! toFix.empty() )
+        {
+            ISExpr* expr = toFix.back();
+            toFix.pop_back();
+
+            if ( expr->type() == ISExpr::LIST )
+            {
+                List* list = expr->toList();
+                list->m_car = promote( region, list->m_car, moved, toFix );
+                list->m_cdr = static_cast<List*>( promote( region, list->m_cdr, moved, toFix ) );
+            }
+            else if ( expr->type() == ISExpr::ATOM )
+            {
+                Atom* atom = expr->toAtom();
+                atom->setValue( promote( region, atom->value(), moved, toFix ) );
+            }
+            else if ( expr->type() == ISExpr::CLOSURE )
+            {
+                auto* closure = static_cast<Closure*>( expr );
+                closure->m_definition = static_cast<List*>( promote( region, closure->m_definition, moved, toFix ) );
+                closure->m_environment = static_cast<Frame*>( promote( region, closure->m_environment, moved, toFix ) );
+            }
+            else if ( expr->type() == ISExpr::FRAME )
+            {
+                auto* frame = static_cast<Frame*>( expr );
+                frame->m_parent = static_cast<Frame*>( promote( region, frame->m_parent, moved, toFix ) );
+                for( uint32_t i = 0; i < frame->m_size; i++ )
+                {
+                    frame->slots()[i] = promote( region, frame->slots()[i], moved, toFix );
+                }
+            }
+        }
+
+        m_vm.forgetCodeIn( region );
+        region.reset();
+        m_heap.clearYoung();
+        m_codeEpoch++;
+    }
+
+    ISExpr* promote( Arena& region, ISExpr* expr, std::unordered_map<ISExpr*,ISExpr*>& moved, std::vector<ISExpr*>& toFix )
+    {
+        if ( expr == nullptr || expr->isFixnum() )
+        {
+            return expr;
+        }
+
+        if ( auto it = moved.find(expr); it != moved.end() )
+        {
+            return it->second;
+        }
+
+        if ( ! region.contains(expr) )
+        {
+            // older objects refer to the region only when they are remembered
+            if ( m_heap.isYoung( expr ) )
+            {
+                moved[expr] = expr;
+                toFix.push_back( expr );
+            }
+            return expr;
+        }
+
+        // shallow copy; references of the copy are fixed later
+        ISExpr* copy;
+        switch( expr->type() )
+        {
+            case ISExpr::LIST:
+            {
+                // the rest of the list is copied right away, so a run of cells
+                // (see Parser::parseList) is a run in the heap too
+                List* back = new List( expr->toList()->m_car, expr->toList()->m_cdr );
+                copy = back;
+                moved[expr] = copy;
+                for( List* it = back->m_cdr; it != nullptr && region.contains(it) && moved.find(it) == moved.end(); it = it->m_cdr )
+                {
+                    back->m_cdr = new List( it->m_car, it->m_cdr );
+                    back = back->m_cdr;
+                    moved[it] = back;
+                    moved[back] = back;
+                    toFix.push_back( back );
+                }
+                break;
+            }
+            case ISExpr::ATOM:
+                // not interned atom (for example result of '+' on atoms)
+                copy = new Atom( expr->toAtom()->name(), expr->toAtom()->value() );
+                break;
+            case ISExpr::INT_NUMBER:
+                copy = new IntNumber( expr->toIntNumber()->intValue() );
+                break;
+            case ISExpr::DOUBLE:
+                copy = new Double( expr->toDouble()->doubleValue() );
+                break;
+            case ISExpr::BIG_INT:
+            {
+                auto* bigInt = static_cast<BigInt*>( expr );
+                copy = BigInt::make( bigInt->isNegative(), bigInt->limbs(), bigInt->size() );
+                break;
+            }
+            case ISExpr::LOCAL_VARIABLE:
+            {
+                auto* variable = static_cast<LocalVariable*>( expr );
+                copy = new LocalVariable( variable->m_atom, variable->m_depth, variable->m_index );
+                break;
+            }
+            case ISExpr::ARRAY:
+            {
+                auto* array = static_cast<Array*>( expr );
+                Array* arrayCopy = Array::make( array->elementType(), array->size() );
+                std::memcpy( arrayCopy->data(), array->data(), array->size() * sizeof(int64_t) );
+                copy = arrayCopy;
+                break;
+            }
+            case ISExpr::CALL_SITE:
+                // the cache is filled again by the next call
+                copy = new CallSite( static_cast<CallSite*>( expr )->m_cache.m_atom );
+                break;
+            default:
+                LOG_ERR( "cannot move value out of evaluation region, type: " << expr->type() );
+                return expr;
+        }
+        moved[expr] = copy;
+        toFix.push_back( copy );
+        return copy;
+    }
+
+    ISExpr* gcStats()
+    {
+        const GcStats& stats = m_heap.stats();
+        auto* result = new List( getAtom("collections"), new List( IntNumber::make( stats.m_collections ) ) );
+        List* back = result->m_cdr;
+        auto add = [&back]( ISExpr* name, ISExpr* value ) {
+            back->m_cdr = new List( name, new List( value ) );
+            back = back->m_cdr->m_cdr;
+        };
+        add( getAtom("bytes-freed"),   IntNumber::make( stats.m_bytesFreed ) );
+        add( getAtom("objects-freed"), IntNumber::make( stats.m_objectsFreed ) );
+        add( getAtom("pause-ms"),      new Double( stats.m_totalPauseMs ) );
+        add( getAtom("last-pause-ms"), new Double( stats.m_lastPauseMs ) );
+        add( getAtom("heap-bytes"),    IntNumber::make( m_heap.heapBytes() ) );
+        return result;
+    }
 
     ISExpr* eval(ISExpr* sExpr0)
     {
@@ -83,8 +665,14 @@ public:
             {
                 return sExpr0->toAtom()->value();
             }
+            case ISExpr::LOCAL_VARIABLE:
+            {
+                ISExpr** slot = localSlot( currentFrame(), static_cast<LocalVariable*>( sExpr0 ) );
+                return (slot != nullptr) ? *slot : m_nilAtom;
+            }
             case ISExpr::DOUBLE:
             case ISExpr::INT_NUMBER:
+            case ISExpr::BIG_INT:
             {
                 return sExpr0;
             }
@@ -97,12 +685,41 @@ public:
                 }
                 else {
                     auto* funcName = sExpr->m_car;
-                    if ( funcName->type() == ISExpr::BUILT_IN_FUNC )
+                    auto  funcType = funcName->type();
+                    if ( funcType == ISExpr::BUILT_IN_FUNC )
                     {
-                        return funcName->toBuiltinFunc()->func()( sExpr->m_cdr );
+                        BuiltinFunc* func = funcName->toBuiltinFunc();
+                        if ( func->isSpecialForm() )
+                        {
+                            if ( m_profiler.isEnabled() )
+                            {
+                                m_profiler.enter( func->name() );
+                            }
+                            ISExpr* result = func->func()( *this, sExpr->m_cdr );
+                            if ( m_profiler.isEnabled() )
+                            {
+                                m_profiler.exit();
+                            }
+                            return result;
+                        }
+
+                        // arguments stay on m_valueStack (a root of the heap) during the call
+                        size_t base = m_valueStack.size();
+                        size_t argCount = evalArguments( sExpr->m_cdr );
+                        if ( m_profiler.isEnabled() )
+                        {
+                            m_profiler.enter( func->name() );
+                        }
+                        ISExpr* result = callBuiltin( func, m_valueStack.data() + base, argCount );
+                        if ( m_profiler.isEnabled() )
+                        {
+                            m_profiler.exit();
+                        }
+                        m_valueStack.resize( base );
+                        return result;
                     }
 
-                    if ( funcName->type() == ISExpr::ATOM )
+                    if ( funcType == ISExpr::CALL_SITE || funcType == ISExpr::ATOM )
                     {
                         //LOG_VAR( funcName->m_atomName );
                         //LOG( "function '" << ((Atom*)funcName)->name() << "' not defined" );
@@ -120,104 +737,199 @@ public:
         return m_nilAtom;
 	}
     
-    ISExpr* evalUserDefinedFunc( List* sExpr )
+    // a builtin that is not a special form, with evaluated arguments
+    ISExpr* callBuiltin( BuiltinFunc* func, ISExpr* const* args, size_t argCount )
     {
-        //sExpr->print("sExpr:");
-        auto* funcName = sExpr->m_car->toAtom();
-        funcName->toExpr()->print0("\nfuncName:");
-        auto* parameters = sExpr->m_cdr;
-        if ( parameters == nullptr )
+        if ( func->arity() >= 0 && size_t( func->arity() ) != argCount )
         {
-            LOG( "parameters == nullptr" )
+            LOG_ERR( "'" << func->name() << "' expects " << func->arity() << " arguments, not " << argCount );
+            return m_nilAtom;
         }
-        else
+        return func->argsFunc()( *this, args, argCount );
+    }
+
+    size_t evalArguments( List* parameters )
+    {
+        size_t argCount = 0;
+        for( auto* it = parameters; (it != nullptr); it = it->m_cdr )
         {
-            parameters->print("\nparameters:");
+            m_valueStack.push_back( eval( it->m_car ) );
+            argCount++;
         }
+        return argCount;
+    }
 
-        //funcName->value()->print0("\nvalue:");
-        auto* funcDefinition = funcName->value()->toList();
-        //funcDefinition->print("\nfuncDefinition:");
-        
-        if ( funcDefinition->type() != ISExpr::LIST )
+    //
+    // Evaluates the last expression of a function body. A call of a user function
+    // in tail position (also in a branch of 'if') is not made: its arguments are
+    // pushed to m_valueStack and the call is returned in 'tailCall', so that
+    // evalUserDefinedFunc() makes it in place of the current one.
+    //
+    ISExpr* evalTail( ISExpr* expr, List*& tailCall, size_t& argCount )
+    {
+        for(;;)
         {
-            std::cerr << "\nbad definition of user function: ";
-            funcDefinition->print( std::cerr );
-            std::cerr << "\n";
-            return m_nilAtom;
-        }
+            if ( expr == nullptr || expr->type() != ISExpr::LIST )
+            {
+                return eval( expr );
+            }
 
-        auto* argList = funcDefinition->m_car->toList();
-        argList->print("\nargList:");
+            List* sExpr = expr->toList();
+            if ( sExpr->isEmptyList() )
+            {
+                return eval( expr );
+            }
 
-        //auto* funcBody = funcDefinition->m_cdr->m_car->toList();
-        auto* funcBody = funcDefinition->m_cdr;
-        if ( funcBody == nullptr )
-        {
-            LOG( "funcBody == nullptr" );
-        }
-        else
-        {
-            //funcBody->print("\nfuncBody:");
+            if ( sExpr->m_car == m_ifFunc && sExpr->m_cdr != nullptr && sExpr->m_cdr->m_cdr != nullptr )
+            {
+                List* branches = sExpr->m_cdr->m_cdr;
+                if ( ! isNil( eval( sExpr->m_cdr->m_car ) ) )
+                {
+                    expr = branches->m_car;
+                }
+                else if ( branches->m_cdr != nullptr )
+                {
+                    expr = branches->m_cdr->m_car;
+                }
+                else
+                {
+                    return m_nilAtom;
+                }
+                continue;
+            }
+
+            auto funcType = sExpr->m_car->type();
+            if ( funcType == ISExpr::CALL_SITE || funcType == ISExpr::ATOM )
+            {
+                argCount = evalArguments( sExpr->m_cdr );
+                tailCall = sExpr;
+                return nullptr;
+            }
+
+            return eval( expr );
         }
-        
-        //
-        //
-        //copy parameters values
-        struct AtomValue { Atom* atom; ISExpr* value; };
-        std::forward_list<AtomValue> savedList;
-        
-        auto* parameterIt = parameters;
-        if ( argList->m_car != nullptr )
+    }
+
+    ISExpr* evalUserDefinedFunc( List* sExpr )
+    {
+        // arguments of a tail call are evaluated before the frame of the caller is popped
+        bool   isTailCall = false;
+        size_t argCount = 0;
+
+        for(;;)
         {
-            for( auto* it = argList; (it != nullptr); it = it->m_cdr )
+            //sExpr->print("sExpr:");
+            // calls in function bodies are CallSite-s (see Resolver), others are atoms
+            CallCache* cache = nullptr;
+            Atom*      funcName;
+            if ( sExpr->m_car->type() == ISExpr::CALL_SITE )
             {
-    //            it->m_car->m_atomValue->print("\nbefore save:");
+                cache = &static_cast<CallSite*>( sExpr->m_car )->m_cache;
+                funcName = cache->m_atom;
+            }
+            else
+            {
+                funcName = sExpr->m_car->toAtom();
+            }
+            TRACE( TRACE_CALLS, funcName->toExpr()->print0("\nfuncName:") );
+            auto* parameters = sExpr->m_cdr;
+            if ( parameters == nullptr )
+            {
+                TRACE( TRACE_CALLS, LOG( "parameters == nullptr" ) );
+            }
+            else
+            {
+                TRACE( TRACE_CALLS, parameters->print("\nparameters:") );
+            }
+
+            //funcName->value()->print0("\nvalue:");
+            Frame*   environment;
+            uint32_t slotCount = 0;
+            List*    funcDefinition;
+            if ( cache != nullptr )
+            {
+                funcDefinition = cachedDefinition( *cache, environment, slotCount );
+            }
+            else
+            {
+                funcDefinition = functionDefinition( funcName->value(), environment );
+                if ( funcDefinition != nullptr )
+                {
+                    slotCount = parameterCount( funcDefinition->m_car->toList() );
+                }
+            }
+            //funcDefinition->print("\nfuncDefinition:");
 
-                savedList.push_front( AtomValue{ it->m_car->toAtom(), it->m_car->toAtom()->value() } );
-                
-                if ( parameterIt != nullptr )
+            if ( funcDefinition == nullptr )
+            {
+                errorStream() << "\nbad definition of user function: ";
+                funcName->print( std::cerr );
+                std::cerr << "\n";
+                if ( isTailCall )
                 {
-                    // substitute/replace argumement value by parameters
-                    //parameterIt->m_car->print("\n");
-                    it->m_car->toAtom()->setValue( parameterIt->m_car );
-                    parameterIt = parameterIt->m_cdr;
+                    m_valueStack.resize( m_valueStack.size() - argCount );
+                }
+                return m_nilAtom;
+            }
+
+            TRACE( TRACE_CALLS, funcDefinition->m_car->toList()->print("\nargList:") );
+
+            //auto* funcBody = funcDefinition->m_cdr->m_car->toList();
+            auto* funcBody = funcDefinition->m_cdr;
+            if ( funcBody == nullptr )
+            {
+                TRACE( TRACE_CALLS, LOG( "funcBody == nullptr" ) );
+            }
+            else
+            {
+                //funcBody->print("\nfuncBody:");
+            }
+
+            //
+            // arguments are evaluated before the call (values are kept on m_valueStack)
+            //
+            if ( ! isTailCall )
+            {
+                argCount = evalArguments( parameters );
+            }
+
+            pushFrame( environment, slotCount, argCount );
+            if ( m_profiler.isEnabled() )
+            {
+                m_profiler.enter( funcName->name() );
+            }
+
+            //
+            // Evaluate !!!
+            //
+            ISExpr* retValue = nullptr;
+            List*   tailCall = nullptr;
+            for( auto* it = funcBody; (it != nullptr); it = it->m_cdr )
+            {
+                auto* expr = it->m_car;
+                TRACE( TRACE_EXPRESSIONS, expr->print0( "\nexpr: " ) );
+                if ( it->m_cdr == nullptr )
+                {
+                    retValue = evalTail( expr, tailCall, argCount );
                 }
                 else
                 {
-                    it->m_car->toAtom()->setValue( m_nilAtom );
+                    retValue = eval( expr );
                 }
-    //            it->m_car->m_atomValue->print("\nafter save:");
             }
-        }
-        
-        //
-        // Evaluate !!!
-        //
-        ISExpr* retValue = nullptr;
-        for( auto* it = funcBody; (it != nullptr); it = it->m_cdr )
-        {
-            auto* expr = it->m_car;
-            expr->print0( "\nexpr: " );
-            retValue = eval( expr );
-        }
 
-        //
-        // restore atom values
-        //
-        while( !savedList.empty() )
-        {
-            auto& front = savedList.front();
-            auto* atom = front.atom;
-            auto* value = front.value;
-            
-//            atom->m_car->print("\nbefore restore:");
-            atom->setValue( value );
-//            atom->m_car->print("\nafter restore:");
-            
-            savedList.pop_front();
-        }
+            popFrame();
+            if ( m_profiler.isEnabled() )
+            {
+                m_profiler.exit();
+            }
 
-        return retValue;
+            if ( tailCall == nullptr )
+            {
+                return retValue;
+            }
+            sExpr = tailCall;
+            isTailCall = true;
+        }
     }
 };
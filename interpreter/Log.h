@@ -1,7 +1,56 @@
 #pragma once
 
+#include <iostream>
 
-#define LOG(expr) std::cerr << "#" << expr << std::endl;
-#define LOG_VAR(var) std::cerr << "#" << #var << ": " << var << std::endl;
-#define LOG_ERR(text) std::cerr << "🟥 " << text << std::endl;
+//
+// Errors come after the output printed before them: while an interpreter
+// evaluates on this thread (ErrorOrderScope), its buffered output (see
+// OutputBuffer) is flushed before anything is written to std::cerr.
+//
+inline thread_local std::ostream* gOutputBeforeErrors = nullptr;
 
+inline std::ostream& errorStream()
+{
+    if ( gOutputBeforeErrors != nullptr )
+    {
+        gOutputBeforeErrors->flush();
+    }
+    return std::cerr;
+}
+
+struct ErrorOrderScope
+{
+    std::ostream* m_saved;
+
+    ErrorOrderScope( std::ostream& output ) : m_saved( gOutputBeforeErrors ) { gOutputBeforeErrors = &output; }
+    ~ErrorOrderScope() { gOutputBeforeErrors = m_saved; }
+};
+
+#define LOG(expr) errorStream() << "#" << expr << std::endl;
+#define LOG_VAR(var) errorStream() << "#" << #var << ": " << var << std::endl;
+#define LOG_ERR(text) errorStream() << "🟥 " << text << std::endl;
+
+//
+// Tracing - debug dumps of the parser and the evaluator
+//
+// LISP_TRACE_LEVEL (build time) is the highest level compiled in, 0 compiles
+// every TRACE out; gTraceLevel (run time, 0 by default) is the level printed.
+//
+#ifndef LISP_TRACE_LEVEL
+    #define LISP_TRACE_LEVEL 3
+#endif
+
+enum TraceLevel
+{
+    TRACE_FORMS       = 1,  // top-level forms being evaluated
+    TRACE_CALLS       = 2,  // lists completed by the parser, calls of user functions
+    TRACE_EXPRESSIONS = 3,  // every expression of a function body
+};
+
+inline int gTraceLevel = 0;
+
+#if LISP_TRACE_LEVEL > 0
+    #define TRACE(level, statement) if ( (level) <= LISP_TRACE_LEVEL && (level) <= gTraceLevel ) { statement; }
+#else
+    #define TRACE(level, statement)
+#endif
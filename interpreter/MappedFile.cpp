@@ -0,0 +1,96 @@
+#include "MappedFile.h"
+#include "Log.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+MappedFile::MappedFile( const std::string& fileName )
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA( fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+    if ( file == INVALID_HANDLE_VALUE )
+    {
+        return;
+    }
+    m_file = file;
+
+    LARGE_INTEGER size;
+    if ( ! GetFileSizeEx( file, &size ) )
+    {
+        return;
+    }
+    m_size = size_t( size.QuadPart );
+    m_isOpen = true;
+    if ( m_size > 0 )
+    {
+        m_mapping = CreateFileMappingA( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+        if ( m_mapping != nullptr )
+        {
+            m_data = static_cast<const char*>( MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ) );
+        }
+    }
+#else
+    int fd = ::open( fileName.c_str(), O_RDONLY );
+    if ( fd < 0 )
+    {
+        return;
+    }
+    struct stat info;
+    if ( ::fstat( fd, &info ) == 0 )
+    {
+        m_size = size_t( info.st_size );
+        m_isOpen = true;
+        if ( m_size > 0 )
+        {
+            void* data = ::mmap( nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+            if ( data != MAP_FAILED )
+            {
+                ::madvise( data, m_size, MADV_SEQUENTIAL );
+                m_data = static_cast<const char*>( data );
+            }
+        }
+    }
+    ::close( fd );
+#endif
+
+    if ( m_size > 0 && m_data == nullptr )
+    {
+        LOG_ERR( "cannot map file: " << fileName );
+        m_isOpen = false;
+        m_size = 0;
+    }
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if ( m_data != nullptr )
+    {
+        UnmapViewOfFile( m_data );
+    }
+    if ( m_mapping != nullptr )
+    {
+        CloseHandle( m_mapping );
+    }
+    if ( m_file != nullptr )
+    {
+        CloseHandle( m_file );
+    }
+#else
+    if ( m_data != nullptr )
+    {
+        ::munmap( const_cast<char*>( m_data ), m_size );
+    }
+#endif
+}
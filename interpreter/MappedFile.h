@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+//
+// MappedFile - read-only memory mapping of a whole file
+// (system headers are kept in MappedFile.cpp)
+//
+class MappedFile
+{
+    const char* m_data = nullptr;
+    size_t      m_size = 0;
+    bool        m_isOpen = false;
+
+    // Windows: file and mapping handles
+    void*       m_file    = nullptr;
+    void*       m_mapping = nullptr;
+
+public:
+    MappedFile( const std::string& fileName );
+    ~MappedFile();
+
+    MappedFile( const MappedFile& ) = delete;
+    MappedFile& operator=( const MappedFile& ) = delete;
+
+    bool isOpen() const { return m_isOpen; }
+
+    std::string_view view() const { return std::string_view( m_data, m_size ); }
+};
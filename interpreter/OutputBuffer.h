@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstring>
+#include <iostream>
+#include <streambuf>
+#include <vector>
+
+//
+// OutputBuffer - large reusable buffer in front of an output stream
+//
+// LInterpreter::output() is an std::ostream on this buffer: what print,
+// printRect and the PRINT opcode write is collected here and handed to the
+// target stream in big blocks, when the buffer is full, on flush() ((flush),
+// the prompt of the REPL), before errors (see Log.h), when the target is
+// changed and when the interpreter is destroyed. Text bigger than the
+// buffer goes to the target directly.
+//
+class OutputBuffer : public std::streambuf
+{
+    std::vector<char> m_buffer;
+    std::ostream*     m_target;
+
+public:
+    OutputBuffer( std::ostream& target, size_t size = 64 * 1024 ) : m_buffer( size ), m_target( &target )
+    {
+        setp( m_buffer.data(), m_buffer.data() + m_buffer.size() );
+    }
+
+    OutputBuffer( const OutputBuffer& ) = delete;
+    OutputBuffer& operator=( const OutputBuffer& ) = delete;
+
+    std::ostream& target() { return *m_target; }
+
+    // what was written so far goes to the old target
+    void setTarget( std::ostream& target )
+    {
+        writePending();
+        m_target = &target;
+    }
+
+    // the buffer and the target
+    void flush()
+    {
+        writePending();
+        m_target->flush();
+    }
+
+protected:
+    int overflow( int c ) override
+    {
+        writePending();
+        if ( c != traits_type::eof() )
+        {
+            *pptr() = traits_type::to_char_type( c );
+            pbump( 1 );
+        }
+        return traits_type::not_eof( c );
+    }
+
+    std::streamsize xsputn( const char* data, std::streamsize count ) override
+    {
+        if ( count > epptr() - pptr() )
+        {
+            writePending();
+            if ( size_t( count ) >= m_buffer.size() )
+            {
+                m_target->write( data, count );
+                return count;
+            }
+        }
+        std::memcpy( pptr(), data, size_t( count ) );
+        pbump( int( count ) );
+        return count;
+    }
+
+    int sync() override
+    {
+        flush();
+        return 0;
+    }
+
+private:
+    void writePending()
+    {
+        if ( pptr() != pbase() )
+        {
+            m_target->write( pbase(), pptr() - pbase() );
+            setp( m_buffer.data(), m_buffer.data() + m_buffer.size() );
+        }
+    }
+};
@@ -0,0 +1,539 @@
+#include "LInterpreter.h"
+#include "Parallel.h"
+
+#include <sstream>
+#include <unordered_map>
+
+//------------------------
+// Importer
+//------------------------
+// Copies a value of another interpreter into the current allocator: atoms are
+// found by name (interned), builtins by name, the rest is copied; shared parts
+// and cycles stay shared. The other interpreter must not run meanwhile.
+class Importer
+{
+    LInterpreter& m_target;
+
+    // also bind atoms called or read by code to copies of their global values
+    bool m_withGlobals;
+
+    std::unordered_map<const ISExpr*, ISExpr*> m_copies;
+
+public:
+    Importer( LInterpreter& target, bool withGlobals ) : m_target(target), m_withGlobals(withGlobals) {}
+
+    ISExpr* copy( ISExpr* expr )
+    {
+        if ( expr == nullptr || expr->isFixnum() )
+        {
+            return expr;
+        }
+        if ( auto it = m_copies.find( expr ); it != m_copies.end() )
+        {
+            return it->second;
+        }
+
+        switch( expr->type() )
+        {
+            case ISExpr::LIST:
+                return copyList( expr->toList() );
+
+            case ISExpr::ATOM:
+                return copyAtom( expr->toAtom(), m_withGlobals );
+
+            case ISExpr::BUILT_IN_FUNC:
+            {
+                BuiltinFunc* builtin = m_target.builtin( expr->toBuiltinFunc()->name() );
+                if ( builtin == nullptr )
+                {
+                    LOG_ERR( "no builtin '" << expr->toBuiltinFunc()->name() << "' in the interpreter" );
+                    return remember( expr, m_target.m_nilAtom );
+                }
+                return remember( expr, builtin );
+            }
+
+            case ISExpr::INT_NUMBER:
+                return remember( expr, new IntNumber( expr->toIntNumber()->intValue() ) );
+
+            case ISExpr::DOUBLE:
+                return remember( expr, new Double( expr->toDouble()->doubleValue() ) );
+
+            case ISExpr::BIG_INT:
+            {
+                auto* bigInt = static_cast<BigInt*>( expr );
+                return remember( expr, BigInt::make( bigInt->isNegative(), bigInt->limbs(), bigInt->size() ) );
+            }
+
+            case ISExpr::ARRAY:
+            {
+                auto* array = static_cast<Array*>( expr );
+                Array* arrayCopy = Array::make( array->elementType(), array->size() );
+                std::memcpy( arrayCopy->data(), array->data(), array->size() * sizeof(int64_t) );
+                return remember( expr, arrayCopy );
+            }
+
+            case ISExpr::LOCAL_VARIABLE:
+            {
+                // the name of a parameter, its global value is not used
+                auto* variable = static_cast<LocalVariable*>( expr );
+                return remember( expr, new LocalVariable( copyAtom( variable->m_atom, false ), variable->m_depth, variable->m_index ) );
+            }
+
+            case ISExpr::CALL_SITE:
+            {
+                // the cache is filled by the first call
+                Atom* atom = copyAtom( static_cast<CallSite*>( expr )->m_cache.m_atom, m_withGlobals );
+                return remember( expr, new CallSite( atom ) );
+            }
+
+            case ISExpr::CLOSURE:
+            {
+                auto* closure = static_cast<Closure*>( expr );
+                auto* closureCopy = new Closure( nullptr, nullptr );
+                remember( expr, closureCopy );
+                closureCopy->m_definition = copyDefinition( closure->m_definition );
+                closureCopy->m_environment = static_cast<Frame*>( copy( closure->m_environment ) );
+                return closureCopy;
+            }
+
+            case ISExpr::FRAME:
+            {
+                auto* frame = static_cast<Frame*>( expr );
+                Frame* frameCopy = Frame::make( nullptr, frame->m_size );
+                remember( expr, frameCopy );
+                frameCopy->m_parent = static_cast<Frame*>( copy( frame->m_parent ) );
+                for( uint32_t i = 0; i < frame->m_size; i++ )
+                {
+                    frameCopy->slots()[i] = copy( frame->slots()[i] );
+                }
+                return frameCopy;
+            }
+
+            default:
+                LOG_ERR( "cannot pass value to another interpreter, type: " << expr->type() );
+                return remember( expr, m_target.m_nilAtom );
+        }
+    }
+
+private:
+    ISExpr* remember( const ISExpr* expr, ISExpr* copy )
+    {
+        m_copies[expr] = copy;
+        return copy;
+    }
+
+    Atom* copyAtom( Atom* atom, bool withGlobal )
+    {
+        if ( auto it = m_copies.find( atom ); it != m_copies.end() )
+        {
+            return it->second->toAtom();
+        }
+
+        // names of builtins and numbers are not atoms there: such atom was not interned
+        ISExpr* interned = m_target.symbol( atom->name() );
+        if ( interned->type() != ISExpr::ATOM )
+        {
+            return static_cast<Atom*>( remember( atom, new Atom( atom->name() ) ) );
+        }
+
+        Atom* atomCopy = interned->toAtom();
+        if ( ! withGlobal )
+        {
+            return atomCopy;
+        }
+
+        remember( atom, atomCopy );
+        if ( atom->value() != atom && atom->value() != nullptr )
+        {
+            atomCopy->setValue( copy( atom->value() ) );
+        }
+        return atomCopy;
+    }
+
+    // ( parameters body... ): parameter names are only names
+    List* copyDefinition( List* definition )
+    {
+        if ( definition == nullptr || definition->m_car == nullptr || definition->m_car->type() != ISExpr::LIST )
+        {
+            return static_cast<List*>( copy( definition ) );
+        }
+
+        bool withGlobals = m_withGlobals;
+        m_withGlobals = false;
+        ISExpr* parameters = copy( definition->m_car );
+        m_withGlobals = withGlobals;
+        return new List( parameters, static_cast<List*>( copy( definition->m_cdr ) ) );
+    }
+
+    // cells are copied along the cdr, so a long list does not nest the calls
+    List* copyList( List* list )
+    {
+        List* first = nullptr;
+        List* back  = nullptr;
+        for( List* it = list; it != nullptr; it = it->m_cdr )
+        {
+            if ( auto found = m_copies.find( it ); found != m_copies.end() )
+            {
+                // shared tail (or a cycle)
+                back->m_cdr = found->second->toList();
+                break;
+            }
+
+            auto* cell = new List();
+            remember( it, cell );
+            if ( back == nullptr )
+            {
+                first = cell;
+            }
+            else
+            {
+                back->m_cdr = cell;
+            }
+            back = cell;
+            cell->m_car = copy( it->m_car );
+        }
+        return first;
+    }
+};
+
+ISExpr* LInterpreter::importValue( ISExpr* value )
+{
+    GcHeap::NoCollectScope noCollect( m_heap );
+    return Importer( *this, false ).copy( value );
+}
+
+void LInterpreter::importFunction( Atom* name, ISExpr* function )
+{
+    GcHeap::NoCollectScope noCollect( m_heap );
+    AllocatorScope scope( m_heap );
+    name->setValue( Importer( *this, true ).copy( function ) );
+}
+
+//------------------------
+// ParallelContext
+//------------------------
+
+size_t ParallelContext::Sequence::size() const
+{
+    return (m_array != nullptr) ? m_array->size() : m_elements.size();
+}
+
+ISExpr* ParallelContext::Sequence::at( size_t index ) const
+{
+    return (m_array != nullptr) ? m_array->at( index ) : m_elements[index];
+}
+
+ParallelContext::ParallelContext( unsigned threadCount ) : m_pool( threadCount )
+{
+    for( unsigned i = 0; i < threadCount; i++ )
+    {
+        auto worker = std::make_unique<Worker>();
+        worker->m_interpreter = std::make_unique<LInterpreter>();
+
+        // pmap in f runs on the worker itself
+        worker->m_interpreter->setParallelThreads( 0 );
+        worker->m_function = worker->m_interpreter->getAtom( "#parallel-function" );
+        m_workers.push_back( std::move(worker) );
+    }
+}
+
+ParallelContext::~ParallelContext() = default;
+
+// (f arg1 arg2) with quoted arguments, in the current allocator
+static List* makeCall( LInterpreter& interpreter, ISExpr* function, ISExpr* arg1, ISExpr* arg2 = nullptr )
+{
+    BuiltinFunc* quote = interpreter.builtin( "quote" );
+    List* args = new List( new List( quote, new List( arg1 ) ) );
+    if ( arg2 != nullptr )
+    {
+        args->m_cdr = new List( new List( quote, new List( arg2 ) ) );
+    }
+    return new List( function, args );
+}
+
+// evaluates (function arg1 arg2) on the calling thread
+static ISExpr* callFunction( LInterpreter& interpreter, ISExpr* function, ISExpr* arg1, ISExpr* arg2 = nullptr )
+{
+    // builtins are called directly, others through an atom of their own (not interned,
+    // so calls of nested pmap-s do not overwrite it)
+    if ( function->type() != ISExpr::BUILT_IN_FUNC )
+    {
+        function = new Atom( "#parallel-function", function );
+    }
+    ISExpr* result = interpreter.eval( makeCall( interpreter, function, arg1, arg2 ) );
+
+    // (a builtin can return nullptr)
+    return (result != nullptr) ? result : interpreter.m_nilAtom;
+}
+
+void ParallelContext::runChunk( LInterpreter& interpreter, Mode mode, ISExpr* function, const Sequence& sequence,
+                                size_t chunk, unsigned workerIndex, std::vector<ISExpr*>& results, std::string& output )
+{
+    Worker& worker = *m_workers[workerIndex];
+    LInterpreter& local = *worker.m_interpreter;
+
+    // the first chunk of this call on this worker
+    if ( worker.m_call != m_call )
+    {
+        worker.m_call = m_call;
+        worker.m_results.reset();
+        local.setUseVirtualMachine( interpreter.useVirtualMachine() );
+        local.importFunction( worker.m_function, function );
+    }
+
+    // builtins are called by name, user functions through the bound atom
+    ISExpr* head = worker.m_function;
+    if ( function->type() == ISExpr::BUILT_IN_FUNC )
+    {
+        head = worker.m_function->value();
+    }
+
+    std::ostringstream chunkOutput;
+    local.setOutput( chunkOutput );
+
+    size_t size  = sequence.size();
+    size_t begin = chunkBegin( size, chunk );
+    size_t end   = chunkBegin( size, chunk+1 );
+    ISExpr* accumulator = nullptr;
+    {
+        // arguments and the forms are code of the worker (as a parsed form)
+        AllocatorScope scope( worker.m_code );
+        for( size_t i = begin; i < end; i++ )
+        {
+            ISExpr* element = (sequence.m_array != nullptr) ? sequence.at( i ) : local.importValue( sequence.at( i ) );
+            if ( mode == REDUCE && i == begin )
+            {
+                accumulator = element;
+                continue;
+            }
+
+            List* form = (mode == REDUCE) ? makeCall( local, head, accumulator, element ) : makeCall( local, head, element );
+            ISExpr* result = local.evalForm( form, worker.m_code );
+            if ( result == nullptr )
+            {
+                result = local.m_nilAtom;
+            }
+            if ( mode == REDUCE )
+            {
+                // the heap of the worker may be collected by the next call
+                accumulator = local.importValue( result );
+            }
+            else if ( mode == MAP )
+            {
+                AllocatorScope resultScope( worker.m_results );
+                results[i] = local.importValue( result );
+            }
+        }
+        if ( mode == REDUCE )
+        {
+            AllocatorScope resultScope( worker.m_results );
+            results[chunk] = local.importValue( accumulator );
+        }
+    }
+
+    local.releaseTemporaries( worker.m_code );
+    local.setOutput( std::cout );
+    output = chunkOutput.str();
+}
+
+ISExpr* ParallelContext::call( LInterpreter& interpreter, Mode mode, ISExpr* function, ISExpr* init, const Sequence& sequence )
+{
+    size_t size = sequence.size();
+    size_t chunks = chunkCount( size );
+    std::vector<ISExpr*> results( (mode == REDUCE) ? chunks : size );
+    std::vector<std::string> outputs( chunks );
+
+    m_call++;
+    m_pool.run( chunks, [&]( size_t chunk, unsigned worker )
+    {
+        runChunk( interpreter, mode, function, sequence, chunk, worker, results, outputs[chunk] );
+    });
+
+    for( auto& output : outputs )
+    {
+        interpreter.output() << output;
+    }
+
+    switch( mode )
+    {
+        case MAP:
+        {
+            // built from the end: every cell is complete when the next one is allocated
+            List* list = nullptr;
+            for( size_t i = size; i-- > 0; )
+            {
+                list = new List( interpreter.importValue( results[i] ), list );
+            }
+            if ( list == nullptr )
+            {
+                return interpreter.m_nilAtom;
+            }
+            return list;
+        }
+        case REDUCE:
+        {
+            ISExpr* accumulator = init;
+            for( size_t chunk = 0; chunk < chunks; chunk++ )
+            {
+                accumulator = callFunction( interpreter, function, accumulator, interpreter.importValue( results[chunk] ) );
+            }
+            return accumulator;
+        }
+        default:
+            return interpreter.m_nilAtom;
+    }
+}
+
+ISExpr* ParallelContext::callInPlace( LInterpreter& interpreter, Mode mode, ISExpr* function, ISExpr* init, const Sequence& sequence )
+{
+    size_t size = sequence.size();
+    switch( mode )
+    {
+        case MAP:
+        {
+            List* first = nullptr;
+            List* back  = nullptr;
+            for( size_t i = 0; i < size; i++ )
+            {
+                auto* cell = new List( callFunction( interpreter, function, sequence.at( i ) ) );
+                if ( back == nullptr )
+                {
+                    first = cell;
+                }
+                else
+                {
+                    back->m_cdr = cell;
+                }
+                back = cell;
+            }
+            if ( first == nullptr )
+            {
+                return interpreter.m_nilAtom;
+            }
+            return first;
+        }
+        case REDUCE:
+        {
+            // in the same chunks as on workers, so the result is the same
+            ISExpr* accumulator = init;
+            for( size_t chunk = 0; chunk < chunkCount( size ); chunk++ )
+            {
+                size_t begin = chunkBegin( size, chunk );
+                ISExpr* chunkValue = sequence.at( begin );
+                for( size_t i = begin+1; i < chunkBegin( size, chunk+1 ); i++ )
+                {
+                    chunkValue = callFunction( interpreter, function, chunkValue, sequence.at( i ) );
+                }
+                accumulator = callFunction( interpreter, function, accumulator, chunkValue );
+            }
+            return accumulator;
+        }
+        default:
+            for( size_t i = 0; i < size; i++ )
+            {
+                callFunction( interpreter, function, sequence.at( i ) );
+            }
+            return interpreter.m_nilAtom;
+    }
+}
+
+//
+// Builtins (with evaluated arguments)
+//
+
+// false (and the error is reported) when 'function' cannot be called
+static bool isFunction( ISExpr*& function, const char* funcName )
+{
+    if ( function->type() == ISExpr::ATOM )
+    {
+        // (pmap (quote f) l)
+        function = function->toAtom()->value();
+    }
+
+    // (builtins with unevaluated arguments evaluate the quoted ones)
+    auto type = function->type();
+    if ( type == ISExpr::CLOSURE || type == ISExpr::LIST || type == ISExpr::BUILT_IN_FUNC )
+    {
+        return true;
+    }
+    LOG_ERR( funcName << ": function expected" );
+    return false;
+}
+
+// false (and the error is reported) when 'value' is neither a list nor an array
+static bool toSequence( LInterpreter& interpreter, ISExpr* value, ParallelContext::Sequence& sequence, const char* funcName )
+{
+    if ( value->type() == ISExpr::ARRAY )
+    {
+        sequence.m_array = static_cast<Array*>( value );
+        return true;
+    }
+    if ( value->type() == ISExpr::LIST )
+    {
+        for( auto* it = value->toList(); it != nullptr && it->m_car != nullptr; it = it->m_cdr )
+        {
+            sequence.m_elements.push_back( it->m_car );
+        }
+        return true;
+    }
+    if ( interpreter.isNil( value ) )
+    {
+        return true;
+    }
+    LOG_ERR( funcName << ": list or array expected" );
+    return false;
+}
+
+static ISExpr* run( LInterpreter& interpreter, ParallelContext::Mode mode, ISExpr* function, ISExpr* init, ISExpr* value, const char* funcName )
+{
+    ParallelContext::Sequence sequence;
+    if ( ! isFunction( function, funcName ) || ! toSequence( interpreter, value, sequence, funcName ) )
+    {
+        return interpreter.m_nilAtom;
+    }
+
+    ParallelContext* parallel = interpreter.parallel();
+    if ( parallel == nullptr || sequence.size() == 0 )
+    {
+        return ParallelContext::callInPlace( interpreter, mode, function, init, sequence );
+    }
+    return parallel->call( interpreter, mode, function, init, sequence );
+}
+
+// (pmap f (quote (1 2 3))) -> ((f 1) (f 2) (f 3))
+static ISExpr* pmap( LInterpreter& interpreter, ISExpr* function, ISExpr* value )
+{
+    return run( interpreter, ParallelContext::MAP, function, nullptr, value, "pmap" );
+}
+
+// (preduce (quote +) 0 (quote (1 2 3))) -> 6
+static ISExpr* preduce( LInterpreter& interpreter, ISExpr* function, ISExpr* init, ISExpr* value )
+{
+    return run( interpreter, ParallelContext::REDUCE, function, init, value, "preduce" );
+}
+
+// (pfor f (quote (1 2 3))) -> nil
+static ISExpr* pfor( LInterpreter& interpreter, ISExpr* function, ISExpr* value )
+{
+    return run( interpreter, ParallelContext::FOR, function, nullptr, value, "pfor" );
+}
+
+void LInterpreter::addParallelFuncs()
+{
+    addBuiltin( BuiltinFunc::make<pmap>( "pmap" ) );
+    addBuiltin( BuiltinFunc::make<preduce>( "preduce" ) );
+    addBuiltin( BuiltinFunc::make<pfor>( "pfor" ) );
+}
+
+ParallelContext* LInterpreter::parallel()
+{
+    if ( m_parallelThreads == 0 )
+    {
+        return nullptr;
+    }
+    if ( m_parallel == nullptr || m_parallel->threadCount() != m_parallelThreads )
+    {
+        m_parallel = std::make_unique<ParallelContext>( m_parallelThreads );
+    }
+    return m_parallel.get();
+}
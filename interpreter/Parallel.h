@@ -0,0 +1,92 @@
+#pragma once
+
+#include "WorkStealingPool.h"
+#include "Arena.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class LInterpreter;
+class ISExpr;
+class Atom;
+class Array;
+
+//---------------------------------------------------------------
+//
+// Parallel - pmap, preduce and pfor on a WorkStealingPool
+//
+//---------------------------------------------------------------
+//
+//  (pmap f l)              -> list of (f x) of every element of a list or an array
+//  (preduce f init l)      -> (f (f init r1) r2)... of the reduced chunks r1, r2...
+//  (pfor f l)              -> nil, (f x) is called for every element
+//
+//  The elements are split into chunks (their number depends on the length
+//  only, so does the result of preduce with doubles) and the chunks are run
+//  by the pool. Every worker thread evaluates in an LInterpreter of its own:
+//  at its first chunk of a call it imports f with the global functions and
+//  variables f refers to (see LInterpreter::importFunction), then each
+//  element is imported and (f x) is evaluated there. The calling thread
+//  waits and imports the results back, in the order of the elements; what
+//  f prints is appended to the output in that order too.
+//
+//  So f must be pure: what it sets is not seen by the caller or by other
+//  calls. preduce expects f to be associative. Inside f (on a worker) and
+//  with 0 threads they run on the calling thread, in the same chunks.
+//
+//---------------------------------------------------------------
+
+class ParallelContext
+{
+public:
+    enum Mode { MAP, REDUCE, FOR };
+
+    // elements: of a list or an array (they are created by Array::at())
+    struct Sequence
+    {
+        std::vector<ISExpr*> m_elements;
+        Array*               m_array = nullptr;
+
+        size_t  size() const;
+        ISExpr* at( size_t index ) const;
+    };
+
+    static constexpr size_t cMaxChunkCount = 64;
+
+private:
+    // the thread-local evaluation context of a worker thread
+    struct Worker
+    {
+        std::unique_ptr<LInterpreter> m_interpreter;
+        Arena     m_code;               // forms and arguments of a chunk
+        Arena     m_results;            // results of the current call, until they are imported back
+        uint64_t  m_call     = 0;       // call whose function is imported
+        Atom*     m_function = nullptr; // bound to f
+    };
+
+    WorkStealingPool                     m_pool;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    uint64_t                             m_call = 0;
+
+public:
+    ParallelContext( unsigned threadCount );
+    ~ParallelContext();
+
+    unsigned threadCount() const { return m_pool.threadCount(); }
+    uint64_t stealCount() const { return m_pool.stealCount(); }
+
+    // evaluates a call of pmap, preduce or pfor of 'interpreter' (the owner of this)
+    ISExpr* call( LInterpreter& interpreter, Mode mode, ISExpr* function, ISExpr* init, const Sequence& sequence );
+
+    // the same on the calling thread
+    static ISExpr* callInPlace( LInterpreter& interpreter, Mode mode, ISExpr* function, ISExpr* init, const Sequence& sequence );
+
+    // [begin, end) of a chunk
+    static size_t chunkCount( size_t size ) { return (size < cMaxChunkCount) ? size : cMaxChunkCount; }
+    static size_t chunkBegin( size_t size, size_t chunk ) { return size * chunk / chunkCount( size ); }
+
+private:
+    void runChunk( LInterpreter& interpreter, Mode mode, ISExpr* function, const Sequence& sequence,
+                   size_t chunk, unsigned worker, std::vector<ISExpr*>& results, std::string& output );
+};
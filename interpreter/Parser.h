@@ -2,20 +2,17 @@
 
 #include "Scanner.h"
 #include "SExpr.h"
+#include "BigInt.h"
 #include "Log.h"
 
+#include "SymbolTable.h"
+
+#include <charconv>
 #include <iostream>
-#include <map>
 #include <functional>
-
-
-struct ConstCharPtrCompare {
-public:
-    bool operator() (const char* str1, const char* str2) const
-    { return std::strcmp(str1, str2) < 0; }
-};
-using NameToSExprMap = std::map<const char*, Atom*, ConstCharPtrCompare>;
-using BuiltinFuncMap = std::map<const char*, BuiltinFunc*, ConstCharPtrCompare>;
+#include <mutex>
+#include <string_view>
+#include <vector>
 
 
 //
@@ -24,68 +21,115 @@ using BuiltinFuncMap = std::map<const char*, BuiltinFunc*, ConstCharPtrCompare>;
 class Parser
 {
     Scanner     m_scanner;
-    std::string m_expression;
 
-    NameToSExprMap* m_globalVariableMap;
-    BuiltinFuncMap* m_builtInFuncMap;
+    SymbolTable* m_symbolTable = nullptr;
+
+    // atoms outlive the form being parsed, so they go to the long-lived region
+    SExprAllocator* m_globalAllocator = nullptr;
+
+    // the symbol table and the atom region can be shared by parsers on several threads;
+    // m_symbolMutex is locked only while they are (see LInterpreter::setSymbolTableShared)
+    std::mutex*  m_symbolMutex = nullptr;
+    const bool*  m_isSymbolTableShared = nullptr;
+
+    // elements of the lists being parsed (innermost last), see parseList()
+    std::vector<ISExpr*> m_elements;
 
 private:
     friend class LInterpreter;
     
-    ISExpr* getAtom( const char* name )
+    static bool canBeNumber( std::string_view name )
+    {
+        char c = name[0];
+        return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+    }
+
+    ISExpr* getAtom( std::string_view name )
     {
-        if ( auto it = m_globalVariableMap->find( name ); it != m_globalVariableMap->end() )
+        if ( canBeNumber( name ) )
         {
-            return it->second;
+            const char* begin = name.data();
+            const char* end   = name.data() + name.size();
+
+            // from_chars does not accept '+'
+            if ( *begin == '+' && name.size() > 1 )
+            {
+                begin++;
+            }
+
+            int64_t value = 0;
+            if ( auto [ptrEnd, error] = std::from_chars( begin, end, value ); ptrEnd == end ) {
+                if ( error == std::errc() ) {
+                    auto* number = IntNumber::make(value);
+                    return number;
+                }
+
+                // does not fit in int64
+                BigValue bigValue;
+                if ( error == std::errc::result_out_of_range && bigValue.parse( name ) ) {
+                    return bigValue.make();
+                }
+            }
+            
+            {
+                double value = 0;
+                if ( auto [ptrEnd, error] = std::from_chars( begin, end, value ); error == std::errc() && ptrEnd == end ) {
+                    auto* number = new Double(value);
+                    return number;
+                }
+            }
         }
-        
-        if ( auto it = m_builtInFuncMap->find( name ); it != m_builtInFuncMap->end() )
+
+        std::unique_lock<std::mutex> lock( *m_symbolMutex, std::defer_lock );
+        if ( *m_isSymbolTableShared )
         {
-            return it->second;
+            lock.lock();
         }
-        
-        char* ptrEnd;
-        int64_t value = strtoll( name, &ptrEnd, 10 );
-        if ( *ptrEnd == char(0) ) {
-            auto* number = new IntNumber(value);
-            return number;
+        Symbol* symbol = m_symbolTable->intern( name.data(), name.size() );
+        if ( symbol->m_builtinFunc != nullptr )
+        {
+            return symbol->m_builtinFunc;
         }
-        
+
+        if ( symbol->m_atom == nullptr )
         {
-            double value = strtod( name, &ptrEnd );
-            if ( *ptrEnd == char(0) ) {
-                auto* number = new Double(value);
-                return number;
-            }
+            AllocatorScope scope( *m_globalAllocator );
+            symbol->m_atom = new Atom( *symbol );
         }
-        
-        auto* atom = new Atom(name);
-        (*m_globalVariableMap)[atom->name()] = atom;
-        return atom;
+        return symbol->m_atom;
     }
 
 public:
-    void init( NameToSExprMap& globalVariableMap,
-                  BuiltinFuncMap& builtInFuncMap )
+    void init( SymbolTable& symbolTable, SExprAllocator& globalAllocator, std::mutex& symbolMutex, const bool& isSymbolTableShared )
     {
-        m_globalVariableMap = &globalVariableMap;
-        m_builtInFuncMap = &builtInFuncMap;
+        m_symbolTable = &symbolTable;
+        m_globalAllocator = &globalAllocator;
+        m_symbolMutex = &symbolMutex;
+        m_isSymbolTableShared = &isSymbolTableShared;
     }
     
-    ISExpr* parse( const std::string& expression,
-                  NameToSExprMap& globalVariableMap,
-                  BuiltinFuncMap& builtInFuncMap )
+    // parses the first form of 'expression' (it is not copied and must stay alive);
+    // setSource() and parse() read the forms of a text one after another
+    ISExpr* parse( std::string_view expression )
     {
-        m_globalVariableMap = &globalVariableMap;
-        m_builtInFuncMap = &builtInFuncMap;
-        m_expression = expression;
+        m_scanner.setSource( expression );
         ISExpr* expr = parse();
         return expr;
     }
+
+    void setSource( std::string_view expression )
+    {
+        m_scanner.setSource( expression );
+    }
+
+    bool isAtEnd()
+    {
+        return m_scanner.isAtEnd();
+    }
     
     ISExpr* parse()
     {
-        auto token = m_scanner.getNextToken(m_expression);
+        auto token = m_scanner.getNextToken();
         switch (token.m_type)
         {
             case Scanner::LEFT_BRACKET:
@@ -94,17 +138,17 @@ public:
             }
             case Scanner::RIGHT_BRACKET:
             {
-                std::cerr << "unexpected ')'";
+                errorStream() << "unexpected ')'";
                 return nullptr;
             }
             case Scanner::ATOM:
             {
                 // не число ли это -> new IntNumber() or DoubleNumber()
-                return  getAtom( token.m_atom.c_str() );
+                return  getAtom( token.m_atom );
             }
             case Scanner::STRING:
             {
-                return  getAtom( token.m_atom.c_str() );
+                return  getAtom( token.m_atom );
             }
             case Scanner::END:
             {
@@ -114,14 +158,17 @@ public:
             return nullptr;
     }
     
+    // Elements are collected first and the cells are allocated together when
+    // the list ends, so the cells of one list follow each other in memory
+    // (a run of 24-byte cells: walking the list reads memory sequentially).
+    // Nothing collects garbage while parsing (the form goes to a region).
     List* parseList()
     {
-        List* result = new List();
-        List* back   = result;
+        size_t begin = m_elements.size();
 
         for (;;)
         {
-            auto token = m_scanner.getNextToken(m_expression);
+            auto token = m_scanner.getNextToken();
 
             switch (token.m_type)
             {
@@ -132,47 +179,48 @@ public:
                     //sExpr->print("\n-sExpr---");
                     if ( sExpr != nullptr )
                     {
-                        if ( result->m_car == nullptr )
-                        {
-                            result->m_car = sExpr;
-                        }
-                        else
-                        {
-                            back->m_cdr = new List( sExpr );
-                            back = back->m_cdr;
-                        }
+                        m_elements.push_back( sExpr );
                     }
-                    //result->print("\n-list-result---");
                     break;
                 }
                 case Scanner::RIGHT_BRACKET:
                 {
-                    result->print("\n--RB-- parser result: ");
+                    List* result = makeRun( begin );
+                    TRACE( TRACE_CALLS, result->print("\n--RB-- parser result: ") );
                     return result;
                 }
                 case Scanner::ATOM:
                 {
                     //LOG_VAR( token.m_atom );
-                    
-                    auto* atom = getAtom( token.m_atom.c_str() );
-                    if ( result->m_car == nullptr )
-                    {
-                        result->m_car = atom;
-                    }
-                    else
-                    {
-                        back->m_cdr = new List( atom );
-                        back = back->m_cdr;
-                    }
-                    //result->print("\n-atom-result---");
+                    m_elements.push_back( getAtom( token.m_atom ) );
                     break;
                 }
                 case Scanner::END:
                 {
+                    m_elements.resize( begin );
                     return nullptr;
                 }
             }
         }
     }
+
+    // list of m_elements from 'begin' (they are removed); () of no elements
+    List* makeRun( size_t begin )
+    {
+        if ( begin == m_elements.size() )
+        {
+            return new List();
+        }
+
+        List* result = new List( m_elements[begin] );
+        List* back   = result;
+        for( size_t i = begin+1; i < m_elements.size(); i++ )
+        {
+            back->m_cdr = new List( m_elements[i] );
+            back = back->m_cdr;
+        }
+        m_elements.resize( begin );
+        return result;
+    }
 };
 
@@ -0,0 +1,117 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+void Profiler::reset()
+{
+    m_functions.clear();
+    m_paths.clear();
+    m_paths.emplace_back( 0, nullptr );
+    m_stack.clear();
+}
+
+uint32_t Profiler::childPath( uint32_t parent, FunctionStats* function )
+{
+    for( uint32_t child : m_paths[parent].m_children )
+    {
+        if ( m_paths[child].m_function == function )
+        {
+            return child;
+        }
+    }
+
+    uint32_t child = uint32_t( m_paths.size() );
+    m_paths.emplace_back( parent, function );
+    m_paths[parent].m_children.push_back( child );
+    return child;
+}
+
+void Profiler::enter( const char* name )
+{
+    FunctionStats& function = m_functions[name];
+    function.m_name = name;
+    function.m_calls++;
+    function.m_activeCount++;
+
+    uint32_t path = childPath( m_stack.empty() ? 0 : m_stack.back().m_path, &function );
+    m_stack.push_back( ActiveCall{ &function, path, now(), 0, m_gcStats.m_allocations, 0 } );
+}
+
+void Profiler::exit()
+{
+    if ( m_stack.empty() )
+    {
+        return;
+    }
+
+    ActiveCall call = m_stack.back();
+    m_stack.pop_back();
+
+    int64_t  inclusiveNs = now() - call.m_startNs;
+    uint64_t allocations = m_gcStats.m_allocations - call.m_startAllocations;
+
+    FunctionStats& function = *call.m_function;
+    function.m_activeCount--;
+    if ( function.m_activeCount == 0 )
+    {
+        function.m_inclusiveNs += inclusiveNs;
+    }
+    function.m_exclusiveNs += inclusiveNs - call.m_childNs;
+    function.m_allocations += allocations - call.m_childAllocations;
+    m_paths[call.m_path].m_exclusiveNs += inclusiveNs - call.m_childNs;
+
+    if ( ! m_stack.empty() )
+    {
+        m_stack.back().m_childNs += inclusiveNs;
+        m_stack.back().m_childAllocations += allocations;
+    }
+}
+
+void Profiler::printFlat( std::ostream& stream ) const
+{
+    std::vector<const FunctionStats*> functions;
+    int64_t totalNs = 0;
+    for( auto& [name, function] : m_functions )
+    {
+        functions.push_back( &function );
+        totalNs += function.m_exclusiveNs;
+    }
+    std::sort( functions.begin(), functions.end(), []( auto* a, auto* b ) { return a->m_exclusiveNs > b->m_exclusiveNs; } );
+
+    char line[256];
+    std::snprintf( line, sizeof(line), "\n# profile: %.3f ms\n%12s %14s %14s %7s %12s  %s\n",
+                   totalNs / 1e6, "calls", "inclusive ms", "exclusive ms", "excl %", "allocations", "function" );
+    stream << line;
+    for( auto* function : functions )
+    {
+        double percent = (totalNs > 0) ? 100.0 * double( function->m_exclusiveNs ) / double( totalNs ) : 0;
+        std::snprintf( line, sizeof(line), "%12llu %14.3f %14.3f %7.2f %12llu  ",
+                       (unsigned long long) function->m_calls, function->m_inclusiveNs / 1e6, function->m_exclusiveNs / 1e6,
+                       percent, (unsigned long long) function->m_allocations );
+        stream << line << function->m_name << "\n";
+    }
+}
+
+void Profiler::writeFolded( std::ostream& stream ) const
+{
+    std::vector<const char*> names;
+    for( uint32_t i = 1; i < m_paths.size(); i++ )
+    {
+        if ( m_paths[i].m_exclusiveNs <= 0 )
+        {
+            continue;
+        }
+
+        names.clear();
+        for( uint32_t node = i; node != 0; node = m_paths[node].m_parent )
+        {
+            names.push_back( m_paths[node].m_function->m_name );
+        }
+        for( size_t j = names.size(); j-- > 0; )
+        {
+            stream << names[j] << ( j > 0 ? ";" : " " );
+        }
+        stream << m_paths[i].m_exclusiveNs << "\n";
+    }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "GcHeap.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//---------------------------------------------------------------
+//
+// Profiler - calls, time and allocations per function
+//
+//---------------------------------------------------------------
+//
+//  Instrumenting: while it is enabled ((profile on), interpreter --profile)
+//  the tree walker and VirtualMachine call enter() and exit() around every
+//  call of a user function or a builtin. Builtins compiled to opcodes by
+//  the VM ('+', '-', '<', 'if', ...) are not seen by it.
+//
+//  Inclusive time of a recursive function is counted by its outermost call;
+//  exclusive time and allocations (objects allocated in GcHeap) do not
+//  include the functions it calls. A tail call replaces the caller, as its
+//  frame does.
+//
+//  Exclusive time is also kept per call path, written as folded stacks
+//  ("f;g;h nanoseconds" per line), the input of flamegraph.pl.
+//
+//---------------------------------------------------------------
+
+class Profiler
+{
+    struct FunctionStats
+    {
+        const char* m_name = nullptr;
+        uint64_t    m_calls = 0;
+        int64_t     m_inclusiveNs = 0;
+        int64_t     m_exclusiveNs = 0;
+        uint64_t    m_allocations = 0;
+        uint32_t    m_activeCount = 0;   // calls on the stack (recursion)
+    };
+
+    // node of the tree of call paths; node 0 is the root
+    struct PathNode
+    {
+        uint32_t       m_parent;
+        FunctionStats* m_function;
+        int64_t        m_exclusiveNs = 0;
+        std::vector<uint32_t> m_children;
+
+        PathNode( uint32_t parent, FunctionStats* function ) : m_parent(parent), m_function(function) {}
+    };
+
+    struct ActiveCall
+    {
+        FunctionStats* m_function;
+        uint32_t       m_path;
+        int64_t        m_startNs;
+        int64_t        m_childNs;
+        uint64_t       m_startAllocations;
+        uint64_t       m_childAllocations;
+    };
+
+    const GcStats& m_gcStats;
+    bool           m_isEnabled = false;
+
+    // by name (names of atoms and builtins are never freed)
+    std::unordered_map<const char*, FunctionStats> m_functions;
+    std::vector<PathNode>   m_paths;
+    std::vector<ActiveCall> m_stack;
+
+public:
+    Profiler( const GcStats& gcStats ) : m_gcStats(gcStats) { reset(); }
+
+    bool isEnabled() const { return m_isEnabled; }
+
+    void enable()
+    {
+        m_stack.clear();
+        m_isEnabled = true;
+    }
+
+    // calls that are not finished yet are counted up to now
+    void disable()
+    {
+        while( ! m_stack.empty() )
+        {
+            exit();
+        }
+        m_isEnabled = false;
+    }
+
+    void reset();
+
+    void enter( const char* name );
+
+    // ignored when there is no call (profiling was enabled inside of it)
+    void exit();
+
+    void tailCall( const char* name )
+    {
+        exit();
+        enter( name );
+    }
+
+    // sorted by exclusive time
+    void printFlat( std::ostream& stream ) const;
+
+    void writeFolded( std::ostream& stream ) const;
+
+private:
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+
+    uint32_t childPath( uint32_t parent, FunctionStats* function );
+};
@@ -0,0 +1,36 @@
+#include "SExpr.h"
+#include "Environment.h"
+#include "Array.h"
+#include "BigInt.h"
+
+#include <type_traits>
+
+// GcHeap frees cells without calling destructors
+static_assert( std::is_trivially_destructible_v<List> && std::is_trivially_destructible_v<Atom> &&
+               std::is_trivially_destructible_v<Frame> && std::is_trivially_destructible_v<Array> &&
+               std::is_trivially_destructible_v<BigInt> );
+
+// header (padded to a word), car and cdr: one cell of the 24-byte size class
+static_assert( sizeof(List) == 3 * sizeof(void*) );
+
+ISExpr* ISExpr::printObject( std::ostream& stream ) const
+{
+    switch( Type( m_type ) )
+    {
+        case LIST:           return static_cast<const List*>( this )->printObject( stream );
+        case BUILT_IN_FUNC:  return static_cast<const BuiltinFunc*>( this )->printObject( stream );
+        case ATOM:           return static_cast<const Atom*>( this )->printObject( stream );
+        case DOUBLE:         return static_cast<const Double*>( this )->printObject( stream );
+        case INT_NUMBER:     return static_cast<const IntNumber*>( this )->printObject( stream );
+        case ARRAY:          return static_cast<const Array*>( this )->printObject( stream );
+        case LOCAL_VARIABLE: return static_cast<const LocalVariable*>( this )->printObject( stream );
+        case CLOSURE:        return static_cast<const Closure*>( this )->printObject( stream );
+        case FRAME:          return static_cast<const Frame*>( this )->printObject( stream );
+        case CALL_SITE:      return static_cast<const CallSite*>( this )->printObject( stream );
+        case CUSTOM:         return static_cast<const CustomBase*>( this )->printObject( stream );
+        case BIG_INT:        return static_cast<const BigInt*>( this )->printObject( stream );
+        default:
+            stream << "#unknown-type-" << int( m_type );
+            return nullptr;
+    }
+}
@@ -1,9 +1,15 @@
 #pragma once
 
+#include "Arena.h"
+#include "SymbolTable.h"
+#include "Log.h"
+
 #include <iostream>
+#include <charconv>
 #include <csignal>
 #include <cstring>
-#include <functional>
+#include <string_view>
+#include <utility>
 
 //---------------------------------------------------------------
 //
@@ -26,6 +32,10 @@
 //  ! value ! name: a !    ! value ! name: b !
 //  !-------!---------!    !-------!---------!
 //
+//  There is no vtable: every object starts with a small header (its type),
+//  so type() is a load from the object itself and print() is a switch on it
+//  (SExpr.cpp). A list cell is 24 bytes: header, car and cdr.
+//
 //---------------------------------------------------------------
 //
 
@@ -35,6 +45,15 @@ class BuiltinFunc;
 class NumberBase;
 class IntNumber;
 class Double;
+class LInterpreter;
+
+// integers are formatted by std::to_chars (no locale, no allocation)
+inline void printInt( std::ostream& stream, int64_t value )
+{
+    char text[24];
+    auto [end, error] = std::to_chars( text, text + sizeof(text), value );
+    stream.write( text, end - text );
+}
 
 
 //----------
@@ -53,19 +72,67 @@ public:
         STRING,
         WSTRING,
         ARRAY,
-        CUSTOM
+        LOCAL_VARIABLE,
+        CLOSURE,
+        FRAME,
+        CALL_SITE,
+        CUSTOM,
+        BIG_INT
     };
 
+private:
+    friend class GcHeap;
+
+    // header: the type and a non-zero byte of a constructed object
+    // (GcHeap zeroes a cell before the constructor runs)
+    uint8_t m_type;
+    uint8_t m_isConstructed = 1;
+
 protected:
-    ISExpr() = default;
-    virtual ~ISExpr() = default;
+    ISExpr( Type type ) : m_type( uint8_t(type) ) {}
+
+    // objects are freed without destructors, so they must be trivial
+    ~ISExpr() = default;
+
+    // dispatches to printObject() of the type (see SExpr.cpp)
+    ISExpr* printObject( std::ostream& stream ) const;
 
 public:
-    virtual Type type() const = 0;
-    virtual ISExpr* print( std::ostream& stream ) const = 0;
-    virtual ISExpr* eval() = 0;
+    // all s-expressions live in the current SExprAllocator region (see Arena.h)
+    static void* operator new( size_t size ) { return SExprAllocator::current()->allocate( size ); }
+    static void* operator new( size_t, void* place ) { return place; }
+    static void  operator delete( void* ) {}
+
+    //
+    // Small integers are not allocated: the value is kept in the pointer itself,
+    // (value << 1) | 1, and 'this' of such IntNumber is an odd address.
+    // So type(), print(), eval() and the number accessors check the tag first
+    // and only then look at the header of the object.
+    //
+    static constexpr int64_t cFixnumMin = INT64_MIN / 2;
+    static constexpr int64_t cFixnumMax = INT64_MAX / 2;
+
+    static ISExpr* makeFixnum( int64_t value ) { return reinterpret_cast<ISExpr*>( (uint64_t(value) << 1) | 1 ); }
+
+    bool    isFixnum() const { return (reinterpret_cast<uintptr_t>(this) & 1) != 0; }
+    int64_t fixnumValue() const { return int64_t( reinterpret_cast<uintptr_t>(this) ) >> 1; }
 
-    virtual ISExpr* print0( const char* prefix ) const { std::cout << prefix; print(std::cout); std::cout << "\n"; return nullptr;};
+    Type type() const { return isFixnum() ? INT_NUMBER : Type( m_type ); }
+
+    ISExpr* print( std::ostream& stream = std::cout ) const
+    {
+        if ( isFixnum() )
+        {
+            printInt( stream, fixnumValue() );
+            return nullptr;
+        }
+        return printObject( stream );
+    }
+
+    // value of an atom, the expression itself otherwise
+    ISExpr* eval();
+
+    ISExpr* print0( const char* prefix ) const { std::cout << prefix; print(std::cout); std::cout << "\n"; return nullptr;};
 
     ISExpr* toExpr() { return this; }
     
@@ -126,7 +193,7 @@ protected:
     const char* copyString( const char* name )
     {
         auto len = std::strlen(name)+1;
-        char* string = new char[len];
+        char* string = static_cast<char*>( SExprAllocator::current()->allocateRaw( len ) );
         std::memcpy( string, name, len );
         return string;
     }
@@ -144,26 +211,22 @@ public:
     List*   m_cdr = nullptr;
 
 public:
-    List() : m_car(nullptr), m_cdr(nullptr) {};
-    List( ISExpr* car ) : m_car(car), m_cdr(nullptr) {};
-    List( ISExpr* car, List* cdr ) : m_car(car), m_cdr(cdr) {};
-    virtual ~List() {}
-
-    Type type() const override { return LIST; }
-    
-    virtual ISExpr* eval() override { return this; } //TODO
+    List() : ISExpr(LIST), m_car(nullptr), m_cdr(nullptr) {};
+    List( ISExpr* car ) : ISExpr(LIST), m_car(car), m_cdr(nullptr) {};
+    List( ISExpr* car, List* cdr ) : ISExpr(LIST), m_car(car), m_cdr(cdr) {};
 
     bool isEmptyList() { return m_car == nullptr && m_cdr == nullptr;}
 
+    using ISExpr::print;
     ISExpr* print(  const char* prefix ) const { std::cout << prefix; print(std::cout); return nullptr;};
 
-    ISExpr* print( std::ostream& stream = std::cout ) const override
+    ISExpr* printObject( std::ostream& stream ) const
     {
         stream << "( ";
         if ( m_car == nullptr && m_cdr == nullptr )
         {
             stream << ")";
-            return;
+            return nullptr;
         }
         
         if ( m_car == nullptr )
@@ -191,24 +254,21 @@ public:
 //------------------------
 class Atom : public ISExpr
 {
+    friend class Snapshot;
+
     const char* m_name;
     ISExpr*     m_value = this;
 
 public:
-    Atom( const char* name ) : m_name( copyString(name) ), m_value(this) {
-        if ( strcmp(m_name,"nil") == 0 )
-        {
-            LOG("nil");
-        }
+    Atom( const char* name ) : ISExpr(ATOM), m_name( copyString(name) ), m_value(this) {
+        TRACE( TRACE_CALLS, if ( strcmp(m_name,"nil") == 0 ) { LOG("nil"); } );
     };
-    Atom( const char* name, ISExpr* value ) : m_name( copyString(name) ), m_value(value) {};
-    virtual ~Atom() { delete [] m_name; }
-
-    Type type() const override { return ATOM; }
+    Atom( const char* name, ISExpr* value ) : ISExpr(ATOM), m_name( copyString(name) ), m_value(value) {};
 
-    virtual ISExpr* eval() override { return m_value; }
+    // interned atom: the name belongs to the symbol table
+    Atom( const Symbol& symbol ) : ISExpr(ATOM), m_name( symbol.m_name ), m_value(this) {};
 
-    ISExpr* print( std::ostream& stream = std::cout ) const override
+    ISExpr* printObject( std::ostream& stream ) const
     {
         stream << m_name;
         return nullptr;
@@ -218,32 +278,95 @@ public:
     void        setValue( ISExpr* newValue ) { m_value = newValue; }
 };
 
+inline ISExpr* ISExpr::eval()
+{
+    if ( isFixnum() || m_type != ATOM )
+    {
+        return this;
+    }
+    return static_cast<Atom*>( this )->value();
+}
+
 //------------------------
 // BuiltinFunc
 //------------------------
-using BuiltInLambda = std::function< ISExpr* (List*) >;
+//
+// Special forms get the unevaluated argument list: (quote a), (set x 1), (if c a b) ...
+// All other builtins get their arguments already evaluated, in an array (a slice
+// of the operand stack), and are called through a plain function pointer.
+// Both get the interpreter that calls them (there may be several, on different threads).
+//
+using BuiltInLambda   = ISExpr* (*)( LInterpreter& interpreter, List* args );
+using BuiltinArgsFunc = ISExpr* (*)( LInterpreter& interpreter, ISExpr* const* args, size_t argCount );
 
-class BuiltinFunc : public ISExpr
+template<class Func>
+struct BuiltinArity;
+
+template<class... Args>
+struct BuiltinArity< ISExpr* (*)( Args... ) >
 {
-    const char* m_name;
-    BuiltInLambda m_lambdaFunc;
-    
-public:
-    BuiltinFunc( const char* name, BuiltInLambda lambdaFunc ) : m_name( copyString(name) ), m_lambdaFunc(lambdaFunc) {};
-    virtual ~BuiltinFunc() { delete [] m_name; }
+    static constexpr int  value = int( sizeof...(Args) );
+    static constexpr bool takesInterpreter = false;
+};
 
-    Type type() const override { return BUILT_IN_FUNC; }
+template<class... Args>
+struct BuiltinArity< ISExpr* (*)( LInterpreter&, Args... ) >
+{
+    static constexpr int  value = int( sizeof...(Args) );
+    static constexpr bool takesInterpreter = true;
+};
 
-    virtual ISExpr* eval() override { return this; }
+class BuiltinFunc : public ISExpr
+{
+    const char*     m_name;
+    BuiltInLambda   m_lambdaFunc = nullptr;
+    BuiltinArgsFunc m_argsFunc   = nullptr;
+    int             m_arity      = -1;      // of m_argsFunc; -1: any number of arguments
 
-    ISExpr* print( std::ostream& stream = std::cout ) const override
+public:
+    BuiltinFunc( const char* name, BuiltInLambda lambdaFunc ) : ISExpr(BUILT_IN_FUNC), m_name( copyString(name) ), m_lambdaFunc(lambdaFunc) {};
+    BuiltinFunc( const char* name, BuiltinArgsFunc argsFunc, int arity = -1 ) : ISExpr(BUILT_IN_FUNC), m_name( copyString(name) ), m_argsFunc(argsFunc), m_arity(arity) {};
+
+    // 'func' takes each argument as a parameter: ISExpr* func( ISExpr* value1, ISExpr* value2 );
+    // they are unpacked from the array at compile time (the interpreter is passed
+    // too when the first parameter is 'LInterpreter&')
+    template<auto func>
+    static BuiltinFunc* make( const char* name )
+    {
+        return new BuiltinFunc( name, &callFixed<func>, BuiltinArity<decltype(func)>::value );
+    }
+
+    ISExpr* printObject( std::ostream& stream ) const
     {
         stream << m_name;
         return nullptr;
     }
 
-    const char* name() const { return m_name; }
-    BuiltInLambda func() const { return m_lambdaFunc; }
+    const char*     name() const { return m_name; }
+    bool            isSpecialForm() const { return m_lambdaFunc != nullptr; }
+    BuiltInLambda   func() const { return m_lambdaFunc; }
+    BuiltinArgsFunc argsFunc() const { return m_argsFunc; }
+    int             arity() const { return m_arity; }
+
+private:
+    template<auto func, size_t... index>
+    static ISExpr* unpack( LInterpreter& interpreter, ISExpr* const* args, std::index_sequence<index...> )
+    {
+        if constexpr ( BuiltinArity<decltype(func)>::takesInterpreter )
+        {
+            return func( interpreter, args[index]... );
+        }
+        else
+        {
+            return func( args[index]... );
+        }
+    }
+
+    template<auto func>
+    static ISExpr* callFixed( LInterpreter& interpreter, ISExpr* const* args, size_t )
+    {
+        return unpack<func>( interpreter, args, std::make_index_sequence< BuiltinArity<decltype(func)>::value >() );
+    }
 };
 
 
@@ -262,23 +385,32 @@ protected:
         double  m_doubleValue;
     };
 
-public:
-    
-    //Type type() const override { return NUMBER_BASE; }
-
-    virtual ISExpr* eval() override { return this; }
+    NumberBase( Type type ) : ISExpr(type) {}
 
-    ISExpr* print( std::ostream& stream = std::cout ) const override
+public:
+    ISExpr* printObject( std::ostream& stream ) const
     {
         stream << "NUMBER_BASE";
         return nullptr;
     }
 
-    virtual int64_t intValue() = 0;
-    virtual double doubleValue() = 0;
+    int64_t intValue() const
+    {
+        if ( isFixnum() )
+        {
+            return fixnumValue();
+        }
+        return (type() == DOUBLE) ? int64_t(m_doubleValue) : m_intValue;
+    }
 
-    virtual void setIntValue( int64_t ) = 0;
-    virtual void setDoubleValue( double ) = 0;
+    double doubleValue() const
+    {
+        if ( isFixnum() )
+        {
+            return double( fixnumValue() );
+        }
+        return (type() == DOUBLE) ? m_doubleValue : double(m_intValue);
+    }
 };
 
 
@@ -290,23 +422,23 @@ class IntNumber: public NumberBase
 {
 protected:
 public:
-    IntNumber( int64_t value ) { m_intValue = value; }
-    
-    Type type() const override { return INT_NUMBER; }
+    IntNumber( int64_t value ) : NumberBase(INT_NUMBER) { m_intValue = value; }
 
-    virtual ISExpr* eval() override { return this; }
+    // fixnum when it fits, boxed IntNumber otherwise
+    static IntNumber* make( int64_t value )
+    {
+        if ( value >= cFixnumMin && value <= cFixnumMax )
+        {
+            return reinterpret_cast<IntNumber*>( makeFixnum( value ) );
+        }
+        return new IntNumber( value );
+    }
 
-    ISExpr* print( std::ostream& stream = std::cout ) const override
+    ISExpr* printObject( std::ostream& stream ) const
     {
-        stream << m_intValue;
+        printInt( stream, m_intValue );
         return nullptr;
     }
-
-    virtual int64_t intValue() override { return m_intValue; }
-    virtual double doubleValue() override { return m_intValue; }
-    
-    virtual void setIntValue( int64_t value ) { m_intValue = value; }
-    virtual void setDoubleValue( double value );
 };
 
 //------------------------
@@ -316,57 +448,78 @@ public:
 class Double: public NumberBase
 {
 public:
-    Double( double value ) { m_doubleValue = value; }
-    
-    Type type() const override { return DOUBLE; }
+    Double( double value ) : NumberBase(DOUBLE) { m_doubleValue = value; }
 
-    virtual ISExpr* eval() override { return this; }
-
-    ISExpr* print( std::ostream& stream = std::cout ) const override
+    ISExpr* printObject( std::ostream& stream ) const
     {
-        std::string str = std::to_string(m_doubleValue);
-        str.erase ( str.find_last_not_of('0') + 1, std::string::npos );
-        str.erase ( str.find_last_not_of('.') + 1, std::string::npos );
-        stream << str;
+        printValue( stream, m_doubleValue );
         return nullptr;
     }
 
-    virtual int64_t intValue() override { return m_doubleValue; }
-    virtual double doubleValue() override { return m_doubleValue; }
-    
-    virtual void setIntValue( int64_t value ) { new(this) IntNumber(value); }
-    virtual void setDoubleValue( double value ) { m_doubleValue = value; }
-};
+    static constexpr size_t cMaxTextSize = 32;
 
-inline void IntNumber::setDoubleValue( double value ) { new(this) Double(value); }
+    // shortest text that reads back as the same value: 2.5, 3, 0.1, 1e+20
+    static std::string_view format( char (&text)[cMaxTextSize], double value )
+    {
+        auto [end, error] = std::to_chars( text, text + cMaxTextSize, value );
+        return std::string_view( text, end - text );
+    }
+
+    static void printValue( std::ostream& stream, double value )
+    {
+        char text[cMaxTextSize];
+        std::string_view formatted = format( text, value );
+        stream.write( formatted.data(), formatted.size() );
+    }
+};
 
 
 //------------------------
 // Custom
 //------------------------
 
-template<class T>
-class Custom: public ISExpr
+class CustomBase: public ISExpr
 {
-    T* m_value = nullptr;
-
-public:
-    Custom( T* value = nullptr ) : m_value(value) {}
-    
-    Type type() const override { return CUSTOM; }
+    // address unique to T of Custom<T> (without a vtable there is no dynamic_cast)
+    const void* m_kind;
 
-    virtual ISExpr* eval() override { return this; }
+protected:
+    CustomBase( const void* kind ) : ISExpr(CUSTOM), m_kind(kind) {}
 
-    ISExpr* print( std::ostream& stream = std::cout ) const override
+public:
+    ISExpr* printObject( std::ostream& stream ) const
     {
         stream << "Custom";
         return nullptr;
     }
 
+    const void* kind() const { return m_kind; }
+};
+
+template<class T>
+class Custom: public CustomBase
+{
+    static inline const char cKind = 0;
+
+    T* m_value = nullptr;
+
+public:
+    Custom( T* value = nullptr ) : CustomBase(&cKind), m_value(value) {}
+
+    static const void* kindOfT() { return &cKind; }
+
     T* value() { return m_value; }
     
     void clear() { delete m_value; m_value = nullptr; }
 };
 
 template<class T>
-inline Custom<T>* to( ISExpr* expr ) { return dynamic_cast<Custom<T>*>(expr); }
+inline Custom<T>* to( ISExpr* expr )
+{
+    if ( expr == nullptr || expr->type() != ISExpr::CUSTOM )
+    {
+        return nullptr;
+    }
+    auto* custom = static_cast<CustomBase*>( expr );
+    return (custom->kind() == Custom<T>::kindOfT()) ? static_cast<Custom<T>*>( custom ) : nullptr;
+}
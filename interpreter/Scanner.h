@@ -1,10 +1,109 @@
 #pragma once
 
 #include "Log.h"
+#include <bit>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <string_view>
 
+//
+// Scanner - tokens are views into the source text (nothing is copied),
+// so the text must stay alive while its tokens are used
+//
+// The text is classified by 64-byte blocks into bit masks, with SSE2/AVX2
+// when the CPU has them (see ScannerSimd.cpp): where tokens start (a bracket
+// or the first character after a delimiter) and where atoms end (a bracket
+// or whitespace). Tokens are then found by bit scans of these masks instead
+// of a test per character.
+//
 class Scanner {
-    int pos = 0;
+public:
+    // bit i is set when block[i] is: '(', ')' or whitespace / whitespace
+    struct CharClasses { uint64_t m_delimiters; uint64_t m_spaces; };
+
+    using ClassifyFunc = CharClasses (*)( const char* block );
+    static constexpr size_t cBlockSize = 64;
+
+    static CharClasses classifyScalar( const char* block );
+    static CharClasses classifySse2( const char* block );
+    static CharClasses classifyAvx2( const char* block );
+
+    // the fastest one supported by the CPU (selected once)
+    static ClassifyFunc bestClassifier();
+
+    // nullptr when the CPU (or the build) does not support it: "scalar", "sse2", "avx2"
+    static ClassifyFunc classifier( const char* name );
+
+private:
+    std::string_view m_source;
+    size_t           m_pos = 0;           // after the last token
+
+    ClassifyFunc     m_classify = bestClassifier();
+
+    // current block (SIZE_MAX: no block yet); blocks are classified one after another
+    size_t           m_blockPos = SIZE_MAX;
+    uint64_t         m_delimiters = 0;
+    uint64_t         m_starts = 0;        // not returned yet
+    bool             m_isAfterDelimiter = true;
+
+    void loadNextBlock()
+    {
+        m_blockPos = (m_blockPos == SIZE_MAX) ? 0 : m_blockPos + cBlockSize;
+
+        CharClasses classes;
+        if ( m_blockPos + cBlockSize <= m_source.size() )
+        {
+            classes = m_classify( m_source.data() + m_blockPos );
+        }
+        else
+        {
+            // the last block is padded with spaces
+            char block[cBlockSize];
+            size_t size = m_source.size() - m_blockPos;
+            std::memcpy( block, m_source.data() + m_blockPos, size );
+            std::memset( block + size, ' ', cBlockSize - size );
+            classes = m_classify( block );
+        }
+
+        uint64_t afterDelimiters = (classes.m_delimiters << 1) | uint64_t( m_isAfterDelimiter );
+        uint64_t brackets = classes.m_delimiters & ~classes.m_spaces;
+
+        m_delimiters = classes.m_delimiters;
+        m_starts = ~classes.m_spaces & (afterDelimiters | brackets);
+        m_isAfterDelimiter = (classes.m_delimiters >> (cBlockSize-1)) != 0;
+    }
+
+    // false: only whitespace is left
+    bool hasNextStart()
+    {
+        while ( m_starts == 0 )
+        {
+            if ( m_blockPos != SIZE_MAX && m_blockPos + cBlockSize >= m_source.size() ) {
+                return false;
+            }
+            loadNextBlock();
+        }
+        return true;
+    }
+
+    // end of the atom that starts at 'pos' in the current block
+    size_t findAtomEnd( size_t pos )
+    {
+        uint64_t bits = m_delimiters >> (pos - m_blockPos);
+        while ( bits == 0 )
+        {
+            if ( m_blockPos + cBlockSize >= m_source.size() ) {
+                return m_source.size();
+            }
+            loadNextBlock();
+            bits = m_delimiters;
+            pos = m_blockPos;
+        }
+        size_t end = pos + std::countr_zero( bits );
+        return (end < m_source.size()) ? end : m_source.size();
+    }
+
 public:
     enum TokenType {
         LEFT_BRACKET,
@@ -17,42 +116,64 @@ public:
     struct Token {
 
         Token(TokenType type) : m_type(type) {}
-        TokenType m_type;
-        std::string    m_atom;
+        Token(TokenType type, std::string_view atom) : m_type(type), m_atom(atom) {}
+        TokenType        m_type;
+        std::string_view m_atom;
     };
 
+    static bool isSpace( char c ) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
 
-    Token getNextToken(const std::string& expression) {
-        int len = expression.length();
-        while (pos < len) {
-            char c = expression[pos];
-            switch (c) {
-            case '(':
-                pos++;
-                //LOG( "(" );
-                return Token(LEFT_BRACKET);
-            case ')':
-                pos++;
-                //LOG( ")" );
-                return Token(RIGHT_BRACKET);
-            case ' ':
-            case '\n':
-            case '\r':
-            case '\t':
-                pos++;
-                break; // nothing
-            default:
-                Token atom(ATOM);
-                while (pos < len && expression[pos] != '(' && expression[pos] != ')' && expression[pos] != ' ') {
-                    atom.m_atom.push_back(expression[pos]);
-                    pos++;
-                }
-                //LOG( "atom:"  << atom.m_atom );
-                return atom;
-            }
+    void setSource( std::string_view source )
+    {
+        m_source = source;
+        m_pos = 0;
+        m_blockPos = SIZE_MAX;
+        m_delimiters = 0;
+        m_starts = 0;
+        m_isAfterDelimiter = true;
+    }
+
+    // for benchmarks and tests (must be supported by the CPU), before setSource()
+    void setClassifier( ClassifyFunc classify )
+    {
+        m_classify = classify;
+    }
+
+    std::string_view source() const { return m_source; }
+
+    // offset of the end of the last token
+    size_t position() const { return m_pos; }
+
+    // only whitespace is left
+    bool isAtEnd()
+    {
+        return ! hasNextStart();
+    }
+
+    Token getNextToken() {
+        if ( ! hasNextStart() ) {
+            m_pos = m_source.size();
+            return Token(END);
         }
-        return Token(END);
 
+        size_t pos = m_blockPos + std::countr_zero( m_starts );
+        m_starts &= m_starts - 1;
+
+        switch (m_source[pos]) {
+        case '(':
+            m_pos = pos+1;
+            //LOG( "(" );
+            return Token(LEFT_BRACKET);
+        case ')':
+            m_pos = pos+1;
+            //LOG( ")" );
+            return Token(RIGHT_BRACKET);
+        default:
+            size_t end = findAtomEnd( pos );
+            m_pos = end;
+            //LOG( "atom:"  << m_source.substr( pos, end-pos ) );
+            return Token(ATOM, m_source.substr( pos, end-pos ));
+        }
     }
 };
 
@@ -75,4 +196,4 @@ inline std::ostream& operator<<(std::ostream& os, Scanner::Token const& token) {
     return os;
 }
 
-    
+
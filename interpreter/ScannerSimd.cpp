@@ -0,0 +1,116 @@
+#include "Scanner.h"
+#include "Cpu.h"
+
+#include <cstring>
+
+Scanner::CharClasses Scanner::classifyScalar( const char* block )
+{
+    CharClasses result = { 0, 0 };
+    for( size_t i = 0; i < cBlockSize; i++ )
+    {
+        char c = block[i];
+        if ( isSpace(c) )
+        {
+            result.m_spaces     |= uint64_t(1) << i;
+            result.m_delimiters |= uint64_t(1) << i;
+        }
+        else if ( c == '(' || c == ')' )
+        {
+            result.m_delimiters |= uint64_t(1) << i;
+        }
+    }
+    return result;
+}
+
+#ifdef LISP_X86_64
+
+Scanner::CharClasses Scanner::classifySse2( const char* block )
+{
+    const __m128i leftBracket  = _mm_set1_epi8( '(' );
+    const __m128i rightBracket = _mm_set1_epi8( ')' );
+    const __m128i space        = _mm_set1_epi8( ' ' );
+    const __m128i newLine      = _mm_set1_epi8( '\n' );
+    const __m128i carriage     = _mm_set1_epi8( '\r' );
+    const __m128i tab          = _mm_set1_epi8( '\t' );
+
+    CharClasses result = { 0, 0 };
+    for( size_t i = 0; i < cBlockSize; i += 16 )
+    {
+        __m128i chars = _mm_loadu_si128( reinterpret_cast<const __m128i*>( block + i ) );
+        __m128i spaces = _mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8( chars, space ), _mm_cmpeq_epi8( chars, newLine ) ),
+                                       _mm_or_si128( _mm_cmpeq_epi8( chars, carriage ), _mm_cmpeq_epi8( chars, tab ) ) );
+        __m128i brackets = _mm_or_si128( _mm_cmpeq_epi8( chars, leftBracket ), _mm_cmpeq_epi8( chars, rightBracket ) );
+
+        result.m_spaces     |= uint64_t( uint32_t( _mm_movemask_epi8( spaces ) ) ) << i;
+        result.m_delimiters |= uint64_t( uint32_t( _mm_movemask_epi8( _mm_or_si128( spaces, brackets ) ) ) ) << i;
+    }
+    return result;
+}
+
+LISP_TARGET_AVX2
+Scanner::CharClasses Scanner::classifyAvx2( const char* block )
+{
+    const __m256i leftBracket  = _mm256_set1_epi8( '(' );
+    const __m256i rightBracket = _mm256_set1_epi8( ')' );
+    const __m256i space        = _mm256_set1_epi8( ' ' );
+    const __m256i newLine      = _mm256_set1_epi8( '\n' );
+    const __m256i carriage     = _mm256_set1_epi8( '\r' );
+    const __m256i tab          = _mm256_set1_epi8( '\t' );
+
+    CharClasses result = { 0, 0 };
+    for( size_t i = 0; i < cBlockSize; i += 32 )
+    {
+        __m256i chars = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( block + i ) );
+        __m256i spaces = _mm256_or_si256( _mm256_or_si256( _mm256_cmpeq_epi8( chars, space ), _mm256_cmpeq_epi8( chars, newLine ) ),
+                                          _mm256_or_si256( _mm256_cmpeq_epi8( chars, carriage ), _mm256_cmpeq_epi8( chars, tab ) ) );
+        __m256i brackets = _mm256_or_si256( _mm256_cmpeq_epi8( chars, leftBracket ), _mm256_cmpeq_epi8( chars, rightBracket ) );
+
+        result.m_spaces     |= uint64_t( uint32_t( _mm256_movemask_epi8( spaces ) ) ) << i;
+        result.m_delimiters |= uint64_t( uint32_t( _mm256_movemask_epi8( _mm256_or_si256( spaces, brackets ) ) ) ) << i;
+    }
+    return result;
+}
+
+#else
+
+// not x86-64: only the scalar classifier is available
+Scanner::CharClasses Scanner::classifySse2( const char* block ) { return classifyScalar( block ); }
+Scanner::CharClasses Scanner::classifyAvx2( const char* block ) { return classifyScalar( block ); }
+
+#endif
+
+Scanner::ClassifyFunc Scanner::classifier( const char* name )
+{
+    if ( std::strcmp( name, "scalar" ) == 0 )
+    {
+        return classifyScalar;
+    }
+#ifdef LISP_X86_64
+    // SSE2 is a part of x86-64
+    if ( std::strcmp( name, "sse2" ) == 0 )
+    {
+        return classifySse2;
+    }
+    if ( std::strcmp( name, "avx2" ) == 0 && cpuHasAvx2() )
+    {
+        return classifyAvx2;
+    }
+#endif
+    return nullptr;
+}
+
+Scanner::ClassifyFunc Scanner::bestClassifier()
+{
+    static const ClassifyFunc best = []
+    {
+        for( const char* name : { "avx2", "sse2" } )
+        {
+            if ( ClassifyFunc func = classifier( name ); func != nullptr )
+            {
+                return func;
+            }
+        }
+        return ClassifyFunc( classifyScalar );
+    }();
+    return best;
+}
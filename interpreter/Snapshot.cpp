@@ -0,0 +1,489 @@
+#include "LInterpreter.h"
+#include "Snapshot.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+namespace
+{
+    struct SnapshotHeader
+    {
+        char     m_magic[8];
+        uint32_t m_version;
+        uint32_t m_pointerSize;
+        uint64_t m_symbolCount;
+        uint64_t m_symbolsSize;     // with the padding to 8 bytes
+        uint64_t m_imageSize;
+        uint64_t m_bindingCount;
+        uint64_t m_relocationCount;
+        uint64_t m_frameCount;
+    };
+
+    constexpr char     cMagic[8] = { 'L', 'I', 'S', 'P', 'I', 'M', 'G', 0 };
+    constexpr uint32_t cVersion  = 1;
+
+    // kind of a relocation (in the low bits of its entry; fields are aligned)
+    enum RelocationKind : uint64_t { IMAGE_OFFSET = 0, SYMBOL_INDEX = 1 };
+
+    // kind byte of a symbol
+    enum SymbolKind : char { ATOM_SYMBOL = 0, BUILTIN_SYMBOL = 1 };
+
+    constexpr size_t alignUp( size_t size ) { return (size + 7) & ~size_t(7); }
+}
+
+//------------------------
+// Writer
+//------------------------
+class Snapshot::Writer
+{
+    const std::function< bool ( Atom* ) >& m_isInterned;
+
+    std::vector<char>       m_image;
+    std::vector<uint64_t>   m_relocations;
+    std::vector<uint64_t>   m_frames;
+
+    std::string             m_symbols;
+    uint64_t                m_symbolCount = 0;
+
+    // object -> image offset, atom or builtin -> symbol index
+    std::unordered_map<const ISExpr*, uint64_t> m_offsets;
+    std::unordered_map<const ISExpr*, uint64_t> m_symbolIndexes;
+
+    // objects copied to the image, their references are not written yet
+    std::vector<std::pair<const ISExpr*, uint64_t>> m_toWrite;
+
+    Atom* m_nilAtom;
+
+public:
+    Writer( Atom* nilAtom, const std::function< bool ( Atom* ) >& isInterned ) : m_isInterned(isInterned), m_nilAtom(nilAtom) {}
+
+    bool write( const std::string& fileName, const std::vector<Binding>& bindings )
+    {
+        // bindings: (atom, value) words at the start of the image
+        m_image.resize( bindings.size() * 2 * sizeof(uint64_t) );
+        for( size_t i = 0; i < bindings.size(); i++ )
+        {
+            writeReference( i * 2 * sizeof(uint64_t), bindings[i].first );
+            writeReference( (i * 2 + 1) * sizeof(uint64_t), bindings[i].second );
+        }
+
+        while( ! m_toWrite.empty() )
+        {
+            auto [expr, offset] = m_toWrite.back();
+            m_toWrite.pop_back();
+            writeReferences( expr, offset );
+        }
+
+        m_symbols.resize( alignUp( m_symbols.size() ), 0 );
+
+        SnapshotHeader header{};
+        std::memcpy( header.m_magic, cMagic, sizeof(cMagic) );
+        header.m_version         = cVersion;
+        header.m_pointerSize     = sizeof(void*);
+        header.m_symbolCount     = m_symbolCount;
+        header.m_symbolsSize     = m_symbols.size();
+        header.m_imageSize       = m_image.size();
+        header.m_bindingCount    = bindings.size();
+        header.m_relocationCount = m_relocations.size();
+        header.m_frameCount      = m_frames.size();
+
+        std::ofstream file( fileName, std::ios::binary );
+        if ( ! file )
+        {
+            LOG_ERR( "cannot write file: " << fileName );
+            return false;
+        }
+        file.write( reinterpret_cast<const char*>( &header ), sizeof(header) );
+        file.write( m_symbols.data(), m_symbols.size() );
+        file.write( m_image.data(), m_image.size() );
+        file.write( reinterpret_cast<const char*>( m_relocations.data() ), m_relocations.size() * sizeof(uint64_t) );
+        file.write( reinterpret_cast<const char*>( m_frames.data() ), m_frames.size() * sizeof(uint64_t) );
+        if ( ! file )
+        {
+            LOG_ERR( "cannot write file: " << fileName );
+            return false;
+        }
+        return true;
+    }
+
+private:
+    // the word at 'fieldOffset' refers to 'expr'
+    void writeReference( uint64_t fieldOffset, const ISExpr* expr )
+    {
+        uint64_t word;
+        if ( expr == nullptr || expr->isFixnum() )
+        {
+            // taken as it is
+            word = reinterpret_cast<uint64_t>( expr );
+        }
+        else if ( isSymbol( expr ) )
+        {
+            word = symbolIndex( expr );
+            m_relocations.push_back( (fieldOffset << 2) | SYMBOL_INDEX );
+        }
+        else if ( uint64_t offset = objectOffset( expr ); offset != UINT64_MAX )
+        {
+            word = offset;
+            m_relocations.push_back( (fieldOffset << 2) | IMAGE_OFFSET );
+        }
+        else
+        {
+            // not supported: nil instead
+            word = symbolIndex( m_nilAtom );
+            m_relocations.push_back( (fieldOffset << 2) | SYMBOL_INDEX );
+        }
+        std::memcpy( m_image.data() + fieldOffset, &word, sizeof(word) );
+    }
+
+    bool isSymbol( const ISExpr* expr )
+    {
+        if ( expr->type() == ISExpr::BUILT_IN_FUNC )
+        {
+            return true;
+        }
+        return expr->type() == ISExpr::ATOM && m_isInterned( const_cast<ISExpr*>( expr )->toAtom() );
+    }
+
+    uint64_t symbolIndex( const ISExpr* expr )
+    {
+        if ( auto it = m_symbolIndexes.find( expr ); it != m_symbolIndexes.end() )
+        {
+            return it->second;
+        }
+
+        if ( expr->type() == ISExpr::BUILT_IN_FUNC )
+        {
+            m_symbols += char( BUILTIN_SYMBOL );
+            m_symbols += const_cast<ISExpr*>( expr )->toBuiltinFunc()->name();
+        }
+        else
+        {
+            m_symbols += char( ATOM_SYMBOL );
+            m_symbols += const_cast<ISExpr*>( expr )->toAtom()->name();
+        }
+        m_symbols += '\0';
+
+        m_symbolIndexes[expr] = m_symbolCount;
+        return m_symbolCount++;
+    }
+
+    // size in the image (SIZE_MAX: the type is not supported)
+    static size_t objectSize( const ISExpr* expr )
+    {
+        switch( expr->type() )
+        {
+            case ISExpr::LIST:           return sizeof(List);
+            case ISExpr::ATOM:           return sizeof(Atom) + alignUp( std::strlen( static_cast<const Atom*>( expr )->name() ) + 1 );
+            case ISExpr::INT_NUMBER:     return sizeof(IntNumber);
+            case ISExpr::DOUBLE:         return sizeof(Double);
+            case ISExpr::LOCAL_VARIABLE: return sizeof(LocalVariable);
+            case ISExpr::CALL_SITE:      return sizeof(CallSite);
+            case ISExpr::CLOSURE:        return sizeof(Closure);
+            case ISExpr::FRAME:          return sizeof(Frame) + static_cast<const Frame*>( expr )->m_size * sizeof(ISExpr*);
+            case ISExpr::ARRAY:          return sizeof(Array) + static_cast<const Array*>( expr )->size() * sizeof(int64_t);
+            case ISExpr::BIG_INT:        return sizeof(BigInt) + static_cast<const BigInt*>( expr )->size() * sizeof(uint64_t);
+            default:                     return SIZE_MAX;
+        }
+    }
+
+    // the object is copied to the image (its references are written later);
+    // UINT64_MAX when its type is not supported
+    uint64_t objectOffset( const ISExpr* expr )
+    {
+        if ( auto it = m_offsets.find( expr ); it != m_offsets.end() )
+        {
+            return it->second;
+        }
+
+        size_t size = objectSize( expr );
+        if ( size == SIZE_MAX )
+        {
+            LOG_ERR( "cannot save value of type " << expr->type() << " to snapshot, nil is saved instead" );
+            return UINT64_MAX;
+        }
+
+        uint64_t offset = m_image.size();
+        m_image.resize( offset + alignUp( size ) );
+        if ( expr->type() == ISExpr::CALL_SITE )
+        {
+            // without the cache
+            CallSite callSite( static_cast<const CallSite*>( expr )->m_cache.m_atom );
+            std::memcpy( m_image.data() + offset, &callSite, sizeof(callSite) );
+        }
+        else if ( expr->type() == ISExpr::ATOM )
+        {
+            std::memcpy( m_image.data() + offset, expr, sizeof(Atom) );
+            const char* name = static_cast<const Atom*>( expr )->name();
+            std::memcpy( m_image.data() + offset + sizeof(Atom), name, std::strlen( name ) + 1 );
+        }
+        else
+        {
+            std::memcpy( m_image.data() + offset, expr, size );
+        }
+
+        if ( expr->type() == ISExpr::FRAME )
+        {
+            m_frames.push_back( offset );
+        }
+
+        m_offsets[expr] = offset;
+        m_toWrite.push_back( { expr, offset } );
+        return offset;
+    }
+
+    // offset of a field of 'expr' in the image of 'expr'
+    template<class T, class Field>
+    static uint64_t fieldOffset( const T* expr, const Field* field )
+    {
+        return reinterpret_cast<const char*>( field ) - reinterpret_cast<const char*>( expr );
+    }
+
+    void writeReferences( const ISExpr* expr, uint64_t offset )
+    {
+        switch( expr->type() )
+        {
+            case ISExpr::LIST:
+            {
+                auto* list = static_cast<const List*>( expr );
+                writeReference( offset + fieldOffset( list, &list->m_car ), list->m_car );
+                writeReference( offset + fieldOffset( list, &list->m_cdr ), list->m_cdr );
+                break;
+            }
+            case ISExpr::ATOM:
+            {
+                // the name follows the atom
+                auto* atom = static_cast<const Atom*>( expr );
+                uint64_t nameOffset = offset + sizeof(Atom);
+                std::memcpy( m_image.data() + offset + fieldOffset( atom, &atom->m_name ), &nameOffset, sizeof(nameOffset) );
+                m_relocations.push_back( ((offset + fieldOffset( atom, &atom->m_name )) << 2) | IMAGE_OFFSET );
+                writeReference( offset + fieldOffset( atom, &atom->m_value ), atom->m_value );
+                break;
+            }
+            case ISExpr::LOCAL_VARIABLE:
+            {
+                auto* variable = static_cast<const LocalVariable*>( expr );
+                writeReference( offset + fieldOffset( variable, &variable->m_atom ), variable->m_atom );
+                break;
+            }
+            case ISExpr::CALL_SITE:
+            {
+                auto* callSite = static_cast<const CallSite*>( expr );
+                writeReference( offset + fieldOffset( callSite, &callSite->m_cache.m_atom ), callSite->m_cache.m_atom );
+                break;
+            }
+            case ISExpr::CLOSURE:
+            {
+                auto* closure = static_cast<const Closure*>( expr );
+                writeReference( offset + fieldOffset( closure, &closure->m_definition ), closure->m_definition );
+                writeReference( offset + fieldOffset( closure, &closure->m_environment ), closure->m_environment );
+                break;
+            }
+            case ISExpr::FRAME:
+            {
+                auto* frame = static_cast<const Frame*>( expr );
+                writeReference( offset + fieldOffset( frame, &frame->m_parent ), frame->m_parent );
+                for( uint32_t i = 0; i < frame->m_size; i++ )
+                {
+                    writeReference( offset + fieldOffset( frame, &frame->slots()[i] ), frame->slots()[i] );
+                }
+                break;
+            }
+            default:
+                // numbers (BigInt too) and arrays have no references
+                break;
+        }
+    }
+};
+
+//------------------------
+// Snapshot
+//------------------------
+
+bool Snapshot::write( const std::string& fileName, const std::vector<Binding>& bindings, Atom* nilAtom,
+                      const std::function< bool ( Atom* ) >& isInterned )
+{
+    return Writer( nilAtom, isInterned ).write( fileName, bindings );
+}
+
+std::unique_ptr<Snapshot> Snapshot::read( const std::string& fileName, const SymbolLookup& symbol,
+                                          std::vector<Binding>& bindings )
+{
+    MappedFile file( fileName );
+    if ( ! file.isOpen() )
+    {
+        LOG_ERR( "cannot open snapshot: " << fileName );
+        return nullptr;
+    }
+    std::string_view data = file.view();
+
+    SnapshotHeader header;
+    if ( data.size() < sizeof(header) )
+    {
+        LOG_ERR( "not a snapshot: " << fileName );
+        return nullptr;
+    }
+    std::memcpy( &header, data.data(), sizeof(header) );
+    if ( std::memcmp( header.m_magic, cMagic, sizeof(cMagic) ) != 0 || header.m_version != cVersion
+        || header.m_pointerSize != sizeof(void*) )
+    {
+        LOG_ERR( "not a snapshot (or of another version or platform): " << fileName );
+        return nullptr;
+    }
+
+    // every size is checked against the file first, so their sum cannot overflow
+    size_t rest = data.size() - sizeof(header);
+    if ( header.m_symbolsSize > rest || header.m_imageSize > rest || header.m_relocationCount > rest / 8
+        || header.m_frameCount > rest / 8 || header.m_bindingCount > header.m_imageSize / 16
+        || header.m_symbolsSize % 8 != 0 || header.m_imageSize % 8 != 0
+        || header.m_symbolsSize + header.m_imageSize + (header.m_relocationCount + header.m_frameCount) * 8 != rest )
+    {
+        LOG_ERR( "damaged snapshot: " << fileName );
+        return nullptr;
+    }
+
+    const char* symbols     = data.data() + sizeof(header);
+    const char* image       = symbols + header.m_symbolsSize;
+    const char* relocations = image + header.m_imageSize;
+    const char* frames      = relocations + header.m_relocationCount * 8;
+
+    // atoms and builtins of this interpreter
+    std::vector<ISExpr*> symbolValues;
+    symbolValues.reserve( header.m_symbolCount < rest ? header.m_symbolCount : 0 );
+    for( const char* it = symbols; symbolValues.size() < header.m_symbolCount; )
+    {
+        // kind byte, name, zero
+        const char* end = nullptr;
+        if ( it + 1 < symbols + header.m_symbolsSize )
+        {
+            end = static_cast<const char*>( std::memchr( it + 1, 0, symbols + header.m_symbolsSize - (it + 1) ) );
+        }
+        if ( end == nullptr || end == it + 1 )
+        {
+            LOG_ERR( "damaged snapshot: " << fileName );
+            return nullptr;
+        }
+
+        bool isBuiltin = (*it == BUILTIN_SYMBOL);
+        ISExpr* value = symbol( it + 1, isBuiltin );
+        if ( value == nullptr )
+        {
+            LOG_ERR( "snapshot " << fileName << " refers to unknown " << (isBuiltin ? "builtin: " : "atom: ") << (it + 1) );
+            return nullptr;
+        }
+        symbolValues.push_back( value );
+        it = end + 1;
+    }
+
+    auto snapshot = std::make_unique<Snapshot>();
+    snapshot->m_imageSize = header.m_imageSize;
+    snapshot->m_image = std::make_unique<uint64_t[]>( header.m_imageSize / 8 );
+    std::memcpy( snapshot->m_image.get(), image, header.m_imageSize );
+
+    uint64_t* words = snapshot->m_image.get();
+    auto base = reinterpret_cast<uint64_t>( words );
+    for( uint64_t i = 0; i < header.m_relocationCount; i++ )
+    {
+        uint64_t entry;
+        std::memcpy( &entry, relocations + i * 8, sizeof(entry) );
+
+        uint64_t fieldOffset = entry >> 2;
+        if ( fieldOffset % 8 != 0 || fieldOffset >= header.m_imageSize )
+        {
+            LOG_ERR( "damaged snapshot: " << fileName );
+            return nullptr;
+        }
+
+        uint64_t& word = words[fieldOffset / 8];
+        if ( (entry & 3) == SYMBOL_INDEX && word < symbolValues.size() )
+        {
+            word = reinterpret_cast<uint64_t>( symbolValues[word] );
+        }
+        else if ( (entry & 3) == IMAGE_OFFSET && word < header.m_imageSize )
+        {
+            word += base;
+        }
+        else
+        {
+            LOG_ERR( "damaged snapshot: " << fileName );
+            return nullptr;
+        }
+    }
+
+    for( uint64_t i = 0; i < header.m_frameCount; i++ )
+    {
+        uint64_t offset;
+        std::memcpy( &offset, frames + i * 8, sizeof(offset) );
+        if ( offset % 8 != 0 || offset >= header.m_imageSize )
+        {
+            LOG_ERR( "damaged snapshot: " << fileName );
+            return nullptr;
+        }
+        snapshot->m_frames.push_back( reinterpret_cast<ISExpr*>( base + offset ) );
+    }
+
+    for( uint64_t i = 0; i < header.m_bindingCount; i++ )
+    {
+        auto* atom  = reinterpret_cast<ISExpr*>( words[i * 2] );
+        auto* value = reinterpret_cast<ISExpr*>( words[i * 2 + 1] );
+        if ( atom == nullptr || atom->isFixnum() || atom->type() != ISExpr::ATOM )
+        {
+            LOG_ERR( "damaged snapshot: " << fileName );
+            return nullptr;
+        }
+        bindings.push_back( { atom->toAtom(), value } );
+    }
+    return snapshot;
+}
+
+//
+// LInterpreter
+//
+
+bool LInterpreter::saveSnapshot( const std::string& fileName )
+{
+    std::lock_guard<std::mutex> lock( m_symbolMutex );
+
+    std::vector<Snapshot::Binding> bindings;
+    m_symbolTable.forEach( [&]( const Symbol& symbol )
+    {
+        if ( symbol.m_atom != nullptr && symbol.m_atom->value() != symbol.m_atom )
+        {
+            bindings.push_back( { symbol.m_atom, symbol.m_atom->value() } );
+        }
+    });
+
+    return Snapshot::write( fileName, bindings, m_nilAtom, [this]( Atom* atom )
+    {
+        Symbol* symbol = m_symbolTable.find( atom->name() );
+        return symbol != nullptr && symbol->m_atom == atom;
+    });
+}
+
+bool LInterpreter::loadSnapshot( const std::string& fileName )
+{
+    std::vector<Snapshot::Binding> bindings;
+    auto snapshot = Snapshot::read( fileName, [this]( const char* name, bool isBuiltin ) -> ISExpr*
+    {
+        if ( isBuiltin )
+        {
+            return builtin( name );
+        }
+        ISExpr* atom = symbol( name );
+        return (atom->type() == ISExpr::ATOM) ? atom : nullptr;
+    }, bindings );
+
+    if ( snapshot == nullptr )
+    {
+        return false;
+    }
+
+    for( auto& [atom, value] : bindings )
+    {
+        atom->setValue( value );
+    }
+    m_snapshots.push_back( std::move(snapshot) );
+    m_codeEpoch++;
+    return true;
+}
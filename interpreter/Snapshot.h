@@ -0,0 +1,87 @@
+#pragma once
+
+#include "GcHeap.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class ISExpr;
+class Atom;
+
+//---------------------------------------------------------------
+//
+// Snapshot - image of the global bindings, loaded without parsing
+//
+//---------------------------------------------------------------
+//
+//  File (native byte order and pointer size):
+//
+//    header        SnapshotHeader
+//    symbols       kind byte (atom or builtin) and zero-terminated name of
+//                  every interned atom and builtin the image refers to
+//    image         the objects as they are in memory (lists, closures with
+//                  their resolved code, frames, numbers, arrays ...); it
+//                  starts with the bindings: (atom, value) pairs of words
+//    relocations   pointer fields of the image: offset of the field and
+//                  whether it holds an image offset or a symbol index
+//    frames        image offsets of frames
+//
+//  Loading maps the file, copies the image in one piece and relocates it:
+//  image offsets become addresses in the copy, symbol indexes the atoms
+//  and builtins of the interpreter (interned by name). Fixnums and other
+//  words are taken as they are. The objects of the image stay in its
+//  memory (outside of GcHeap) as long as the interpreter.
+//
+//  The code in the image is already resolved and folded, so it is not
+//  changed afterwards; frames are (set of a captured variable), so they
+//  are roots of the garbage collector. Byte code of VirtualMachine is not
+//  saved, it is compiled by the first call.
+//
+//  An image is trusted: its layout is checked, not the objects.
+//
+//---------------------------------------------------------------
+
+class Snapshot
+{
+public:
+    // atom and its global value
+    using Binding = std::pair<Atom*, ISExpr*>;
+
+    // interned atom or builtin (isBuiltin) by name; nullptr when there is none
+    using SymbolLookup = std::function< ISExpr* ( const char* name, bool isBuiltin ) >;
+
+private:
+    class Writer;
+
+    // the relocated image
+    std::unique_ptr<uint64_t[]> m_image;
+    size_t                      m_imageSize = 0;
+
+    std::vector<ISExpr*>        m_frames;
+
+public:
+    // writes 'bindings' and everything reachable from them; atoms for which
+    // 'isInterned' is true (and builtins) are written as names, values of
+    // other types (Custom) as 'nilAtom'
+    static bool write( const std::string& fileName, const std::vector<Binding>& bindings, Atom* nilAtom,
+                       const std::function< bool ( Atom* ) >& isInterned );
+
+    // nullptr (and the error is reported) when the file is not a valid image
+    static std::unique_ptr<Snapshot> read( const std::string& fileName, const SymbolLookup& symbol,
+                                           std::vector<Binding>& bindings );
+
+    size_t imageSize() const { return m_imageSize; }
+
+    // values stored into frames of the image by 'set'
+    void markRoots( GcHeap& heap ) const
+    {
+        for( auto* frame : m_frames )
+        {
+            heap.markReferences( frame );
+        }
+    }
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "Arena.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+class Atom;
+class BuiltinFunc;
+
+//---------------------------------------------------------------
+//
+// SymbolTable - interned names
+//
+//---------------------------------------------------------------
+//
+//  Every distinct name has exactly one Symbol, so once a token is
+//  interned, atoms and builtins are compared by pointer.
+//
+//  Open addressing with linear probing; the hash is computed once per
+//  token and kept in the Symbol (for rehashing and fast probe rejects).
+//  Symbols and their names are stored in the table's own arena and live
+//  as long as the table.
+//
+//---------------------------------------------------------------
+
+struct Symbol
+{
+    const char*  m_name;
+    uint32_t     m_length;
+    uint32_t     m_hash;
+
+    Atom*        m_atom        = nullptr;
+    BuiltinFunc* m_builtinFunc = nullptr;
+};
+
+class SymbolTable
+{
+    Arena                m_arena;
+    std::vector<Symbol*> m_slots;
+    size_t               m_count = 0;
+
+public:
+    SymbolTable() : m_slots( 256, nullptr ) {}
+
+    SymbolTable( const SymbolTable& ) = delete;
+    SymbolTable& operator=( const SymbolTable& ) = delete;
+
+    // FNV-1a
+    static uint32_t hash( const char* name, size_t length )
+    {
+        uint32_t result = 2166136261u;
+        for( size_t i = 0; i < length; i++ )
+        {
+            result ^= uint8_t(name[i]);
+            result *= 16777619u;
+        }
+        return result;
+    }
+
+    Symbol* find( const char* name ) const
+    {
+        size_t length = std::strlen(name);
+        return find( name, length, hash( name, length ) );
+    }
+
+    Symbol* find( const char* name, size_t length, uint32_t hash ) const
+    {
+        size_t mask = m_slots.size() - 1;
+        for( size_t i = hash & mask; m_slots[i] != nullptr; i = (i+1) & mask )
+        {
+            Symbol* symbol = m_slots[i];
+            if ( symbol->m_hash == hash && symbol->m_length == length && std::memcmp( symbol->m_name, name, length ) == 0 )
+            {
+                return symbol;
+            }
+        }
+        return nullptr;
+    }
+
+    Symbol* intern( const char* name )
+    {
+        return intern( name, std::strlen(name) );
+    }
+
+    Symbol* intern( const char* name, size_t length )
+    {
+        uint32_t nameHash = hash( name, length );
+        if ( Symbol* symbol = find( name, length, nameHash ); symbol != nullptr )
+        {
+            return symbol;
+        }
+
+        // keep load factor <= 1/2
+        if ( (m_count+1) * 2 > m_slots.size() )
+        {
+            grow();
+        }
+
+        char* nameCopy = static_cast<char*>( m_arena.allocate( length+1 ) );
+        std::memcpy( nameCopy, name, length );
+        nameCopy[length] = 0;
+
+        auto* symbol = new( m_arena.allocate( sizeof(Symbol) ) ) Symbol{ nameCopy, uint32_t(length), nameHash };
+        insert( symbol );
+        m_count++;
+        return symbol;
+    }
+
+    size_t size() const { return m_count; }
+
+    template<class F>
+    void forEach( F func ) const
+    {
+        for( Symbol* symbol : m_slots )
+        {
+            if ( symbol != nullptr )
+            {
+                func( *symbol );
+            }
+        }
+    }
+
+private:
+    void insert( Symbol* symbol )
+    {
+        size_t mask = m_slots.size() - 1;
+        size_t i = symbol->m_hash & mask;
+        while( m_slots[i] != nullptr )
+        {
+            i = (i+1) & mask;
+        }
+        m_slots[i] = symbol;
+    }
+
+    void grow()
+    {
+        std::vector<Symbol*> oldSlots( m_slots.size() * 2, nullptr );
+        oldSlots.swap( m_slots );
+        for( Symbol* symbol : oldSlots )
+        {
+            if ( symbol != nullptr )
+            {
+                insert( symbol );
+            }
+        }
+    }
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+class ISExpr;
+
+//
+// ValueStack - evaluated arguments of user functions and operands of VirtualMachine
+//
+// A raw array and the index of its top (a root of the heap: values below the
+// top are marked). push_back() grows the array when it is full; VirtualMachine::run
+// reserve()s room for its code instead and writes the operands through data().
+// Growing moves the values, so pointers into the stack (data()) are valid until
+// the next push_back() or reserve().
+//
+class ValueStack
+{
+    std::unique_ptr<ISExpr*[]> m_values;
+    size_t                     m_size = 0;
+    size_t                     m_capacity = 0;
+
+public:
+    ValueStack( size_t capacity = 1024 ) { grow( capacity ); }
+
+    ValueStack( const ValueStack& ) = delete;
+    ValueStack& operator=( const ValueStack& ) = delete;
+
+    size_t   size() const   { return m_size; }
+    bool     empty() const  { return m_size == 0; }
+    ISExpr** data()         { return m_values.get(); }
+    ISExpr** begin()        { return m_values.get(); }
+    ISExpr** end()          { return m_values.get() + m_size; }
+    ISExpr*& back()         { return m_values[m_size-1]; }
+
+    // room for 'size' values
+    void reserve( size_t size )
+    {
+        if ( size > m_capacity )
+        {
+            grow( std::max( size, 2*m_capacity ) );
+        }
+    }
+
+    void push_back( ISExpr* value )
+    {
+        if ( m_size == m_capacity )
+        {
+            grow( 2*m_capacity );
+        }
+        m_values[m_size++] = value;
+    }
+
+    void pop_back()          { m_size--; }
+    void pop( size_t count ) { m_size -= count; }
+
+    // within the reserved room
+    void resize( size_t size ) { m_size = size; }
+
+private:
+    void grow( size_t capacity )
+    {
+        auto values = std::make_unique<ISExpr*[]>( capacity );
+        if ( m_size > 0 )
+        {
+            std::memcpy( values.get(), m_values.get(), m_size * sizeof(ISExpr*) );
+        }
+        m_values = std::move( values );
+        m_capacity = capacity;
+    }
+};
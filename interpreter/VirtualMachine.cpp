@@ -0,0 +1,633 @@
+#include "VirtualMachine.h"
+#include "LInterpreter.h"
+#include "Arithmetic.h"
+
+#include <algorithm>
+
+void VirtualMachine::init()
+{
+    auto builtin = [this]( const char* name ) -> BuiltinFunc*
+    {
+        Symbol* symbol = m_interpreter.m_symbolTable.find( name );
+        return (symbol != nullptr) ? symbol->m_builtinFunc : nullptr;
+    };
+
+    m_quote   = builtin( "quote" );
+    m_set     = builtin( "set" );
+    m_if      = builtin( "if" );
+    m_print   = builtin( "print" );
+
+    static_assert( int(OpCode::DIV) - int(OpCode::ADD) == Arithmetic::DIV );
+    static_assert( int(OpCode::GREATER_EQUAL) - int(OpCode::LESS) == Arithmetic::GREATER_EQUAL );
+    for( int op = Arithmetic::ADD; op <= Arithmetic::DIV; op++ )
+    {
+        m_numericFuncs[op] = builtin( Arithmetic::name( Arithmetic::Op(op) ) );
+    }
+    for( int comparison = Arithmetic::LESS; comparison <= Arithmetic::GREATER_EQUAL; comparison++ )
+    {
+        m_numericFuncs[ int(OpCode::LESS) - int(OpCode::ADD) + comparison ] = builtin( Arithmetic::name( Arithmetic::Comparison(comparison) ) );
+    }
+}
+
+ISExpr* VirtualMachine::eval( ISExpr* expr )
+{
+    // a form evaluated again (a call parsed once by the host) is not compiled again
+    auto it = m_forms.find( expr );
+    if ( it == m_forms.end() )
+    {
+        if ( m_forms.size() >= cMaxForms )
+        {
+            // forms of pmap calls, they are not evaluated again
+            for( auto& [form, code] : m_forms )
+            {
+                m_retired.push_back( std::move( code ) );
+            }
+            m_forms.clear();
+        }
+
+        auto code = std::make_unique<ByteCode>();
+        compile( expr, *code );
+        code->emit( OpCode::RETURN );
+        it = m_forms.emplace( expr, std::move( code ) ).first;
+    }
+
+    // the entry can be retired while the code runs
+    const ByteCode& code = *it->second;
+    m_evalDepth++;
+    ISExpr* result = run( code );
+    m_evalDepth--;
+    if ( m_evalDepth == 0 )
+    {
+        m_retired.clear();
+    }
+    return result;
+}
+
+void VirtualMachine::markRoots( GcHeap& heap )
+{
+    // CallCache-s filled before are not used any more, so the code of
+    // definitions that are not reachable otherwise is not kept
+    auto retire = [this]( auto& codeMap )
+    {
+        for( auto& [key, code] : codeMap )
+        {
+            m_retired.push_back( std::move( code ) );
+        }
+        codeMap.clear();
+    };
+    retire( m_functions );
+    retire( m_forms );
+
+    for( auto& code : m_retired )
+    {
+        for( ISExpr* constant : code->m_constants )
+        {
+            heap.mark( constant );
+        }
+    }
+}
+
+void VirtualMachine::forgetCodeIn( const Arena& region )
+{
+    auto forget = [&region]( auto& codeMap )
+    {
+        for( auto it = codeMap.begin(); it != codeMap.end(); )
+        {
+            if ( region.contains( it->first ) )
+            {
+                it = codeMap.erase( it );
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    };
+    forget( m_functions );
+    forget( m_forms );
+    if ( m_evalDepth == 0 )
+    {
+        m_retired.clear();
+    }
+}
+
+//
+// Compiler
+//
+void VirtualMachine::compile( ISExpr* expr, ByteCode& code, bool isTail )
+{
+    if ( expr == nullptr )
+    {
+        code.emit( OpCode::EVAL, code.addConstant( expr ) );
+        return;
+    }
+
+    switch( expr->type() )
+    {
+        case ISExpr::ATOM:
+            code.emit( OpCode::LOAD, code.addConstant( expr ) );
+            return;
+
+        case ISExpr::LOCAL_VARIABLE:
+        {
+            auto* variable = static_cast<LocalVariable*>( expr );
+            code.emit( OpCode::LOAD_LOCAL, variable->m_depth, variable->m_index );
+            return;
+        }
+
+        case ISExpr::INT_NUMBER:
+        case ISExpr::DOUBLE:
+        case ISExpr::BIG_INT:
+            code.emit( OpCode::CONST, code.addConstant( expr ) );
+            return;
+
+        case ISExpr::LIST:
+            break;
+
+        default:
+            code.emit( OpCode::EVAL, code.addConstant( expr ) );
+            return;
+    }
+
+    List* list = expr->toList();
+    if ( list->isEmptyList() || list->m_car == nullptr )
+    {
+        code.emit( OpCode::EVAL, code.addConstant( expr ) );
+        return;
+    }
+
+    ISExpr* head = list->m_car;
+    List*   args = list->m_cdr;
+
+    int32_t argCount = 0;
+    for( auto* it = args; it != nullptr; it = it->m_cdr )
+    {
+        argCount++;
+    }
+
+    // user function: arguments are evaluated before the call
+    if ( head->type() == ISExpr::ATOM || head->type() == ISExpr::CALL_SITE )
+    {
+        Atom* funcName = (head->type() == ISExpr::ATOM) ? head->toAtom() : static_cast<CallSite*>( head )->m_cache.m_atom;
+        for( auto* it = args; it != nullptr; it = it->m_cdr )
+        {
+            compile( it->m_car, code );
+        }
+        code.emit( isTail ? OpCode::TAIL_CALL : OpCode::CALL, code.addCallCache( funcName ), argCount );
+        return;
+    }
+
+    if ( head->type() != ISExpr::BUILT_IN_FUNC )
+    {
+        code.emit( OpCode::EVAL, code.addConstant( expr ) );
+        return;
+    }
+
+    BuiltinFunc* func = head->toBuiltinFunc();
+
+    if ( func == m_quote && argCount >= 1 )
+    {
+        code.emit( OpCode::CONST, code.addConstant( args->m_car ) );
+    }
+    else if ( func == m_set && argCount >= 1 && (args->m_car->type() == ISExpr::ATOM || args->m_car->type() == ISExpr::LOCAL_VARIABLE) )
+    {
+        if ( argCount == 1 )
+        {
+            code.emit( OpCode::CONST, code.addConstant( m_interpreter.m_nilAtom ) );
+        }
+        else
+        {
+            compile( args->m_cdr->m_car, code );
+        }
+        if ( args->m_car->type() == ISExpr::ATOM )
+        {
+            code.emit( OpCode::STORE, code.addConstant( args->m_car ) );
+        }
+        else
+        {
+            auto* variable = static_cast<LocalVariable*>( args->m_car );
+            code.emit( OpCode::STORE_LOCAL, variable->m_depth, variable->m_index );
+        }
+    }
+    else if ( func == m_if && argCount >= 2 )
+    {
+        compile( args->m_car, code );
+        int32_t elseJump = code.emitJump( OpCode::JUMP_IF_NIL );
+        compile( args->m_cdr->m_car, code, isTail );
+        int32_t endJump = code.emitJump( OpCode::JUMP );
+        code.patchJump( elseJump );
+        if ( argCount >= 3 )
+        {
+            compile( args->m_cdr->m_cdr->m_car, code, isTail );
+        }
+        else
+        {
+            code.emit( OpCode::CONST, code.addConstant( m_interpreter.m_nilAtom ) );
+        }
+        code.patchJump( endJump );
+    }
+    else if ( auto* numericFunc = std::find( std::begin(m_numericFuncs), std::end(m_numericFuncs), func ); numericFunc != std::end(m_numericFuncs) )
+    {
+        for( auto* it = args; it != nullptr; it = it->m_cdr )
+        {
+            compile( it->m_car, code );
+        }
+        code.emit( OpCode( int(OpCode::ADD) + int( numericFunc - m_numericFuncs ) ), argCount );
+    }
+    else if ( func == m_print )
+    {
+        if ( argCount == 0 )
+        {
+            code.emit( OpCode::CONST, code.addConstant( m_interpreter.m_nilAtom ) );
+        }
+        for( auto* it = args; it != nullptr; it = it->m_cdr )
+        {
+            compile( it->m_car, code );
+            code.emit( OpCode::PRINT, it->m_cdr == nullptr );
+        }
+    }
+    else if ( ! func->isSpecialForm() )
+    {
+        for( auto* it = args; it != nullptr; it = it->m_cdr )
+        {
+            compile( it->m_car, code );
+        }
+        code.emit( OpCode::CALL_BUILTIN, code.addConstant( func ), argCount );
+    }
+    else
+    {
+        code.emit( OpCode::BUILTIN, code.addConstant( func ), code.addConstant( args ) );
+    }
+}
+
+void VirtualMachine::compileBody( List* body, ByteCode& code )
+{
+    if ( body == nullptr )
+    {
+        code.emit( OpCode::CONST, code.addConstant( nullptr ) );
+    }
+    for( auto* it = body; it != nullptr; it = it->m_cdr )
+    {
+        compile( it->m_car, code, it->m_cdr == nullptr );
+        if ( it->m_cdr != nullptr )
+        {
+            code.emit( OpCode::POP );
+        }
+    }
+    code.emit( OpCode::RETURN );
+}
+
+ByteCode* VirtualMachine::functionCode( List* definition )
+{
+    if ( auto it = m_functions.find( definition ); it != m_functions.end() )
+    {
+        return it->second.get();
+    }
+
+    auto code = std::make_unique<ByteCode>();
+    code->m_slotCount = LInterpreter::parameterCount( definition->m_car->toList() );
+    compileBody( definition->m_cdr, *code );
+
+    ByteCode* result = code.get();
+    m_functions[definition] = std::move( code );
+    return result;
+}
+
+ByteCode* VirtualMachine::calledFunction( CallCache& cache, Frame*& environment )
+{
+    uint32_t slotCount;
+    List* definition = m_interpreter.cachedDefinition( cache, environment, slotCount );
+    if ( definition == nullptr )
+    {
+        return nullptr;
+    }
+    if ( cache.m_code == nullptr )
+    {
+        cache.m_code = functionCode( definition );
+    }
+    return cache.m_code;
+}
+
+//
+// Interpreter loop
+//
+ISExpr* VirtualMachine::run( const ByteCode& byteCode )
+{
+    // every instruction pushes one value at most; the top is kept in 'top' and
+    // stored to the stack (a root of the heap) before anything that can allocate,
+    // call or use the stack, and loaded again after it (the stack may have grown)
+    auto& stack = m_interpreter.m_valueStack;
+    size_t base = stack.size();
+    stack.reserve( base + byteCode.m_code.size() );
+    ISExpr** top = stack.end();
+    auto store = [&] { stack.resize( top - stack.data() ); };
+    auto load  = [&] { top = stack.end(); };
+
+    Frame* frame = m_interpreter.currentFrame();
+
+    const int32_t* code      = byteCode.m_code.data();
+    ISExpr* const* constants = byteCode.m_constants.data();
+    CallCache*     caches    = byteCode.m_callCaches.data();
+    size_t pc = 0;
+
+    for(;;)
+    {
+        switch( OpCode( code[pc++] ) )
+        {
+            case OpCode::CONST:
+                *top++ = constants[ code[pc++] ];
+                break;
+
+            case OpCode::LOAD:
+                *top++ = static_cast<Atom*>( constants[ code[pc++] ] )->value();
+                break;
+
+            case OpCode::STORE:
+            {
+                auto* atom = static_cast<Atom*>( constants[ code[pc++] ] );
+                atom->setValue( top[-1] );
+                m_interpreter.remember( atom, top[-1] );
+                break;
+            }
+
+            case OpCode::LOAD_LOCAL:
+            case OpCode::STORE_LOCAL:
+            {
+                OpCode opCode = OpCode( code[pc-1] );
+                ISExpr** slot = m_interpreter.localSlot( frame, code[pc], code[pc+1] );
+                if ( opCode == OpCode::LOAD_LOCAL )
+                {
+                    *top++ = (slot != nullptr) ? *slot : m_interpreter.m_nilAtom;
+                }
+                else if ( slot != nullptr )
+                {
+                    *slot = top[-1];
+
+                    // a pooled frame is gone before the form is released
+                    Frame* slotFrame = LInterpreter::localFrame( frame, code[pc] );
+                    if ( ! slotFrame->m_isPooled )
+                    {
+                        m_interpreter.remember( slotFrame, top[-1] );
+                    }
+                }
+                pc += 2;
+                break;
+            }
+
+            case OpCode::POP:
+                top--;
+                break;
+
+            case OpCode::JUMP:
+                pc = code[pc];
+                break;
+
+            case OpCode::JUMP_IF_NIL:
+            {
+                ISExpr* value = *--top;
+                pc = m_interpreter.isNil( value ) ? code[pc] : pc+1;
+                break;
+            }
+
+            case OpCode::ADD:
+            case OpCode::SUB:
+            case OpCode::MUL:
+            case OpCode::DIV:
+            {
+                auto op = Arithmetic::Op( code[pc-1] - int(OpCode::ADD) );
+                size_t argCount = code[pc++];
+
+                // a result can be allocated
+                store();
+                ISExpr* const* args = top - argCount;
+                ISExpr* result = (argCount == 2) ? Arithmetic::apply2( op, args[0], args[1] ) : Arithmetic::apply( op, args, argCount );
+                if ( result == nullptr )
+                {
+                    // not numbers: concatenation of '+' or the error, as the builtin does it
+                    result = m_interpreter.callBuiltin( m_numericFuncs[op], args, argCount );
+                }
+                top -= argCount;
+                *top++ = result;
+                break;
+            }
+
+            case OpCode::LESS:
+            case OpCode::GREATER:
+            case OpCode::EQUAL:
+            case OpCode::LESS_EQUAL:
+            case OpCode::GREATER_EQUAL:
+            {
+                int index = code[pc-1] - int(OpCode::ADD);
+                auto comparison = Arithmetic::Comparison( code[pc-1] - int(OpCode::LESS) );
+                size_t argCount = code[pc++];
+                ISExpr* const* args = top - argCount;
+
+                bool isTrue;
+                bool isValid = (argCount == 2) ? Arithmetic::compare2( comparison, args[0], args[1], isTrue )
+                                               : Arithmetic::compare( comparison, args, argCount, isTrue );
+                ISExpr* result;
+                if ( isValid )
+                {
+                    result = isTrue ? m_interpreter.m_trueAtom : m_interpreter.m_nilAtom;
+                }
+                else
+                {
+                    store();
+                    result = m_interpreter.callBuiltin( m_numericFuncs[index], args, argCount );
+                }
+                top -= argCount;
+                *top++ = result;
+                break;
+            }
+
+            case OpCode::PRINT:
+            {
+                bool isLast = code[pc++] != 0;
+                ISExpr* value = top[-1];
+                if ( value != nullptr )
+                {
+                    value->print( m_interpreter.output() );
+                }
+                else
+                {
+                    m_interpreter.output() << "NIL";
+                }
+                if ( ! isLast )
+                {
+                    m_interpreter.output() << '_';
+                    top--;
+                }
+                break;
+            }
+
+            case OpCode::CALL:
+            {
+                CallCache& cache = caches[ code[pc] ];
+                size_t argCount = code[pc+1];
+                pc += 2;
+                store();
+                ISExpr* result = callUserFunc( cache, argCount );
+                load();
+                *top++ = result;
+                break;
+            }
+
+            case OpCode::TAIL_CALL:
+            {
+                CallCache& cache = caches[ code[pc] ];
+                size_t argCount = code[pc+1];
+                pc += 2;
+                store();
+
+                Frame* environment;
+                ByteCode* function = calledFunction( cache, environment );
+                if ( function == nullptr )
+                {
+                    ISExpr* result = callUserFunc( cache, argCount );
+                    load();
+                    *top++ = result;
+                    break;
+                }
+
+                // arguments replace the operands of the caller, its frame is replaced by the callee one
+                std::copy( top - argCount, top, stack.data() + base );
+                stack.resize( base + argCount );
+                popFrame();
+                m_interpreter.pushFrame( makeFrame( *function, environment ), argCount );
+                stack.reserve( base + function->m_code.size() );
+                load();
+                if ( m_interpreter.m_profiler.isEnabled() )
+                {
+                    m_interpreter.m_profiler.tailCall( cache.m_atom->name() );
+                }
+
+                frame     = m_interpreter.currentFrame();
+                code      = function->m_code.data();
+                constants = function->m_constants.data();
+                caches    = function->m_callCaches.data();
+                pc        = 0;
+                break;
+            }
+
+            case OpCode::BUILTIN:
+            {
+                auto* func = static_cast<BuiltinFunc*>( constants[ code[pc] ] );
+                auto* args = static_cast<List*>( constants[ code[pc+1] ] );
+                pc += 2;
+                store();
+                if ( m_interpreter.m_profiler.isEnabled() )
+                {
+                    m_interpreter.m_profiler.enter( func->name() );
+                }
+                ISExpr* result = func->func()( m_interpreter, args );
+                if ( m_interpreter.m_profiler.isEnabled() )
+                {
+                    m_interpreter.m_profiler.exit();
+                }
+                load();
+                *top++ = result;
+                break;
+            }
+
+            case OpCode::CALL_BUILTIN:
+            {
+                auto* func = static_cast<BuiltinFunc*>( constants[ code[pc] ] );
+                size_t argCount = code[pc+1];
+                pc += 2;
+                store();
+                if ( m_interpreter.m_profiler.isEnabled() )
+                {
+                    m_interpreter.m_profiler.enter( func->name() );
+                }
+                ISExpr* result = m_interpreter.callBuiltin( func, top - argCount, argCount );
+                if ( m_interpreter.m_profiler.isEnabled() )
+                {
+                    m_interpreter.m_profiler.exit();
+                }
+                stack.pop( argCount );
+                load();
+                *top++ = result;
+                break;
+            }
+
+            case OpCode::EVAL:
+            {
+                store();
+                ISExpr* result = m_interpreter.eval( constants[ code[pc++] ] );
+                load();
+                *top++ = result;
+                break;
+            }
+
+            case OpCode::RETURN:
+            {
+                ISExpr* result = top[-1];
+                stack.resize( base );
+                return result;
+            }
+        }
+    }
+}
+
+ISExpr* VirtualMachine::callUserFunc( CallCache& cache, size_t argCount )
+{
+    Atom* funcName = cache.m_atom;
+    Frame* environment;
+    ByteCode* function = calledFunction( cache, environment );
+    if ( function == nullptr )
+    {
+        errorStream() << "\nbad definition of user function: ";
+        funcName->print( std::cerr );
+        std::cerr << "\n";
+        m_interpreter.m_valueStack.resize( m_interpreter.m_valueStack.size() - argCount );
+        return m_interpreter.m_nilAtom;
+    }
+
+    m_interpreter.pushFrame( makeFrame( *function, environment ), argCount );
+    if ( m_interpreter.m_profiler.isEnabled() )
+    {
+        m_interpreter.m_profiler.enter( funcName->name() );
+    }
+    ISExpr* result = run( *function );
+    popFrame();
+    if ( m_interpreter.m_profiler.isEnabled() )
+    {
+        m_interpreter.m_profiler.exit();
+    }
+
+    return result;
+}
+
+Frame* VirtualMachine::makeFrame( const ByteCode& function, Frame* environment )
+{
+    if ( function.m_canCaptureFrame )
+    {
+        return Frame::make( environment, function.m_slotCount );
+    }
+
+    if ( function.m_slotCount >= m_freeFrames.size() )
+    {
+        m_freeFrames.resize( function.m_slotCount + 1 );
+    }
+    auto& freeFrames = m_freeFrames[function.m_slotCount];
+    if ( freeFrames.empty() )
+    {
+        void* place = m_frameArena.allocate( sizeof(Frame) + function.m_slotCount * sizeof(ISExpr*) );
+        return Frame::makePooled( place, environment, function.m_slotCount );
+    }
+
+    Frame* frame = freeFrames.back();
+    freeFrames.pop_back();
+    frame->m_parent = environment;
+    return frame;
+}
+
+void VirtualMachine::popFrame()
+{
+    Frame* frame = m_interpreter.currentFrame();
+    m_interpreter.popFrame();
+    if ( frame->m_isPooled )
+    {
+        m_freeFrames[frame->m_size].push_back( frame );
+    }
+}
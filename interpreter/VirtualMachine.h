@@ -0,0 +1,104 @@
+#pragma once
+
+#include "ByteCode.h"
+#include "Arena.h"
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class LInterpreter;
+class GcHeap;
+
+//---------------------------------------------------------------
+//
+// VirtualMachine - stack machine running compiled forms
+//
+//---------------------------------------------------------------
+//
+//  An alternative to the tree walking LInterpreter::eval(ISExpr*),
+//  enabled by LInterpreter::setUseVirtualMachine().
+//
+//  A top-level form is compiled to ByteCode and run (the code is kept for
+//  the next evaluation of the same form); a user function is
+//  compiled on its first call and the code is cached by its definition
+//  (see Closure); each call keeps an inline cache of the function it called
+//  (see CallCache). Atoms, local variables, numbers, 'quote', 'set', 'if',
+//  '+', '-', '*', '/', '<', '>', '=', '<=', '>=', 'print' and calls of user functions are
+//  compiled to opcodes; other builtins get their arguments evaluated on
+//  the stack, special forms get them unevaluated, as in the tree walker.
+//
+//  The operand stack is LInterpreter::m_valueStack (a root of the heap);
+//  run() reserves room for the operands of its code once and pushes them
+//  unchecked. Calls push the same frames as the tree walker
+//  (LInterpreter::pushFrame), so both produce the same results; a function
+//  whose code runs no builtins nor the tree walker cannot give its frame to
+//  a closure, so the frame is reused after the call instead of being
+//  allocated in the heap.
+//
+//---------------------------------------------------------------
+
+class VirtualMachine
+{
+    LInterpreter& m_interpreter;
+
+    // builtins that are compiled to opcodes
+    BuiltinFunc* m_quote   = nullptr;
+    BuiltinFunc* m_set     = nullptr;
+    BuiltinFunc* m_if      = nullptr;
+    // '+', '-', '*', '/' and '<', '>', '=', '<=', '>=' by opcode (from ADD on)
+    BuiltinFunc* m_numericFuncs[9] = {};
+    BuiltinFunc* m_print   = nullptr;
+
+    // function definition (Closure::m_definition) -> its code
+    std::unordered_map<List*, std::unique_ptr<ByteCode>> m_functions;
+
+    // top-level form -> its code
+    std::unordered_map<ISExpr*, std::unique_ptr<ByteCode>> m_forms;
+    static constexpr size_t cMaxForms = 1024;
+
+    // code of both maps when the heap is collected: the definitions and forms are
+    // not kept alive (the code is compiled again when called), but the code may be
+    // running, so it is freed (and its constants marked) until no form is run
+    std::vector<std::unique_ptr<ByteCode>> m_retired;
+
+    // nesting of eval()
+    int m_evalDepth = 0;
+
+    // frames of calls that cannot be captured (see Frame::m_isPooled),
+    // free ones by slot count; their memory is kept in m_frameArena
+    std::vector<std::vector<Frame*>> m_freeFrames;
+    Arena m_frameArena;
+
+public:
+    VirtualMachine( LInterpreter& interpreter ) : m_interpreter(interpreter) {}
+
+    // must be called when all builtins are registered
+    void init();
+
+    // compiles and runs a top-level form (its code is kept until the form is released)
+    ISExpr* eval( ISExpr* expr );
+
+    // the code epoch has changed (see LInterpreter::m_codeEpoch)
+    void markRoots( GcHeap& heap );
+
+    // definitions allocated in 'region' are about to be released
+    void forgetCodeIn( const Arena& region );
+
+private:
+    // 'isTail': the value of 'expr' is returned by the function (calls become TAIL_CALL)
+    void compile( ISExpr* expr, ByteCode& code, bool isTail = false );
+    void compileBody( List* body, ByteCode& code );
+    ByteCode* functionCode( List* definition );
+
+    // code of the function called through 'cache' (nullptr: not a function)
+    ByteCode* calledFunction( CallCache& cache, Frame*& environment );
+
+    ISExpr* run( const ByteCode& code );
+    ISExpr* callUserFunc( CallCache& cache, size_t argCount );
+
+    // frame of a call of 'function' (pooled when the code cannot capture it)
+    Frame* makeFrame( const ByteCode& function, Frame* environment );
+    // the current frame is left
+    void popFrame();
+};
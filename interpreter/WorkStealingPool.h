@@ -0,0 +1,170 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// WorkStealingPool - fixed set of threads running numbered tasks
+//
+// run() gives every worker a contiguous block of the tasks; a worker takes
+// its own tasks from the front of its deque and, when it has none left,
+// steals from the back of the others', so uneven tasks still keep every
+// thread busy. run() returns when all tasks are done. Tasks of one run()
+// may run in any order and on any worker.
+//
+class WorkStealingPool
+{
+public:
+    using Body = std::function< void ( size_t task, unsigned worker ) >;
+
+private:
+    struct Worker
+    {
+        std::mutex         m_mutex;
+        std::deque<size_t> m_tasks;
+        std::thread        m_thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    std::mutex              m_mutex;
+    std::condition_variable m_started;
+    std::condition_variable m_finished;
+    const Body*             m_body = nullptr;
+    uint64_t                m_run  = 0;         // number of the current run()
+    size_t                  m_busyWorkers = 0;
+    bool                    m_isStopped = false;
+
+    std::atomic<size_t>     m_pendingTasks{ 0 };
+    std::atomic<uint64_t>   m_stealCount{ 0 };
+
+public:
+    WorkStealingPool( unsigned threadCount )
+    {
+        for( unsigned i = 0; i < threadCount; i++ )
+        {
+            m_workers.push_back( std::make_unique<Worker>() );
+        }
+        for( unsigned i = 0; i < threadCount; i++ )
+        {
+            m_workers[i]->m_thread = std::thread( [this,i] { workerLoop(i); } );
+        }
+    }
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_isStopped = true;
+        }
+        m_started.notify_all();
+        for( auto& worker : m_workers )
+        {
+            worker->m_thread.join();
+        }
+    }
+
+    WorkStealingPool( const WorkStealingPool& ) = delete;
+    WorkStealingPool& operator=( const WorkStealingPool& ) = delete;
+
+    unsigned threadCount() const { return unsigned( m_workers.size() ); }
+
+    // tasks taken from other workers' deques since the pool was created
+    uint64_t stealCount() const { return m_stealCount.load(); }
+
+    void run( size_t taskCount, const Body& body )
+    {
+        if ( taskCount == 0 )
+        {
+            return;
+        }
+
+        size_t workerCount = m_workers.size();
+        for( size_t i = 0; i < workerCount; i++ )
+        {
+            std::lock_guard<std::mutex> lock( m_workers[i]->m_mutex );
+            for( size_t task = taskCount * i / workerCount; task < taskCount * (i+1) / workerCount; task++ )
+            {
+                m_workers[i]->m_tasks.push_back( task );
+            }
+        }
+        m_pendingTasks = taskCount;
+
+        std::unique_lock<std::mutex> lock( m_mutex );
+        m_body = &body;
+        m_busyWorkers = workerCount;
+        m_run++;
+        m_started.notify_all();
+
+        // all workers are back to waiting, so none of them can see 'body' later
+        m_finished.wait( lock, [this] { return m_busyWorkers == 0; } );
+        m_body = nullptr;
+    }
+
+private:
+    bool takeTask( unsigned worker, size_t& task )
+    {
+        {
+            Worker& own = *m_workers[worker];
+            std::lock_guard<std::mutex> lock( own.m_mutex );
+            if ( ! own.m_tasks.empty() )
+            {
+                task = own.m_tasks.front();
+                own.m_tasks.pop_front();
+                return true;
+            }
+        }
+
+        for( size_t i = 1; i < m_workers.size(); i++ )
+        {
+            Worker& victim = *m_workers[ (worker + i) % m_workers.size() ];
+            std::lock_guard<std::mutex> lock( victim.m_mutex );
+            if ( ! victim.m_tasks.empty() )
+            {
+                task = victim.m_tasks.back();
+                victim.m_tasks.pop_back();
+                m_stealCount++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop( unsigned worker )
+    {
+        uint64_t lastRun = 0;
+        for(;;)
+        {
+            const Body* body;
+            {
+                std::unique_lock<std::mutex> lock( m_mutex );
+                m_started.wait( lock, [&] { return m_run != lastRun || m_isStopped; } );
+                if ( m_isStopped )
+                {
+                    return;
+                }
+                lastRun = m_run;
+                body = m_body;
+            }
+
+            size_t task;
+            while( m_pendingTasks.load() > 0 && takeTask( worker, task ) )
+            {
+                (*body)( task, worker );
+                m_pendingTasks--;
+            }
+
+            std::lock_guard<std::mutex> lock( m_mutex );
+            if ( --m_busyWorkers == 0 )
+            {
+                m_finished.notify_all();
+            }
+        }
+    }
+};
@@ -1,7 +1,10 @@
 #include "Scanner.h"
 #include "Parser.h"
 #include "LInterpreter.h"
+#include "Driver.h"
 
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -24,27 +27,22 @@
 
  */
 
-struct Date
-{
-    int mo, da, yr;
-public:
-    Date(int m, int d, int y)
-    {
-        mo = m; da = d; yr = y;
-    }
-};
-
-std::ostream& operator<<(std::ostream& os, const Date& dt)
-{
-    os << dt.mo << '/' << dt.da << '/' << dt.yr;
-    return os;
-}
-
-
-
 using namespace std;
 
-int main() {
+//
+// interpreter [--vm] [--no-fold] [--repl] [--threads n] [--trace level] [--profile folded.txt]
+//             [--image in.img] [--save-image out.img] [file]
+//
+// Evaluates the forms of 'file' (or of the standard input) one by one as they are read;
+// --repl prints the result of every form, --vm runs forms on the bytecode virtual machine,
+// --no-fold evaluates forms as they are parsed (without ConstantFolder),
+// --threads sets the number of worker threads of pmap, preduce and pfor (0: none),
+// --trace prints debug dumps up to 'level' (see Log.h), --profile profiles the whole run:
+// the flat profile goes to stderr and folded stacks (for flame graphs) to the file;
+// --image loads the functions and variables saved by --save-image (after the run)
+// before the forms are evaluated (see Snapshot.h)
+//
+int main( int argc, char* argv[] ) {
     //string input = "(print (a b c))";
     //string input = "(print (print1 (a b c)) (print2 (a b c)) )";
     //string input = "(print (quote (a b c)) (quote (1 2 3)))";
@@ -52,29 +50,116 @@ int main() {
     //string input = "(set c (quote z)) (defun f(a b) (+ a c b c)) (print (f x y))";
     //string input = "(defun f(a b) (+ a b c) (+ a b c c)) (print (f x y))";
     //string input = "(print (+ (+ a b)(+ c d)))";
-    //string input = "(print (+ (+ a b)(+ c d)))";
     //string input = "(print a) (print b) ";
     //string input = "(printRect (25 50))";
+    //string input = "(set x (quote 11)) (print (+ 25.5 x))";
 
-    string input = "(set x (quote 11)) (print (+ 25.5 x))";
+    bool useVirtualMachine = false;
+    bool foldConstants = true;
+    bool isRepl = false;
+    int  parallelThreads = -1;
+    string fileName;
+    string profileFileName;
+    string imageFileName;
+    string saveImageFileName;
+    for( int i = 1; i < argc; i++ )
+    {
+        string arg = argv[i];
+        if ( arg == "--vm" )
+        {
+            useVirtualMachine = true;
+        }
+        else if ( arg == "--no-fold" )
+        {
+            foldConstants = false;
+        }
+        else if ( arg == "--repl" )
+        {
+            isRepl = true;
+        }
+        else if ( arg == "--profile" && i+1 < argc )
+        {
+            profileFileName = argv[++i];
+        }
+        else if ( arg == "--threads" && i+1 < argc )
+        {
+            parallelThreads = std::atoi( argv[++i] );
+        }
+        else if ( arg == "--image" && i+1 < argc )
+        {
+            imageFileName = argv[++i];
+        }
+        else if ( arg == "--save-image" && i+1 < argc )
+        {
+            saveImageFileName = argv[++i];
+        }
+        else if ( arg == "--trace" && i+1 < argc )
+        {
+            gTraceLevel = std::atoi( argv[++i] );
+        }
+        else
+        {
+            fileName = arg;
+        }
+    }
 
-    LInterpreter& lInterpreter = LInterpreter::getInstance();
-    while( lInterpreter.eval(input) != nullptr ) {
+    LInterpreter lInterpreter;
+    lInterpreter.setUseVirtualMachine( useVirtualMachine );
+    lInterpreter.setFoldConstants( foldConstants );
+    if ( parallelThreads >= 0 )
+    {
+        lInterpreter.setParallelThreads( unsigned( parallelThreads ) );
+    }
+
+    if ( ! imageFileName.empty() && ! lInterpreter.loadSnapshot( imageFileName ) )
+    {
+        return 1;
     }
-    std::cout << "\n\n# LInterpreter ended\n\n";
-    
-    
-    ISExpr* str = new Custom<Date>( new Date(12,31,2023) );
-    str->print("\n\nprint: ");
 
-    auto* s = to<Date>( str );
-    if ( s != nullptr )
+    if ( ! profileFileName.empty() )
     {
-        std::cout << "\n\n#value:  " << *s->value();
-        std::cout << "\n\n# ";
+        lInterpreter.profiler().enable();
     }
-    
-    s->clear();
 
+    Driver driver( lInterpreter );
+    driver.setInteractive( isRepl );
+
+    if ( fileName.empty() )
+    {
+        FormReader reader( 0 );
+        driver.run( reader );
+    }
+    else
+    {
+        FormReader reader( fileName );
+        if ( ! reader.isOpen() )
+        {
+            LOG_ERR( "cannot open file: " << fileName );
+            return 1;
+        }
+        driver.run( reader );
+    }
+
+    if ( ! profileFileName.empty() )
+    {
+        Profiler& profiler = lInterpreter.profiler();
+        profiler.disable();
+        profiler.printFlat( std::cerr );
+
+        std::ofstream folded( profileFileName );
+        if ( ! folded )
+        {
+            LOG_ERR( "cannot write file: " << profileFileName );
+        }
+        profiler.writeFolded( folded );
+    }
+
+    if ( ! saveImageFileName.empty() && ! lInterpreter.saveSnapshot( saveImageFileName ) )
+    {
+        return 1;
+    }
+
+    lInterpreter.flushOutput();
+    std::cout << "\n\n# LInterpreter ended\n\n";
     return 0;
 }
@@ -2,25 +2,28 @@
 
 void LInterpreter::addPseudoTableFuncs() {
 
-    m_builtInFuncMap["printRect"] = new BuiltinFunc( "printRect", [](List* expr) -> ISExpr* {
+    addBuiltin( new BuiltinFunc( "printRect", [](LInterpreter& interpreter, List* expr) -> ISExpr* {
         List* parameterList = expr->m_car->toList();
         int height = parameterList->m_car->toIntNumber()->intValue();
         int width = parameterList->m_cdr->m_car->toIntNumber()->intValue();
 
-        std::string answer = "";
-        for (int j = 0; j < height; ++j) {
+        // all rows but the first and the last one are the same: they are built once
+        auto row = [height, width]( int j )
+        {
+            std::string answer;
+            answer.reserve( (width > 0) ? width + 1 : 0 );
             for (int i = 0; i <= width; ++i) {
                 if (i == 0 && j == 0) {
-                    answer += ".";
+                    answer += '.';
                 }
                 else if (j == 0 && i + 1 == width) {
-                    answer += ".";
+                    answer += '.';
                 }
                 else if (i == 0 && j + 1 == height) {
-                    answer += ".";
+                    answer += '.';
                 }
                 else if (i + 1 == width && j + 1 == height) {
-                    answer += ".";
+                    answer += '.';
                 }
                 else if (i == 0 || i + 1 == width) {
                     answer += '|';
@@ -33,9 +36,21 @@ void LInterpreter::addPseudoTableFuncs() {
                 }
                 else answer += ' ';
             }
+            return answer;
+        };
+
+        std::ostream& output = interpreter.output();
+        std::string middle = (height > 2) ? row( 1 ) : std::string();
+        for (int j = 0; j < height; ++j) {
+            if (j == 0 || j + 1 == height) {
+                std::string edge = row( j );
+                output.write( edge.data(), edge.size() );
+            }
+            else {
+                output.write( middle.data(), middle.size() );
+            }
         }
-        std::cout << answer;
         return new List();
-    });
+    }));
     return;
 }
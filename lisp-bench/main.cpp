@@ -0,0 +1,1310 @@
+#include "Scanner.h"
+#include "MappedFile.h"
+#include "LInterpreter.h"
+#include "Parallel.h"
+#include "BinaryFormat.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//
+// lisp-bench - performance measurements
+//
+// usage: lisp-bench [--json file] [--filter text] [file.lisp]
+//
+//        --json    results are also written to 'file' as JSON (to track regressions)
+//        --filter  only benchmarks whose name contains 'text'
+//        without a file a generated data file (about 16 MB) is scanned and parsed
+//
+// All workloads are fixed (generated data is the same on every run), so the
+// results of different builds can be compared. Every benchmark is run several
+// times and the best time is reported.
+//
+// instances/N run interpreters on N threads at once and parallel/pmap/N runs
+// pmap on N worker threads; both compare their results with the ones of one
+// thread, startup/image and serialize/binary with the ones of the text, and
+// numeric/ and bigint/ check arithmetic results: the exit code is 1 when they
+// differ. Output and errors are always checked to stay in order.
+//
+
+// s-expression data like the generated data files
+static std::string generateData( size_t minSize )
+{
+    std::string data;
+    data.reserve( minSize + 256 );
+    for( size_t i = 0; data.size() < minSize; i++ )
+    {
+        data += "(record (id " + std::to_string(i) + ") (name item" + std::to_string(i) + ")";
+        data += "\n    (value " + std::to_string(i % 1000) + ".25) (tags (alpha beta gamma))\t(nested ((1 2) (3 4))))\n";
+    }
+    return data;
+}
+
+//------------------------
+// Suite
+//------------------------
+class Suite
+{
+public:
+    struct Result
+    {
+        std::string m_name;
+        int         m_runs = 0;
+        double      m_seconds = 0;          // best run
+        double      m_bytesPerSecond = 0;
+        double      m_itemsPerSecond = 0;
+
+        // other rates: name -> per second
+        std::vector<std::pair<std::string,double>> m_counters;
+
+        Result( std::string name, int runs, double seconds, double bytesPerSecond, double itemsPerSecond )
+          : m_name(std::move(name)), m_runs(runs), m_seconds(seconds), m_bytesPerSecond(bytesPerSecond), m_itemsPerSecond(itemsPerSecond) {}
+    };
+
+    static constexpr int cRuns = 5;
+
+private:
+    std::string         m_filter;
+    std::vector<Result> m_results;
+
+public:
+    Suite( std::string filter ) : m_filter( std::move(filter) ) {}
+
+    bool isSelected( const std::string& name ) const
+    {
+        return m_filter.empty() || name.find( m_filter ) != std::string::npos;
+    }
+
+    // best time of 'body' of several runs
+    static double bestSeconds( const std::function<void()>& body, int runs = cRuns )
+    {
+        double best = 1e30;
+        for( int run = 0; run < runs; run++ )
+        {
+            auto start = std::chrono::steady_clock::now();
+            body();
+            double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+            if ( seconds < best )
+            {
+                best = seconds;
+            }
+        }
+        return best;
+    }
+
+    void add( Result result )
+    {
+        std::printf( "%-36s %12.3f ms", result.m_name.c_str(), result.m_seconds * 1000 );
+        if ( result.m_bytesPerSecond > 0 )
+        {
+            std::printf( "  %10.1f MB/s", result.m_bytesPerSecond / (1024*1024) );
+        }
+        if ( result.m_itemsPerSecond > 0 )
+        {
+            std::printf( "  %10.3f M items/s", result.m_itemsPerSecond / 1e6 );
+        }
+        for( auto& [name, perSecond] : result.m_counters )
+        {
+            std::printf( "  %s %.3f M/s", name.c_str(), perSecond / 1e6 );
+        }
+        std::printf( "\n" );
+        std::fflush( stdout );
+
+        m_results.push_back( std::move(result) );
+    }
+
+    // the layout of Google Benchmark JSON output
+    void writeJson( std::ostream& stream ) const
+    {
+        char date[64];
+        std::time_t now = std::time( nullptr );
+        std::strftime( date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime( &now ) );
+
+        stream.precision( 12 );
+        stream << "{\n";
+        stream << "  \"context\": {\n";
+        stream << "    \"date\": \"" << date << "\",\n";
+        stream << "    \"trace_level\": " << LISP_TRACE_LEVEL << "\n";
+        stream << "  },\n";
+        stream << "  \"benchmarks\": [\n";
+        for( size_t i = 0; i < m_results.size(); i++ )
+        {
+            const Result& result = m_results[i];
+            stream << "    {\n";
+            stream << "      \"name\": \"" << jsonEscaped( result.m_name ) << "\",\n";
+            stream << "      \"iterations\": " << result.m_runs << ",\n";
+            stream << "      \"real_time\": " << result.m_seconds * 1e9 << ",\n";
+            stream << "      \"time_unit\": \"ns\"";
+            if ( result.m_bytesPerSecond > 0 )
+            {
+                stream << ",\n      \"bytes_per_second\": " << result.m_bytesPerSecond;
+            }
+            if ( result.m_itemsPerSecond > 0 )
+            {
+                stream << ",\n      \"items_per_second\": " << result.m_itemsPerSecond;
+            }
+            for( auto& [name, perSecond] : result.m_counters )
+            {
+                stream << ",\n      \"" << jsonEscaped( name ) << "\": " << perSecond;
+            }
+            stream << "\n    }" << ( i+1 < m_results.size() ? "," : "" ) << "\n";
+        }
+        stream << "  ]\n";
+        stream << "}\n";
+    }
+
+private:
+    static std::string jsonEscaped( const std::string& text )
+    {
+        std::string result;
+        for( char c : text )
+        {
+            if ( c == '"' || c == '\\' )
+            {
+                result += '\\';
+            }
+            result += c;
+        }
+        return result;
+    }
+};
+
+//
+// Scanner throughput: all tokens of the source
+//
+static void benchScanner( Suite& suite, std::string_view source, const char* classifierName )
+{
+    std::string name = std::string("scanner/") + classifierName;
+    if ( ! suite.isSelected( name ) )
+    {
+        return;
+    }
+
+    Scanner::ClassifyFunc classify = Scanner::classifier( classifierName );
+    if ( classify == nullptr )
+    {
+        std::printf( "%-36s not supported\n", name.c_str() );
+        return;
+    }
+
+    size_t tokenCount = 0;
+    double seconds = Suite::bestSeconds( [&]
+    {
+        Scanner scanner;
+        scanner.setClassifier( classify );
+        scanner.setSource( source );
+        size_t count = 0;
+        for( auto token = scanner.getNextToken(); token.m_type != Scanner::END; token = scanner.getNextToken() )
+        {
+            count++;
+        }
+        tokenCount = count;
+    });
+
+    suite.add( { name, Suite::cRuns, seconds, double( source.size() ) / seconds, double( tokenCount ) / seconds } );
+}
+
+//
+// Parser: all forms of the source into an Arena (items are forms)
+//
+static void benchParser( Suite& suite, LInterpreter& interpreter, std::string_view source )
+{
+    if ( ! suite.isSelected( "parser" ) )
+    {
+        return;
+    }
+
+    Parser parser;
+    interpreter.initParser( parser );
+
+    size_t formCount = 0;
+    uint64_t allocationCount = 0;
+    uint64_t bytesAllocated = 0;
+    double seconds = Suite::bestSeconds( [&]
+    {
+        Arena arena;
+        AllocatorScope scope( arena );
+        parser.setSource( source );
+        size_t count = 0;
+        while( ! parser.isAtEnd() )
+        {
+            parser.parse();
+            count++;
+        }
+        formCount = count;
+        allocationCount = arena.allocationCount();
+        bytesAllocated = arena.bytesAllocated();
+    });
+
+    Suite::Result result{ "parser", Suite::cRuns, seconds, double( source.size() ) / seconds, double( formCount ) / seconds };
+    result.m_counters.push_back( { "allocations_per_second", double( allocationCount ) / seconds } );
+    result.m_counters.push_back( { "allocated_bytes_per_second", double( bytesAllocated ) / seconds } );
+    suite.add( std::move(result) );
+}
+
+//
+// Array kernels on 1M doubles (items are elements)
+//
+static void benchArrayKernels( Suite& suite, const char* kernelsName )
+{
+    const ArrayKernels* kernels = ArrayKernels::kernels( kernelsName );
+    const size_t size = 1024*1024;
+    std::vector<double> a( size ), b( size ), result( size );
+    for( size_t i = 0; i < size; i++ )
+    {
+        a[i] = double( i % 1000 ) * 0.5;
+        b[i] = double( i % 7 ) - 3;
+    }
+
+    for( const char* operation : { "dot", "vec+" } )
+    {
+        std::string name = std::string("array/") + operation + "/" + kernelsName;
+        if ( ! suite.isSelected( name ) )
+        {
+            continue;
+        }
+        if ( kernels == nullptr )
+        {
+            std::printf( "%-36s not supported\n", name.c_str() );
+            continue;
+        }
+
+        volatile double sink = 0;
+        double seconds = Suite::bestSeconds( [&]
+        {
+            if ( std::string_view( operation ) == "dot" )
+            {
+                sink = kernels->m_dotDoubles( a.data(), b.data(), size );
+            }
+            else
+            {
+                kernels->m_addDoubles( a.data(), b.data(), result.data(), size );
+            }
+        });
+        suite.add( { name, Suite::cRuns, seconds, 0, double( size ) / seconds } );
+    }
+}
+
+//
+// Sum of 100000 numbers: a list walked by a user function against (sum array)
+//
+static void benchArraySum( Suite& suite, LInterpreter& interpreter )
+{
+    interpreter.eval( "(defun lsum (l acc) (if l (lsum (cdr l) (+ acc (car l))) acc))" );
+    interpreter.eval( "(set numbers (make-array 100000 1))" );
+    interpreter.eval( "(set numberList (array->list numbers))" );
+
+    // calls are parsed once and evaluated again and again
+    Arena arena;
+    Parser parser;
+    interpreter.initParser( parser );
+
+    for( auto [kind, call] : { std::pair{ "list", "(lsum numberList 0)" }, std::pair{ "array", "(sum numbers)" } } )
+    {
+        std::string name = std::string("array/sum/") + kind;
+        if ( ! suite.isSelected( name ) )
+        {
+            continue;
+        }
+
+        ISExpr* form;
+        {
+            AllocatorScope scope( arena );
+            parser.setSource( call );
+            form = parser.parse();
+        }
+        double seconds = Suite::bestSeconds( [&] { interpreter.evalForm( form, arena ); } );
+        suite.add( { name, Suite::cRuns, seconds, 0, 100000 / seconds } );
+    }
+}
+
+//
+// Round trip of the forms of the source: printed and parsed back against
+// written and read back by BinaryWriter/BinaryReader (items are forms,
+// bytes are of the text)
+//
+static bool benchSerialization( Suite& suite, LInterpreter& interpreter, std::string_view source )
+{
+    Parser parser;
+    interpreter.initParser( parser );
+
+    Arena dataArena;
+    std::vector<ISExpr*> forms;
+    {
+        AllocatorScope scope( dataArena );
+        parser.setSource( source );
+        while( ! parser.isAtEnd() )
+        {
+            if ( ISExpr* form = parser.parse(); form != nullptr )
+            {
+                forms.push_back( form );
+            }
+        }
+    }
+
+    auto printAll = []( const std::vector<ISExpr*>& values )
+    {
+        std::ostringstream text;
+        for( ISExpr* value : values )
+        {
+            value->print( text );
+            text << '\n';
+        }
+        return text.str();
+    };
+    std::string expected = printAll( forms );
+
+    bool isOk = true;
+    for( bool isBinary : { false, true } )
+    {
+        std::string name = isBinary ? "serialize/binary" : "serialize/text";
+        if ( ! suite.isSelected( name ) )
+        {
+            continue;
+        }
+
+        // forms read by the last run are checked
+        Arena arena;
+        std::vector<ISExpr*> readForms;
+        double seconds = Suite::bestSeconds( [&]
+        {
+            arena.reset();
+            AllocatorScope scope( arena );
+            readForms.clear();
+            if ( isBinary )
+            {
+                std::stringstream stream;
+                BinaryWriter writer( stream, interpreter );
+                for( ISExpr* form : forms )
+                {
+                    writer.write( form );
+                }
+
+                BinaryReader reader( stream, interpreter );
+                while( ISExpr* form = reader.read() )
+                {
+                    readForms.push_back( form );
+                }
+            }
+            else
+            {
+                std::string text = printAll( forms );
+
+                parser.setSource( text );
+                while( ! parser.isAtEnd() )
+                {
+                    if ( ISExpr* form = parser.parse(); form != nullptr )
+                    {
+                        readForms.push_back( form );
+                    }
+                }
+            }
+        });
+        if ( printAll( readForms ) != expected )
+        {
+            std::fprintf( stderr, "%s: forms read back differ from the ones of the source\n", name.c_str() );
+            isOk = false;
+        }
+
+        suite.add( { name, Suite::cRuns, seconds, double( expected.size() ) / seconds, double( forms.size() ) / seconds } );
+    }
+    return isOk;
+}
+
+//
+// Lisp workloads, by the tree walker and by the virtual machine
+//
+struct Workload
+{
+    const char* m_name;
+    const char* m_definition;
+    const char* m_call;
+    double      m_itemCount;    // calls, iterations or conses of one m_call
+};
+
+static const Workload cWorkloads[] =
+{
+    { "arithmetic", "(defun arith (n acc) (if (< n 1) acc (arith (- n 1) (+ acc (* n 2) (- n 1)))))",
+                    "(arith 200000 0)", 200000 },
+    { "constants",  "(defun area (n acc) (if (< n 1) acc (area (- n 1) (+ acc (* 3.5 (* 2 2)) (- 10 (quote 4))))))",
+                    "(area 200000 0)", 200000 },
+    { "fib",        "(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))",
+                    "(fib 20)", 21891 },
+    { "ackermann",  "(defun ack (m n) (if (< m 1) (+ n 1) (if (< n 1) (ack (- m 1) 1) (ack (- m 1) (ack m (- n 1))))))",
+                    "(ack 2 200)", 81405 },
+    { "cons",       "(defun build (n l) (if (< n 1) l (build (- n 1) (cons n l))))",
+                    "(build 100000 nil)", 100000 },
+    { "printRect",  "(defun rects (n) (printRect (60 120)) (if (< n 1) n (rects (- n 1))))",
+                    "(rects 199)", 200 },
+};
+
+// output of printRect is not measured
+class NullBuffer : public std::streambuf
+{
+protected:
+    int             overflow( int c ) override { return c; }
+    std::streamsize xsputn( const char*, std::streamsize count ) override { return count; }
+};
+
+static void benchWorkloads( Suite& suite, LInterpreter& interpreter )
+{
+    for( const Workload& workload : cWorkloads )
+    {
+        interpreter.eval( workload.m_definition );
+    }
+
+    // calls are parsed once and evaluated again and again
+    Arena arena;
+    Parser parser;
+    interpreter.initParser( parser );
+
+    NullBuffer nullBuffer;
+    std::ostream nullStream( &nullBuffer );
+    interpreter.setOutput( nullStream );
+    for( bool useVirtualMachine : { false, true } )
+    {
+        interpreter.setUseVirtualMachine( useVirtualMachine );
+        for( const Workload& workload : cWorkloads )
+        {
+            std::string name = std::string( workload.m_name ) + ( useVirtualMachine ? "/vm" : "/tree" );
+            if ( ! suite.isSelected( name ) )
+            {
+                continue;
+            }
+
+            ISExpr* call;
+            {
+                AllocatorScope scope( arena );
+                parser.setSource( workload.m_call );
+                call = parser.parse();
+            }
+
+            double seconds = Suite::bestSeconds( [&] { interpreter.evalForm( call, arena ); } );
+
+            suite.add( { name, Suite::cRuns, seconds, 0, workload.m_itemCount / seconds } );
+        }
+    }
+    interpreter.setUseVirtualMachine( false );
+    interpreter.setOutput( std::cout );
+}
+
+//
+// Allocation churn: the temporaries of a form (a list of 10000 doubles, 100
+// times) by global new and delete one by one, as every object was allocated
+// before the regions, against an Arena released at once; then through the
+// interpreter, where every '+' of doubles allocates its result in GcHeap
+// (items are allocations)
+//
+class NewDeleteAllocator : public SExprAllocator
+{
+    std::vector<void*> m_blocks;
+
+public:
+    ~NewDeleteAllocator() { release(); }
+
+    void* allocate( size_t size ) override
+    {
+        void* block = ::operator new( size );
+        m_blocks.push_back( block );
+        return block;
+    }
+
+    void release()
+    {
+        for( void* block : m_blocks )
+        {
+            ::operator delete( block );
+        }
+        m_blocks.clear();
+    }
+};
+
+static void benchAllocation( Suite& suite, LInterpreter& interpreter )
+{
+    constexpr size_t cListSize = 10000;
+    constexpr size_t cRounds   = 100;
+    constexpr double cAllocationCount = 2.0 * cListSize * cRounds;
+
+    auto churn = [&]( SExprAllocator& allocator, const std::function<void()>& release )
+    {
+        for( size_t round = 0; round < cRounds; round++ )
+        {
+            {
+                AllocatorScope scope( allocator );
+                List* list = nullptr;
+                for( size_t i = 0; i < cListSize; i++ )
+                {
+                    list = new List( new Double( double(i) ), list );
+                }
+            }
+            release();
+        }
+    };
+
+    if ( suite.isSelected( "alloc/churn/new" ) )
+    {
+        NewDeleteAllocator allocator;
+        double seconds = Suite::bestSeconds( [&] { churn( allocator, [&] { allocator.release(); } ); } );
+        suite.add( { "alloc/churn/new", Suite::cRuns, seconds, 0, cAllocationCount / seconds } );
+    }
+    if ( suite.isSelected( "alloc/churn/arena" ) )
+    {
+        Arena allocator;
+        double seconds = Suite::bestSeconds( [&] { churn( allocator, [&] { allocator.reset(); } ); } );
+        suite.add( { "alloc/churn/arena", Suite::cRuns, seconds, 0, cAllocationCount / seconds } );
+    }
+
+    interpreter.eval( "(defun dsum (n acc) (if (< n 1) acc (dsum (- n 1) (+ acc 0.5))))" );
+    Arena arena;
+    Parser parser;
+    interpreter.initParser( parser );
+    for( bool useVirtualMachine : { false, true } )
+    {
+        std::string name = useVirtualMachine ? "alloc/doubles/vm" : "alloc/doubles/tree";
+        if ( ! suite.isSelected( name ) )
+        {
+            continue;
+        }
+
+        ISExpr* call;
+        {
+            AllocatorScope scope( arena );
+            parser.setSource( "(dsum 200000 0.5)" );
+            call = parser.parse();
+        }
+
+        interpreter.setUseVirtualMachine( useVirtualMachine );
+        double seconds = Suite::bestSeconds( [&] { interpreter.evalForm( call, arena ); } );
+        suite.add( { name, Suite::cRuns, seconds, 0, 200000 / seconds } );
+    }
+    interpreter.setUseVirtualMachine( false );
+}
+
+//
+// Integer arithmetic on tagged immediates (fixnums) against boxed IntNumber-s,
+// as every integer was before (values above 2^62 are still boxed): 10M
+// additions by Arithmetic (boxed results go to an Arena), then a loop of
+// user function calls adding to an accumulator (items are additions)
+//
+static void benchFixnums( Suite& suite, LInterpreter& interpreter )
+{
+    constexpr int64_t cBoxedBase = int64_t(1) << 62;
+    constexpr size_t  cAddCount  = 10'000'000;
+
+    for( bool isBoxed : { false, true } )
+    {
+        std::string name = isBoxed ? "fixnum/add/boxed" : "fixnum/add/fixnum";
+        if ( ! suite.isSelected( name ) )
+        {
+            continue;
+        }
+
+        Arena arena;
+        AllocatorScope scope( arena );
+        ISExpr* step = IntNumber::make( 3 );
+        ISExpr* sum = nullptr;
+        double seconds = Suite::bestSeconds( [&]
+        {
+            arena.reset();
+            sum = IntNumber::make( isBoxed ? cBoxedBase : 0 );
+            for( size_t i = 0; i < cAddCount; i++ )
+            {
+                sum = Arithmetic::apply2( Arithmetic::ADD, sum, step );
+            }
+        });
+        if ( sum->isFixnum() == isBoxed )
+        {
+            std::fprintf( stderr, "%s: the sum is not of the measured representation\n", name.c_str() );
+        }
+        suite.add( { name, Suite::cRuns, seconds, 0, cAddCount / seconds } );
+    }
+
+    interpreter.eval( "(defun isum (n acc step) (if (< n 1) acc (isum (- n 1) (+ acc step) step)))" );
+    Arena arena;
+    Parser parser;
+    interpreter.initParser( parser );
+    for( bool useVirtualMachine : { false, true } )
+    {
+        for( bool isBoxed : { false, true } )
+        {
+            std::string name = std::string( isBoxed ? "fixnum/loop/boxed" : "fixnum/loop/fixnum" ) + ( useVirtualMachine ? "/vm" : "/tree" );
+            if ( ! suite.isSelected( name ) )
+            {
+                continue;
+            }
+
+            ISExpr* call;
+            {
+                AllocatorScope scope( arena );
+                parser.setSource( isBoxed ? "(isum 200000 4611686018427387904 3)" : "(isum 200000 0 3)" );
+                call = parser.parse();
+            }
+
+            interpreter.setUseVirtualMachine( useVirtualMachine );
+            double seconds = Suite::bestSeconds( [&] { interpreter.evalForm( call, arena ); } );
+            suite.add( { name, Suite::cRuns, seconds, 0, 200000 / seconds } );
+        }
+    }
+    interpreter.setUseVirtualMachine( false );
+}
+
+//
+// Independent interpreters on 1, 2, 4... threads: every thread runs all workloads
+// on an LInterpreter of its own (items as of the workloads). The output of every
+// thread must be the same as the one of a single interpreter.
+//
+static std::string runWorkloads()
+{
+    std::ostringstream output;
+    LInterpreter interpreter;
+    interpreter.setOutput( output );
+    for( const Workload& workload : cWorkloads )
+    {
+        interpreter.eval( workload.m_definition );
+        std::string call = std::string( "(print " ) + workload.m_call + ")";
+        interpreter.eval( call );
+    }
+    interpreter.flushOutput();
+    return output.str();
+}
+
+static bool benchInstances( Suite& suite )
+{
+    unsigned maxThreadCount = std::max( 4u, std::thread::hardware_concurrency() );
+    std::string expected;
+    bool isOk = true;
+    for( unsigned threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2 )
+    {
+        std::string name = "instances/" + std::to_string( threadCount );
+        if ( ! suite.isSelected( name ) )
+        {
+            continue;
+        }
+        if ( expected.empty() )
+        {
+            expected = runWorkloads();
+        }
+
+        std::vector<std::string> outputs( threadCount );
+        double seconds = Suite::bestSeconds( [&]
+        {
+            std::vector<std::thread> threads;
+            for( unsigned i = 0; i < threadCount; i++ )
+            {
+                threads.emplace_back( [&outputs,i] { outputs[i] = runWorkloads(); } );
+            }
+            for( auto& thread : threads )
+            {
+                thread.join();
+            }
+        }, 3 );
+
+        for( unsigned i = 0; i < threadCount; i++ )
+        {
+            if ( outputs[i] != expected )
+            {
+                std::fprintf( stderr, "%s: output of thread %u differs from the one of a single interpreter\n", name.c_str(), i );
+                isOk = false;
+            }
+        }
+        double itemCount = 0;
+        for( const Workload& workload : cWorkloads )
+        {
+            itemCount += workload.m_itemCount;
+        }
+        suite.add( { name, 3, seconds, 0, itemCount * threadCount / seconds } );
+    }
+    return isOk;
+}
+
+//
+// pmap of fib over 64 growing numbers on 1, 2, 4 and 8 worker threads (items are
+// elements); the result must be the same on any number of threads
+//
+static bool benchParallel( Suite& suite )
+{
+    LInterpreter interpreter;
+    interpreter.eval( "(defun fib (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))" );
+    // the cost grows along the list, so the workers of the last chunks steal
+    interpreter.eval( "(defun range (n l) (if (< n 1) l (range (- n 1) (cons (+ 10 (/ n 8)) l))))" );
+    interpreter.eval( "(set numbers (range 64 nil))" );
+    constexpr double cElementCount = 64;
+
+    // the call is parsed once and evaluated again and again
+    Arena arena;
+    Parser parser;
+    interpreter.initParser( parser );
+    ISExpr* call;
+    {
+        AllocatorScope scope( arena );
+        parser.setSource( "(print (pmap (quote fib) numbers))" );
+        call = parser.parse();
+    }
+
+    std::string expected;
+    bool isOk = true;
+    for( unsigned threadCount : { 1u, 2u, 4u, 8u } )
+    {
+        std::string name = "parallel/pmap/" + std::to_string( threadCount );
+        if ( ! suite.isSelected( name ) )
+        {
+            continue;
+        }
+        interpreter.setParallelThreads( threadCount );
+
+        std::ostringstream output;
+        interpreter.setOutput( output );
+        interpreter.evalForm( call, arena );
+
+        uint64_t steals = interpreter.parallel()->stealCount();
+        double seconds = Suite::bestSeconds( [&]
+        {
+            interpreter.flushOutput();
+            output.str( {} );
+            interpreter.evalForm( call, arena );
+        });
+        steals = interpreter.parallel()->stealCount() - steals;
+        interpreter.setOutput( std::cout );
+
+        if ( expected.empty() )
+        {
+            expected = output.str();
+        }
+        else if ( output.str() != expected )
+        {
+            std::fprintf( stderr, "%s: result differs from the one of 1 thread\n", name.c_str() );
+            isOk = false;
+        }
+
+        Suite::Result result{ name, Suite::cRuns, seconds, 0, cElementCount / seconds };
+        result.m_counters.push_back( { "steals_per_second", double( steals ) / (seconds * Suite::cRuns) } );
+        suite.add( result );
+    }
+    return isOk;
+}
+
+//
+// Startup with a library of 1000 functions: a new interpreter and evalFile of
+// the library text against loadSnapshot of its image (items are functions)
+//
+static std::string generateLibrary( size_t functionCount )
+{
+    std::string text;
+    for( size_t i = 0; i < functionCount; i++ )
+    {
+        std::string name = "f" + std::to_string( i );
+        std::string previous = (i == 0) ? "+" : "f" + std::to_string( i - 1 );
+        text += "(defun " + name + " (a b) (if (< a 1) b (" + previous + " (- a 1) (+ b (* a 2) (quote 3)))))\n";
+    }
+    text += "(set table (quote (1 2.5 (a b) (c (d e)) 100000000000000000)))\n";
+    return text;
+}
+
+static bool benchStartup( Suite& suite )
+{
+    constexpr size_t cFunctionCount = 1000;
+    auto directory = std::filesystem::temp_directory_path();
+    std::string textFileName  = ( directory / "lisp-bench-library.lisp" ).string();
+    std::string imageFileName = ( directory / "lisp-bench-library.img" ).string();
+    {
+        std::ofstream file( textFileName );
+        file << generateLibrary( cFunctionCount );
+    }
+    {
+        LInterpreter interpreter;
+        interpreter.evalFile( textFileName );
+        interpreter.saveSnapshot( imageFileName );
+    }
+
+    // output of a call of the last function (it calls all the others)
+    auto check = []( LInterpreter& interpreter )
+    {
+        std::ostringstream output;
+        interpreter.setOutput( output );
+        interpreter.eval( "(print (f999 999 0))" );
+        interpreter.eval( "(print table)" );
+        interpreter.setOutput( std::cout );
+        return output.str();
+    };
+
+    bool isOk = true;
+    std::string expected;
+    for( bool useImage : { false, true } )
+    {
+        std::string name = useImage ? "startup/image" : "startup/text";
+        if ( ! suite.isSelected( name ) )
+        {
+            continue;
+        }
+
+        double seconds = Suite::bestSeconds( [&]
+        {
+            LInterpreter interpreter;
+            if ( useImage )
+            {
+                interpreter.loadSnapshot( imageFileName );
+            }
+            else
+            {
+                interpreter.evalFile( textFileName );
+            }
+        }, 3 );
+
+        LInterpreter interpreter;
+        bool isLoaded = useImage ? interpreter.loadSnapshot( imageFileName ) : interpreter.evalFile( textFileName ) != nullptr;
+        if ( isLoaded )
+        {
+            std::string output = check( interpreter );
+            if ( expected.empty() )
+            {
+                expected = output;
+            }
+            else if ( output != expected )
+            {
+                std::fprintf( stderr, "%s: functions of the image differ from the ones of the text\n", name.c_str() );
+                isOk = false;
+            }
+        }
+        suite.add( { name, 3, seconds, 0, cFunctionCount / seconds } );
+    }
+
+    std::filesystem::remove( textFileName );
+    std::filesystem::remove( imageFileName );
+    return isOk;
+}
+
+//
+// Builtin calls: the calling convention of LInterpreter (a function pointer
+// with evaluated arguments) against the former one (std::function returned
+// by value, arguments fetched and evaluated from the list by the builtin)
+//
+struct ListBuiltin
+{
+    std::function< ISExpr* (List*) > m_lambdaFunc;
+    std::function< ISExpr* (List*) > func() const { return m_lambdaFunc; }
+};
+
+static void benchBuiltinCalls( Suite& suite, LInterpreter& interpreter )
+{
+    interpreter.eval( "(set x 7)" );
+    interpreter.eval( "(set l (quote (a b c)))" );
+
+    auto& nil = interpreter.m_nilAtom;
+    ListBuiltin listSub{ [&]( List* expr ) -> ISExpr* {
+        auto* value1 = interpreter.eval( expr->m_car );
+        auto* value2 = interpreter.eval( expr->m_cdr->m_car );
+        return IntNumber::make( value1->toIntNumber()->intValue() - value2->toIntNumber()->intValue() );
+    }};
+    ListBuiltin listLess{ [&]( List* expr ) -> ISExpr* {
+        auto value1 = interpreter.eval( expr->m_car )->toNumberBase()->doubleValue();
+        auto value2 = interpreter.eval( expr->m_cdr->m_car )->toNumberBase()->doubleValue();
+        return ( value1 < value2 ) ? interpreter.m_trueAtom : nil;
+    }};
+    ListBuiltin listCar{ [&]( List* expr ) -> ISExpr* {
+        auto* list = interpreter.eval( expr->m_car );
+        return ( list->type() == ISExpr::LIST ) ? list->toList()->m_car : nil;
+    }};
+
+    // forms are parsed once, into a region of their own
+    Arena arena;
+    Parser parser;
+    interpreter.initParser( parser );
+    auto parse = [&]( const char* text ) -> List*
+    {
+        AllocatorScope scope( arena );
+        parser.setSource( text );
+        return parser.parse()->toList();
+    };
+
+    constexpr size_t cCallCount = 10'000'000;
+    auto callRate = [&]( const std::function<void()>& call )
+    {
+        return Suite::bestSeconds( [&]
+        {
+            for( size_t i = 0; i < cCallCount; i++ )
+            {
+                call();
+            }
+        });
+    };
+
+    struct Case { const char* m_text; ListBuiltin* m_listBuiltin; };
+    for( auto [text, listBuiltin] : { Case{ "(- x 3)", &listSub }, Case{ "(< x 3)", &listLess }, Case{ "(car l)", &listCar } } )
+    {
+        std::string name = std::string("builtin/") + text;
+        if ( ! suite.isSelected( name ) )
+        {
+            continue;
+        }
+
+        List* form = parse( text );
+        BuiltinFunc* func = form->m_car->toBuiltinFunc();
+
+        double listSeconds = callRate( [&] { listBuiltin->func()( form->m_cdr ); } );
+        suite.add( { name + "/std::function", Suite::cRuns, listSeconds, 0, cCallCount / listSeconds } );
+
+        double pointerSeconds = callRate( [&] {
+            ISExpr* args[2];
+            size_t argCount = 0;
+            for( auto* it = form->m_cdr; it != nullptr; it = it->m_cdr )
+            {
+                args[argCount++] = interpreter.eval( it->m_car );
+            }
+            interpreter.callBuiltin( func, args, argCount );
+        });
+        suite.add( { name + "/pointer", Suite::cRuns, pointerSeconds, 0, cCallCount / pointerSeconds } );
+
+        double evalSeconds = callRate( [&] { interpreter.eval( form ); } );
+        suite.add( { name + "/eval", Suite::cRuns, evalSeconds, 0, cCallCount / evalSeconds } );
+    }
+}
+
+//
+// Arithmetic and comparisons: every operator on two integers, two doubles and
+// an integer and a double (the call is evaluated again and again, items are
+// calls). Before, the cases of cArithmeticCases are checked: folded, by the
+// tree walker and by the virtual machine; the exit code is 1 when a result
+// is not the expected one.
+//
+struct ArithmeticCase
+{
+    const char* m_form;
+    const char* m_expected;
+};
+
+static const ArithmeticCase cArithmeticCases[] =
+{
+    { "(+)", "0" },                     { "(*)", "1" },
+    { "(+ 7)", "7" },                   { "(- 7)", "-7" },
+    { "(/ 4)", "0.25" },                { "(- 2.5)", "-2.5" },
+    { "(+ 1 2 3 4)", "10" },            { "(- 10 1 2)", "7" },
+    { "(* 2 3 4)", "24" },              { "(/ 1 2 2)", "0.25" },
+    { "(/ 6 3)", "2" },                 { "(/ 7 2)", "3.5" },
+    { "(+ 1 2.5)", "3.5" },             { "(+ 2.5 1)", "3.5" },
+    { "(- 1 0.5 2)", "-1.5" },          { "(* 3 2.5)", "7.5" },
+    { "(* 0.5 4 3)", "6" },             { "(+ 0.1 0.2)", "0.30000000000000004" },
+    // fixnum boundary and int64 overflow (then BigInt)
+    { "(+ 4611686018427387903 1)", "4611686018427387904" },
+    { "(- -4611686018427387904 1)", "-4611686018427387905" },
+    { "(+ 9223372036854775807 0)", "9223372036854775807" },
+    { "(+ 9223372036854775807 1)", "9223372036854775808" },
+    { "(- -9223372036854775807 10)", "-9223372036854775817" },
+    { "(* 3037000499 3037000499)", "9223372030926249001" },
+    { "(* 3037000500 3037000500)", "9223372037000250000" },
+    { "(* 4611686018427387904 4 0.5)", "9223372036854775808" },
+    { "(- 9223372036854775807 -1 1)", "9223372036854775807" },
+    // comparisons
+    { "(< 1 2)", "t" },                 { "(< 2 1)", "nil" },
+    { "(< 1 2 3)", "t" },               { "(< 1 3 2)", "nil" },
+    { "(> 3 2 1)", "t" },               { "(> 3 3)", "nil" },
+    { "(= 2 2 2.0)", "t" },             { "(= 1 2)", "nil" },
+    { "(<= 1 1 2)", "t" },              { "(<= 2 1)", "nil" },
+    { "(>= 2 2 1)", "t" },              { "(>= 2 2 3)", "nil" },
+    { "(< 1 2.5)", "t" },               { "(> 1.5 1)", "t" },
+    { "(< 7)", "t" },
+    { "(< 9007199254740992 9007199254740993)", "t" },
+    { "(= 9007199254740992 9007199254740993)", "nil" },
+};
+
+static bool checkArithmetic( LInterpreter& interpreter )
+{
+    bool isOk = true;
+    std::ostringstream output;
+    interpreter.setOutput( output );
+    for( const char* mode : { "folded", "tree", "vm" } )
+    {
+        interpreter.setFoldConstants( std::string_view( mode ) == "folded" );
+        interpreter.setUseVirtualMachine( std::string_view( mode ) == "vm" );
+        for( const ArithmeticCase& arithmeticCase : cArithmeticCases )
+        {
+            interpreter.flushOutput();
+            output.str( {} );
+            interpreter.eval( std::string( "(print " ) + arithmeticCase.m_form + ")" );
+            interpreter.flushOutput();
+            if ( output.str() != arithmeticCase.m_expected )
+            {
+                std::fprintf( stderr, "numeric (%s): %s -> %s, expected %s\n",
+                              mode, arithmeticCase.m_form, output.str().c_str(), arithmeticCase.m_expected );
+                isOk = false;
+            }
+        }
+    }
+    interpreter.setFoldConstants( true );
+    interpreter.setUseVirtualMachine( false );
+    interpreter.setOutput( std::cout );
+    return isOk;
+}
+
+static bool benchArithmetic( Suite& suite, LInterpreter& interpreter )
+{
+    bool isOk = true;
+    if ( suite.isSelected( "numeric/" ) )
+    {
+        isOk = checkArithmetic( interpreter );
+    }
+
+    interpreter.eval( "(set i1 1234567)" );
+    interpreter.eval( "(set i2 89)" );
+    interpreter.eval( "(set d1 1234.5)" );
+    interpreter.eval( "(set d2 8.25)" );
+
+    Arena arena;
+    Parser parser;
+    interpreter.initParser( parser );
+
+    constexpr size_t cCallCount = 1'000'000;
+    struct Operands { const char* m_name; const char* m_text; };
+    for( const char* op : { "+", "-", "*", "/", "<", ">", "=", "<=", ">=" } )
+    {
+        for( auto [kind, operands] : { Operands{ "int", "i1 i2" }, Operands{ "double", "d1 d2" }, Operands{ "mixed", "i1 d2" } } )
+        {
+            std::string name = std::string( "numeric/" ) + op + "/" + kind;
+            if ( ! suite.isSelected( name ) )
+            {
+                continue;
+            }
+
+            std::string text = std::string( "(" ) + op + " " + operands + ")";
+            ISExpr* form;
+            {
+                AllocatorScope scope( arena );
+                parser.setSource( text );
+                form = parser.parse();
+            }
+
+            double seconds = Suite::bestSeconds( [&]
+            {
+                for( size_t i = 0; i < cCallCount; i++ )
+                {
+                    interpreter.evalForm( form, arena );
+                }
+            });
+            suite.add( { name, Suite::cRuns, seconds, 0, cCallCount / seconds } );
+        }
+    }
+    return isOk;
+}
+
+//
+// BigInt: factorials (a growing number times a small one), powers by repeated
+// multiplication and by repeated squaring (two equal long numbers: Karatsuba
+// from BigValue::cKaratsubaLimbs limbs on); items are multiplications.
+// 3^4096 by both ways must be the same: the exit code is 1 otherwise.
+//
+static bool benchBigInt( Suite& suite, LInterpreter& interpreter )
+{
+    interpreter.eval( "(defun fact (n acc) (if (< n 1) acc (fact (- n 1) (* acc n))))" );
+    interpreter.eval( "(defun pow (x n acc) (if (< n 1) acc (pow x (- n 1) (* acc x))))" );
+    interpreter.eval( "(defun squares (x n) (if (< n 1) x (squares (* x x) (- n 1))))" );
+
+    bool isOk = true;
+    if ( suite.isSelected( "bigint/" ) )
+    {
+        std::ostringstream output;
+        interpreter.setOutput( output );
+        interpreter.eval( "(print (= (squares 3 12) (pow 3 4096 1)))" );
+        interpreter.flushOutput();
+        interpreter.setOutput( std::cout );
+        if ( output.str() != "t" )
+        {
+            std::fprintf( stderr, "bigint: 3^4096 by squaring differs from the one by multiplication\n" );
+            isOk = false;
+        }
+    }
+
+    Arena arena;
+    Parser parser;
+    interpreter.initParser( parser );
+
+    struct Case { const char* m_name; const char* m_call; double m_multiplications; };
+    static const Case cCases[] =
+    {
+        { "bigint/factorial/1000",   "(fact 1000 1)",      1000 },
+        { "bigint/factorial/5000",   "(fact 5000 1)",      5000 },
+        { "bigint/power/7^5000",     "(pow 7 5000 1)",     5000 },
+        { "bigint/power/3^(2^16)",   "(squares 3 16)",     16 },
+        { "bigint/power/3^(2^18)",   "(squares 3 18)",     18 },
+    };
+    for( const Case& bigIntCase : cCases )
+    {
+        if ( ! suite.isSelected( bigIntCase.m_name ) )
+        {
+            continue;
+        }
+
+        ISExpr* call;
+        {
+            AllocatorScope scope( arena );
+            parser.setSource( bigIntCase.m_call );
+            call = parser.parse();
+        }
+
+        double seconds = Suite::bestSeconds( [&] { interpreter.evalForm( call, arena ); } );
+        suite.add( { bigIntCase.m_name, Suite::cRuns, seconds, 0, bigIntCase.m_multiplications / seconds } );
+    }
+    return isOk;
+}
+
+//
+// Output and errors in the order they were written: print is buffered (see
+// OutputBuffer), errors go to std::cerr (here both go to one stream); the
+// exit code is 1 otherwise
+//
+static bool checkOutputOrder( LInterpreter& interpreter )
+{
+    bool isOk = true;
+    std::ostringstream output;
+    std::streambuf* savedErrors = std::cerr.rdbuf( output.rdbuf() );
+    interpreter.setOutput( output );
+    for( bool useVirtualMachine : { false, true } )
+    {
+        interpreter.setUseVirtualMachine( useVirtualMachine );
+        output.str( {} );
+        for( const char* form : { "(print 1)", "(print 2)", "(print (/ 1 0))", "(print 3)" } )
+        {
+            interpreter.eval( form );
+        }
+        interpreter.flushOutput();
+        if ( output.str() != "12🟥 divide by 0\ninf3" )
+        {
+            std::fprintf( stderr, "output (%s): errors out of order: %s\n", useVirtualMachine ? "vm" : "tree", output.str().c_str() );
+            isOk = false;
+        }
+    }
+    interpreter.setUseVirtualMachine( false );
+    interpreter.setOutput( std::cout );
+    std::cerr.rdbuf( savedErrors );
+    return isOk;
+}
+
+//
+// Doubles concatenated to atoms by '+' are spelled as print spells them
+// (shortest text that reads back: 1.0000001 and 1e+20, not 1 and 100000000000000000000)
+//
+static bool checkConcatenation( LInterpreter& interpreter )
+{
+    bool isOk = true;
+    std::ostringstream output;
+    interpreter.setOutput( output );
+    auto printed = [&]( const std::string& form )
+    {
+        interpreter.flushOutput();
+        output.str( {} );
+        interpreter.eval( "(print " + form + ")" );
+        interpreter.flushOutput();
+        return output.str();
+    };
+    for( const char* mode : { "folded", "tree", "vm" } )
+    {
+        interpreter.setFoldConstants( std::string_view( mode ) == "folded" );
+        interpreter.setUseVirtualMachine( std::string_view( mode ) == "vm" );
+        for( const char* number : { "0.1", "2.5", "3.0", "-0.5", "1e20", "1.0000001", "0.000001" } )
+        {
+            std::string concatenated = printed( std::string( "(+ (quote a) " ) + number + ")" );
+            std::string expected = "a" + printed( number );
+            if ( concatenated != expected )
+            {
+                std::fprintf( stderr, "concatenation (%s): (+ (quote a) %s) -> %s, expected %s\n",
+                              mode, number, concatenated.c_str(), expected.c_str() );
+                isOk = false;
+            }
+        }
+    }
+    interpreter.setFoldConstants( true );
+    interpreter.setUseVirtualMachine( false );
+    interpreter.setOutput( std::cout );
+    return isOk;
+}
+
+int main( int argc, char* argv[] )
+{
+    std::string jsonFileName;
+    std::string filter;
+    std::string dataFileName;
+    for( int i = 1; i < argc; i++ )
+    {
+        std::string arg = argv[i];
+        if ( arg == "--json" && i+1 < argc )
+        {
+            jsonFileName = argv[++i];
+        }
+        else if ( arg == "--filter" && i+1 < argc )
+        {
+            filter = argv[++i];
+        }
+        else
+        {
+            dataFileName = arg;
+        }
+    }
+
+    std::string generatedData;
+    std::unique_ptr<MappedFile> file;
+    std::string_view source;
+    if ( dataFileName.empty() )
+    {
+        generatedData = generateData( 16*1024*1024 );
+        source = generatedData;
+    }
+    else
+    {
+        file = std::make_unique<MappedFile>( dataFileName );
+        if ( ! file->isOpen() )
+        {
+            std::fprintf( stderr, "cannot open: %s\n", dataFileName.c_str() );
+            return 1;
+        }
+        source = file->view();
+    }
+
+    Suite suite( filter );
+    LInterpreter interpreter;
+
+    for( const char* name : { "scalar", "sse2", "avx2" } )
+    {
+        benchScanner( suite, source, name );
+    }
+    benchParser( suite, interpreter, source );
+    for( const char* name : { "scalar", "sse2", "avx2" } )
+    {
+        benchArrayKernels( suite, name );
+    }
+    benchArraySum( suite, interpreter );
+    benchWorkloads( suite, interpreter );
+    benchAllocation( suite, interpreter );
+    benchFixnums( suite, interpreter );
+    benchBuiltinCalls( suite, interpreter );
+    bool isOk = checkOutputOrder( interpreter );
+    isOk = checkConcatenation( interpreter ) && isOk;
+    isOk = benchArithmetic( suite, interpreter ) && isOk;
+    isOk = benchBigInt( suite, interpreter ) && isOk;
+    isOk = benchInstances( suite ) && isOk;
+    isOk = benchSerialization( suite, interpreter, source.substr( 0, 4*1024*1024 ) ) && isOk;
+    isOk = benchParallel( suite ) && isOk;
+    isOk = benchStartup( suite ) && isOk;
+
+    if ( ! jsonFileName.empty() )
+    {
+        std::ofstream json( jsonFileName );
+        if ( ! json )
+        {
+            std::fprintf( stderr, "cannot write: %s\n", jsonFileName.c_str() );
+            return 1;
+        }
+        suite.writeJson( json );
+    }
+    return isOk ? 0 : 1;
+}